@@ -22,10 +22,8 @@ import pufferlib.pytorch
 
 torch.set_float32_matmul_precision('high')
 
-# Fast Cython GAE implementation
-#import pyximport
-#pyximport.install(setup_args={"include_dirs": np.get_include()})
-from c_gae import compute_gae
+# native GAE implementation, splits env rows across threads
+from cy_impulse_wars import computeAdvantages, sortRollouts
 
 
 def create(config, vecenv, policy, optimizer=None, wandb=None):
@@ -44,10 +42,18 @@ def create(config, vecenv, policy, optimizer=None, wandb=None):
     atn_dtype = vecenv.single_action_space.dtype
     total_agents = vecenv.num_agents
 
+    # obs are stored without the parts that only change when an episode
+    # resets or sudden death walls are spawned
+    static_obs_idxs = None
+    if config.split_obs:
+        static_obs_idxs = getattr(vecenv.driver_env, 'static_obs_idxs', None)
+        if static_obs_idxs is None:
+            raise ValueError('split_obs needs an env with static obs')
+
     lstm = policy.lstm if hasattr(policy, 'lstm') else None
     experience = Experience(config.batch_size, config.bptt_horizon,
         config.minibatch_size, obs_shape, obs_dtype, atn_shape, atn_dtype,
-        config.cpu_offload, config.device, lstm, total_agents)
+        config.cpu_offload, config.device, lstm, total_agents, static_obs_idxs)
 
     uncompiled_policy = policy
 
@@ -154,9 +160,10 @@ def train(data):
         values_np = experience.values_np[idxs]
         rewards_np = experience.rewards_np[idxs]
         # TODO: bootstrap between segment bounds
-        advantages_np = compute_gae(dones_np, values_np,
-            rewards_np, config.gamma, config.gae_lambda)
-        experience.flatten_batch(advantages_np)
+        computeAdvantages(rewards_np, dones_np, values_np,
+            experience.advantages_np, experience.returns_np, experience.row_offsets,
+            config.gamma, config.gae_lambda, config.norm_adv, config.gae_threads)
+        experience.flatten_batch()
 
     # Optimizing the policy and value network
     total_minibatches = experience.num_minibatches * config.update_epochs
@@ -166,8 +173,7 @@ def train(data):
         lstm_state = None
         for mb in range(experience.num_minibatches):
             with profile.train_misc:
-                obs = experience.b_obs[mb]
-                obs = obs.to(config.device)
+                obs = experience.minibatch_obs(mb, config.device)
                 atn = experience.b_actions[mb]
                 log_probs = experience.b_logprobs[mb]
                 val = experience.b_values[mb]
@@ -198,9 +204,9 @@ def train(data):
                     approx_kl = ((ratio - 1) - logratio).mean()
                     clipfrac = ((ratio - 1.0).abs() > config.clip_coef).float().mean()
 
+                # advantages are normalized over the whole batch when
+                # they are computed
                 adv = adv.reshape(-1)
-                if config.norm_adv:
-                    adv = (adv - adv.mean()) / (adv.std() + 1e-8)
 
                 # Policy loss
                 pg_loss1 = -adv * ratio
@@ -253,7 +259,7 @@ def train(data):
             lrnow = frac * config.learning_rate
             data.optimizer.param_groups[0]["lr"] = lrnow
 
-        y_pred = experience.values_np
+        y_pred = values_np
         y_true = experience.returns_np
         var_y = np.var(y_true)
         explained_var = np.nan if var_y == 0 else 1 - np.var(y_true - y_pred) / var_y
@@ -392,7 +398,7 @@ def make_losses():
 class Experience:
     '''Flat tensor storage and array views for faster indexing'''
     def __init__(self, batch_size, bptt_horizon, minibatch_size, obs_shape, obs_dtype, atn_shape, atn_dtype,
-                 cpu_offload=False, device='cuda', lstm=None, lstm_total_agents=0):
+                 cpu_offload=False, device='cuda', lstm=None, total_agents=0, static_obs_idxs=None):
         if minibatch_size is None:
             minibatch_size = batch_size
 
@@ -400,7 +406,27 @@ class Experience:
         atn_dtype = pufferlib.pytorch.numpy_to_torch_dtype_dict[atn_dtype]
         pin = device == 'cuda' and cpu_offload
         obs_device = device if not pin else 'cpu'
-        self.obs=torch.zeros(batch_size, *obs_shape, dtype=obs_dtype,
+        # if static obs idxs are set only the rest of the obs are stored
+        # in obs, and the static parts of the obs are stored once in
+        # planes each time they change and referenced by plane_ids
+        self.obs_shape = obs_shape
+        self.obs_dtype = obs_dtype
+        self.static_obs_idxs = self.dynamic_obs_idxs = None
+        stored_obs_shape = obs_shape
+        if static_obs_idxs is not None:
+            assert len(obs_shape) == 1
+            is_static = np.zeros(obs_shape[0], dtype=bool)
+            is_static[static_obs_idxs] = True
+            self.static_obs_idxs = torch.as_tensor(np.flatnonzero(is_static), device=obs_device)
+            self.dynamic_obs_idxs = torch.as_tensor(np.flatnonzero(~is_static), device=obs_device)
+            stored_obs_shape = (len(self.dynamic_obs_idxs),)
+            self.plane_ids = torch.zeros(batch_size, dtype=torch.int64, device=obs_device)
+            self.planes = torch.zeros(max(total_agents, 1), len(self.static_obs_idxs),
+                dtype=obs_dtype, device=obs_device)
+            self.num_planes = 0
+            # the plane of each agent's last stored obs
+            self.agent_planes = torch.full((total_agents,), -1, dtype=torch.int64, device=obs_device)
+        self.obs=torch.zeros(batch_size, *stored_obs_shape, dtype=obs_dtype,
             pin_memory=pin, device=device if not pin else 'cpu')
         self.actions=torch.zeros(batch_size, *atn_shape, dtype=atn_dtype, pin_memory=pin)
         self.logprobs=torch.zeros(batch_size, pin_memory=pin)
@@ -416,11 +442,19 @@ class Experience:
         self.dones_np = np.asarray(self.dones)
         self.truncateds_np = np.asarray(self.truncateds)
         self.values_np = np.asarray(self.values)
+        # written in the order of the sorted training data
+        self.advantages_np = np.zeros(batch_size, dtype=np.float32)
+        self.returns_np = np.zeros(batch_size, dtype=np.float32)
+        # steps are sorted by the env id they are stored with
+        self.env_ids_np = np.zeros(batch_size, dtype=np.int32)
+        self.row_offsets = np.zeros(total_agents + 1, dtype=np.int64)
+        self.sorted_idxs = np.zeros(batch_size, dtype=np.int64)
+        self.segment_idxs = np.zeros(batch_size, dtype=np.int64)
 
         self.lstm_h = self.lstm_c = None
         if lstm is not None:
-            assert lstm_total_agents > 0
-            shape = (lstm.num_layers, lstm_total_agents, lstm.hidden_size)
+            assert total_agents > 0
+            shape = (lstm.num_layers, total_agents, lstm.hidden_size)
             self.lstm_h = torch.zeros(shape).to(device)
             self.lstm_c = torch.zeros(shape).to(device)
 
@@ -438,7 +472,6 @@ class Experience:
         self.bptt_horizon = bptt_horizon
         self.minibatch_size = minibatch_size
         self.device = device
-        self.sort_keys = []
         self.ptr = 0
         self.step = 0
 
@@ -452,30 +485,84 @@ class Experience:
         indices = torch.where(mask)[0].numpy()[:self.batch_size - ptr]
         end = ptr + len(indices)
  
-        self.obs[ptr:end] = obs.to(self.obs.device)[indices]
+        obs = obs.to(self.obs.device)[indices]
+        if self.static_obs_idxs is None:
+            self.obs[ptr:end] = obs
+        else:
+            self.store_split_obs(obs, env_id, indices, ptr, end)
         self.values_np[ptr:end] = value.cpu().numpy()[indices]
         self.actions_np[ptr:end] = action[indices]
         self.logprobs_np[ptr:end] = logprob.cpu().numpy()[indices]
         self.rewards_np[ptr:end] = reward.cpu().numpy()[indices]
         self.dones_np[ptr:end] = done.cpu().numpy()[indices]
-        self.sort_keys.extend([(env_id[i], self.step) for i in indices])
+        self.env_ids_np[ptr:end] = np.asarray(env_id, dtype=np.int32)[indices]
         self.ptr = end
         self.step += 1
 
+    def store_split_obs(self, obs, env_id, indices, ptr, end):
+        # planes are only kept for the batch being collected
+        if ptr == 0:
+            self.num_planes = 0
+            self.agent_planes.fill_(-1)
+
+        static = obs[:, self.static_obs_idxs]
+        agents = torch.as_tensor(np.asarray(env_id)[indices], device=self.obs.device)
+        plane_ids = self.agent_planes[agents]
+        # obs are compared to the agent's last plane, which is the same
+        # until its env resets or spawns sudden death walls
+        known = plane_ids >= 0
+        unchanged = known.clone()
+        unchanged[known] = (self.planes[plane_ids[known]] == static[known]).all(dim=1)
+        changed = torch.nonzero(~unchanged).squeeze(1)
+
+        num_changed = len(changed)
+        if num_changed > 0:
+            if self.num_planes + num_changed > len(self.planes):
+                capacity = max(2 * len(self.planes), self.num_planes + num_changed)
+                planes = torch.zeros(capacity, self.planes.shape[1],
+                    dtype=self.planes.dtype, device=self.planes.device)
+                planes[:self.num_planes] = self.planes[:self.num_planes]
+                self.planes = planes
+            new_ids = torch.arange(self.num_planes, self.num_planes + num_changed, device=self.obs.device)
+            self.planes[new_ids] = static[changed]
+            plane_ids[changed] = new_ids
+            self.agent_planes[agents] = plane_ids
+            self.num_planes += num_changed
+
+        self.plane_ids[ptr:end] = plane_ids
+        self.obs[ptr:end] = obs[:, self.dynamic_obs_idxs]
+
+    def minibatch_obs(self, mb, device):
+        obs = self.b_obs[mb]
+        if self.static_obs_idxs is None:
+            return obs.to(device)
+
+        # full obs are only built for one minibatch at a time, after the
+        # smaller split obs are moved to the device
+        static = self.planes[self.b_plane_ids[mb]].to(device)
+        dynamic = obs.to(device)
+        full = torch.empty(*dynamic.shape[:-1], *self.obs_shape, dtype=self.obs_dtype, device=device)
+        full[..., self.dynamic_obs_idxs.to(device)] = dynamic
+        full[..., self.static_obs_idxs.to(device)] = static
+        return full
+
     def sort_training_data(self):
-        idxs = np.asarray(sorted(
-            range(len(self.sort_keys)), key=self.sort_keys.__getitem__))
-        self.b_idxs_obs = torch.as_tensor(idxs.reshape(
-                self.minibatch_rows, self.num_minibatches, self.bptt_horizon
-            ).transpose(1,0,-1)).to(self.obs.device).long()
+        # steps are stored in the order they were taken, so a stable sort
+        # by env id orders them by env then step. The sorted data is env
+        # major, every env's steps are a row
+        sortRollouts(self.env_ids_np, self.row_offsets, self.sorted_idxs,
+            self.segment_idxs, self.bptt_horizon, self.num_minibatches)
+        self.b_idxs_obs = torch.as_tensor(self.segment_idxs.reshape(
+                self.num_minibatches, self.minibatch_rows, self.bptt_horizon
+            )).to(self.obs.device)
         self.b_idxs = self.b_idxs_obs.to(self.device)
         self.b_idxs_flat = self.b_idxs.reshape(
             self.num_minibatches, self.minibatch_size)
-        self.sort_keys = []
-        return idxs
+        return self.sorted_idxs
 
-    def flatten_batch(self, advantages_np):
-        advantages = torch.as_tensor(advantages_np).to(self.device)
+    def flatten_batch(self):
+        advantages = torch.as_tensor(self.advantages_np).to(self.device)
+        returns = torch.as_tensor(self.returns_np).to(self.device)
         b_idxs, b_flat = self.b_idxs, self.b_idxs_flat
         self.b_actions = self.actions.to(self.device, non_blocking=True)
         self.b_logprobs = self.logprobs.to(self.device, non_blocking=True)
@@ -484,13 +571,16 @@ class Experience:
         self.b_advantages = advantages.reshape(self.minibatch_rows,
             self.num_minibatches, self.bptt_horizon).transpose(0, 1).reshape(
             self.num_minibatches, self.minibatch_size)
-        self.returns_np = advantages_np + self.values_np
+        self.b_returns = returns.reshape(self.minibatch_rows,
+            self.num_minibatches, self.bptt_horizon).transpose(0, 1).reshape(
+            self.num_minibatches, self.minibatch_size)
         self.b_obs = self.obs[self.b_idxs_obs]
+        if self.static_obs_idxs is not None:
+            self.b_plane_ids = self.plane_ids[self.b_idxs_obs]
         self.b_actions = self.b_actions[b_idxs].contiguous()
         self.b_logprobs = self.b_logprobs[b_idxs]
         self.b_dones = self.b_dones[b_idxs]
         self.b_values = self.b_values[b_flat]
-        self.b_returns = self.b_advantages + self.b_values
 
 class Utilization(Thread):
     def __init__(self, delay=1, maxlen=20):
@@ -1,16 +1,15 @@
-from libc.stdint cimport uint8_t, int8_t, uint16_t, uint64_t
+from libc.stdint cimport uint8_t, int8_t, uint16_t, int32_t, uint32_t, int64_t, uint64_t
 from libc.stdlib cimport calloc, free
 import numpy as np
 import pufferlib
 
-cdef extern from "include/cc_array.h":
-    void* safe_array_get_at(CC_Array* array, size_t index)
-
 cdef extern from "settings.h":
     cdef int ACTION_SIZE
+    cdef const float STAT_QUANTILES[]
 
 from impulse_wars cimport (
     MAX_DRONES,
+    NUM_MAPS,
     OBS_SIZE,
     NUM_WALL_TYPES,
     NUM_WEAPONS,
@@ -20,20 +19,58 @@ from impulse_wars cimport (
     MAP_CELL_OBS_SIZE,
     MAX_MAP_COLUMNS,
     MAX_MAP_ROWS,
+    OBS_MAP_COLUMNS,
+    OBS_MAP_ROWS,
+    PIXEL_OBS_RES,
+    PIXEL_OBS_CHANNELS,
+    PIXEL_MAP_OBS_SIZE,
+    PIXEL_OBS_SIZE,
     env,
     initEnv,
     rayClient,
     createRayClient,
+    createHeadlessRayClient,
     destroyRayClient,
+    envViewer,
+    createEnvViewer,
+    destroyEnvViewer,
     resetEnv,
     stepEnv,
     destroyEnv,
-    LOG_BUFFER_SIZE,
-    logBuffer,
-    logEntry,
-    createLogBuffer,
-    destroyLogBuffer,
-    aggregateAndClearLogBuffer,
+    STATS_BUFFER_SIZE,
+    STAT_FIELDS,
+    NUM_DRONE_STATS,
+    NUM_STAT_QUANTILES,
+    statsAccumulator,
+    createStatsAccumulator,
+    destroyStatsAccumulator,
+    readAndClearStats,
+    envStartRecording,
+    envStopRecording,
+    envStartVideoRecording,
+    envStopVideoRecording,
+    envSetBotType,
+    envSetMapWeights,
+    envSetMapGen,
+    envSetMapLibrary,
+    envSetPixelObs,
+    openMapLibrary,
+    closeMapLibrary,
+    mapFileWriter,
+    createMapFileWriter,
+    addMapToFile,
+    closeMapFileWriter,
+    policyBots,
+    computeGAE,
+    sortRolloutSteps,
+    createPolicyBots,
+    destroyPolicyBots,
+    policyBotsStep,
+    replayReader,
+    openReplay,
+    closeReplay,
+    replayStep,
+    renderEnv,
 )
 
 cdef extern from "box2d/box2d.h":
@@ -71,7 +108,13 @@ cdef extern from "settings.h":
 cdef extern from "types.h":
     # Constants
     cdef const int _MAX_DRONES
+    cdef const int MAX_CELLS
+    cdef const int _ARENA_SIZE_CLASSES
+    cdef const int _NUM_MAPS
     cdef const int _NUM_WEAPONS
+    cdef const int _NUM_LOG_STATS
+    cdef const int _NUM_STAT_QUANTILES
+    cdef const int _NUM_SKETCH_MARKERS
 
     # Enums
     cdef enum entityType:
@@ -96,10 +139,56 @@ cdef extern from "types.h":
         SHOTGUN_WEAPON
         IMPLODER_WEAPON
 
+    cdef enum botType:
+        NO_BOT
+        AIM_NEAREST_BOT
+        STRAFE_BOT
+        PICKUP_SEEKER_BOT
+        DODGE_BOT
+        POLICY_BOT
+
+    cdef enum mapSymmetry:
+        NO_SYMMETRY
+        MIRROR_SYMMETRY
+        QUAD_SYMMETRY
+        ROTATIONAL_SYMMETRY
+
+    cdef enum videoFormat:
+        Y4M_VIDEO
+        PNG_VIDEO
+
     # Structs
+    cdef struct replayRecorder:
+        pass
+
+    cdef struct videoRecorder:
+        pass
+
+    cdef struct snapshotBuffer:
+        pass
+
+    cdef struct envViewer:
+        pass
+
+    ctypedef uint32_t entityHandle
+
     cdef struct entity:
         entityType type
         void *entity
+        uint16_t generation
+        uint16_t nextFree
+
+    cdef struct envArena:
+        uint8_t *blocks
+        uint8_t *current
+        size_t used
+        void *freeLists[_ARENA_SIZE_CLASSES]
+
+    cdef struct entityTable:
+        entity *slots
+        uint16_t size
+        uint16_t capacity
+        uint16_t freeHead
 
     cdef struct mapEntry:
         const char *layout
@@ -111,14 +200,40 @@ cdef extern from "types.h":
         uint16_t weaponPickups
         weaponType defaultWeapon
 
-    cdef struct mapCell:
-        entity *ent
-        b2Vec2 pos
+    cdef struct mapCells:
+        uint16_t count
+        uint8_t wallTypes[MAX_CELLS]
+        uint8_t pickupWeapons[MAX_CELLS]
+        entityHandle entities[MAX_CELLS]
+        b2Vec2 positions[MAX_CELLS]
+        bint droneSpawnBlocked[MAX_CELLS]
 
     cdef struct mapBounds:
         b2Vec2 min
         b2Vec2 max
 
+    cdef struct mapLibrary:
+        uint32_t id
+        void *data
+        size_t size
+        uint32_t numMaps
+        const uint64_t *offsets
+
+    cdef struct mapGenParams:
+        uint8_t columns
+        uint8_t rows
+        float wallDensity
+        float standardWallWeight
+        float bouncyWallWeight
+        float deathWallWeight
+        mapSymmetry symmetry
+        uint8_t floatingStandardWalls
+        uint8_t floatingBouncyWalls
+        uint8_t floatingDeathWalls
+        uint16_t weaponPickups
+        weaponType defaultWeapon
+        uint8_t numDrones
+
     cdef struct cachedPos:
         b2Vec2 pos
         bint valid
@@ -199,20 +314,22 @@ cdef extern from "types.h":
         int killedBy
         int lives
 
-        # New fields for multidiscrete action space
-        uint8_t aim_action
-        uint8_t booster_action
-        uint8_t fire_action
-        uint8_t rotation_speed_action
+    cdef struct quantileSketch:
+        float heights[_NUM_SKETCH_MARKERS]
+        float positions[_NUM_SKETCH_MARKERS]
+        float desired[_NUM_SKETCH_MARKERS]
 
-    cdef struct logEntry:
-        float length
-        droneStats stats[_MAX_DRONES]
+    cdef struct runningStat:
+        float mean
+        float m2
+        float min
+        float max
+        quantileSketch quantiles[_NUM_STAT_QUANTILES]
 
-    cdef struct logBuffer:
-        logEntry *logs
-        uint16_t size
-        uint16_t capacity
+    cdef struct statsAccumulator:
+        uint8_t numDrones
+        uint32_t count
+        runningStat stats[_NUM_LOG_STATS]
 
     cdef struct rayClient:
         float scale
@@ -224,6 +341,8 @@ cdef extern from "types.h":
     cdef struct env:
         uint8_t numDrones
         uint8_t numAgents
+        botType botTypes[_MAX_DRONES]
+        int botActions[_MAX_DRONES * 4]
 
         uint8_t *obs
         float *rewards
@@ -232,20 +351,35 @@ cdef extern from "types.h":
 
         uint64_t randState
         bint needsReset
+        replayRecorder *recorder
+        videoRecorder *videoRecorder
+        bint pixelObs
+        uint8_t *pixelWalls
+        uint32_t pixelWallsVersion
+        snapshotBuffer *snapshotBuffer
 
         uint16_t episodeLength
-        logBuffer *logs
+        statsAccumulator *logs
         droneStats stats[_MAX_DRONES]
 
         b2WorldId worldID
+        uint8_t mapIdx
+        float mapWeights[_NUM_MAPS]
+        bint generateMaps
+        mapGenParams mapGen
+        uint32_t mapPoolSize
+        const mapLibrary *mapLibrary
         uint8_t columns
         uint8_t rows
+        uint16_t obsCellOffset
         mapBounds bounds
         weaponInformation *defaultWeapon
-        CC_Array *cells
+        mapCells cells
         CC_Array *walls
         CC_Array *floatingWalls
-        CC_Array *drones
+        envArena arena
+        entityTable entities
+        droneEntity drones[_MAX_DRONES]
         CC_Array *pickups
         CC_SList *projectiles
 
@@ -254,15 +388,232 @@ cdef extern from "types.h":
         uint8_t suddenDeathWallCounter
 
         rayClient *client
+        uint32_t staticWallsVersion
 
         uint8_t explosionSteps
         b2ExplosionDef explosion
 
+# env server clients, server.h isn't included by env.h as the server is
+# its own executable
+cdef extern from "server.h":
+    cdef const int SERVER_MAGIC
+    cdef const int SERVER_VERSION
+
+    cdef enum serverCommand:
+        SERVER_STEP
+        SERVER_RESET
+        SERVER_LOG
+
+    cdef enum serverStatus:
+        SERVER_OK
+        SERVER_INVALID_REQUEST
+        SERVER_FAILED
+
+    ctypedef struct serverSessionRequest:
+        pass
+
+    ctypedef struct serverSessionReply:
+        pass
+
+    ctypedef struct serverShm:
+        uint32_t magic
+        uint32_t version
+        uint16_t numEnvs
+        uint8_t numDrones
+        uint8_t numAgents
+        uint32_t obsSize
+        uint64_t obsOffset
+        uint64_t actionsOffset
+        uint64_t rewardsOffset
+        uint64_t terminalsOffset
+        uint64_t statsOffset
+        uint64_t size
+
+    uint32_t envServerSend(serverShm *shm, uint32_t command) nogil
+    bint envServerWait(serverShm *shm, uint32_t seq, int sock) nogil
+
 # Wrapper functions for constants
 def maxDrones() -> int:
     return MAX_DRONES
 
 
+def numMaps() -> int:
+    return NUM_MAPS
+
+
+def mapSymmetries() -> dict:
+    return {
+        "none": NO_SYMMETRY,
+        "mirror": MIRROR_SYMMETRY,
+        "quad": QUAD_SYMMETRY,
+        "rotational": ROTATIONAL_SYMMETRY,
+    }
+
+
+def weaponTypes() -> dict:
+    return {
+        "standard": STANDARD_WEAPON,
+        "machinegun": MACHINEGUN_WEAPON,
+        "sniper": SNIPER_WEAPON,
+        "shotgun": SHOTGUN_WEAPON,
+        "imploder": IMPLODER_WEAPON,
+    }
+
+
+def videoFormats() -> dict:
+    return {
+        "y4m": Y4M_VIDEO,
+        "png": PNG_VIDEO,
+    }
+
+
+def writeMapFile(str path, list maps):
+    # writes maps to a map file that can be loaded with the map_file env
+    # argument; maps are dicts with a layout of rows of cell types in the
+    # same format as the predefined maps' layouts, floating wall counts,
+    # a weapon pickup count and a default weapon
+    cdef bytes pathBytes = path.encode()
+    cdef mapFileWriter *writer = createMapFileWriter(pathBytes)
+    if writer == NULL:
+        raise ValueError(f"failed to create map file {path}")
+
+    weapons = weaponTypes()
+    cdef bytes layout
+    cdef uint8_t columns, rows
+    try:
+        for m in maps:
+            rows = len(m["layout"])
+            columns = len(m["layout"][0])
+            if rows > MAX_MAP_ROWS or columns > MAX_MAP_COLUMNS or any(len(row) != columns for row in m["layout"]):
+                raise ValueError(f"map layouts must be rectangular and at most {MAX_MAP_COLUMNS}x{MAX_MAP_ROWS} cells")
+            layout = "".join(m["layout"]).encode()
+            if any(cell not in b"OWBDwbd" for cell in layout):
+                raise ValueError("map layouts can only contain O, W, B, D, w, b and d cells")
+            addMapToFile(
+                writer,
+                layout,
+                columns,
+                rows,
+                m.get("floating_standard_walls", 0),
+                m.get("floating_bouncy_walls", 0),
+                m.get("floating_death_walls", 0),
+                m.get("weapon_pickups", 0),
+                <weaponType><int>weapons[m.get("default_weapon", "standard")],
+            )
+    finally:
+        ok = closeMapFileWriter(writer)
+    if not ok:
+        raise ValueError(f"failed to write map file {path}")
+
+
+def computeAdvantages(
+    float[:] rewards,
+    float[:] dones,
+    float[:] values,
+    float[:] advantages,
+    float[:] returns,
+    int64_t[:] rowOffsets,
+    float gamma,
+    float gaeLambda,
+    bint normalize,
+    int numThreads,
+):
+    # writes the GAE advantages and returns of env major rollout buffers
+    # in place, row i spans [rowOffsets[i], rowOffsets[i + 1]) and
+    # advantages are never carried across rows
+    cdef Py_ssize_t numSteps = rewards.shape[0]
+    if dones.shape[0] != numSteps or values.shape[0] != numSteps or advantages.shape[0] != numSteps or returns.shape[0] != numSteps:
+        raise ValueError("rewards, dones, values, advantages and returns must be the same size")
+    if rowOffsets.shape[0] < 2 or rowOffsets[0] < 0 or rowOffsets[rowOffsets.shape[0] - 1] > numSteps:
+        raise ValueError(f"rowOffsets must have at least 2 offsets that are within the {numSteps} steps")
+    if numSteps == 0:
+        return
+
+    cdef uint32_t numRows = rowOffsets.shape[0] - 1
+    cdef uint8_t threads = min(max(numThreads, 1), 255)
+    computeGAE(&rewards[0], &dones[0], &values[0], &advantages[0], &returns[0], &rowOffsets[0], numRows, gamma, gaeLambda, normalize, threads)
+
+
+def sortRollouts(
+    int32_t[:] envIds,
+    int64_t[:] rowOffsets,
+    int64_t[:] sortedIdxs,
+    int64_t[:] segmentIdxs,
+    uint32_t bpttHorizon,
+    uint32_t numMinibatches,
+):
+    # sorts the stored steps by env id keeping each env's steps in the
+    # order they were stored, see sortRolloutSteps; rowOffsets must have
+    # room for one more offset than there are env ids
+    cdef Py_ssize_t numSteps = envIds.shape[0]
+    if sortedIdxs.shape[0] != numSteps or segmentIdxs.shape[0] != numSteps:
+        raise ValueError("envIds, sortedIdxs and segmentIdxs must be the same size")
+    if rowOffsets.shape[0] < 2 or bpttHorizon == 0 or numMinibatches == 0 or numSteps % (bpttHorizon * numMinibatches) != 0:
+        raise ValueError("the steps must split evenly into minibatches of bpttHorizon step segments")
+    if numSteps == 0:
+        return
+
+    if not sortRolloutSteps(&envIds[0], numSteps, rowOffsets.shape[0] - 1, &rowOffsets[0], &sortedIdxs[0], &segmentIdxs[0], bpttHorizon, numMinibatches):
+        raise ValueError(f"env ids must be less than {rowOffsets.shape[0] - 1}")
+
+
+def serverConstants() -> pufferlib.Namespace:
+    return pufferlib.Namespace(
+        magic=SERVER_MAGIC,
+        version=SERVER_VERSION,
+        requestSize=sizeof(serverSessionRequest),
+        replySize=sizeof(serverSessionReply),
+        step=SERVER_STEP,
+        reset=SERVER_RESET,
+        log=SERVER_LOG,
+        ok=SERVER_OK,
+        invalidRequest=SERVER_INVALID_REQUEST,
+        failed=SERVER_FAILED,
+    )
+
+
+def serverLayout(uint8_t[:] shm) -> dict:
+    # returns the layout of a session's shared memory that was mapped by
+    # a learner, see serverShm
+    if shm.shape[0] < sizeof(serverShm):
+        raise ValueError("shared memory is too small to be an env server session")
+    cdef serverShm *header = <serverShm *>&shm[0]
+    if header.magic != SERVER_MAGIC or header.version != SERVER_VERSION:
+        raise ValueError("shared memory isn't an env server session of this version")
+    if header.size > shm.shape[0]:
+        raise ValueError(f"shared memory is smaller than the session's {header.size} bytes")
+
+    return {
+        "numEnvs": header.numEnvs,
+        "numDrones": header.numDrones,
+        "numAgents": header.numAgents,
+        "obsSize": header.obsSize,
+        "obsOffset": header.obsOffset,
+        "actionsOffset": header.actionsOffset,
+        "rewardsOffset": header.rewardsOffset,
+        "terminalsOffset": header.terminalsOffset,
+        "statsOffset": header.statsOffset,
+        "size": header.size,
+    }
+
+
+def serverSend(uint8_t[:] shm, uint32_t command) -> int:
+    # sends a command to an env server without waiting for it to be done,
+    # returns the sequence number to pass to serverWait
+    return envServerSend(<serverShm *>&shm[0], command)
+
+
+def serverWait(uint8_t[:] shm, uint32_t seq, int sock) -> bool:
+    # waits for the command sent with seq to be done, sock is the fd of
+    # the session's socket; returns False if the server closed the session
+    # or exited
+    cdef serverShm *header = <serverShm *>&shm[0]
+    cdef bint ok
+    with nogil:
+        ok = envServerWait(header, seq, sock)
+    return ok
+
+
 def obsConstants(numDrones: int) -> pufferlib.Namespace:
     return pufferlib.Namespace(
         obsSize=OBS_SIZE,
@@ -274,28 +625,95 @@ def obsConstants(numDrones: int) -> pufferlib.Namespace:
         mapCellObsSize=MAP_CELL_OBS_SIZE,
         maxMapColumns=MAX_MAP_COLUMNS,
         maxMapRows=MAX_MAP_ROWS,
+        obsMapColumns=OBS_MAP_COLUMNS,
+        obsMapRows=OBS_MAP_ROWS,
+        pixelObsRes=PIXEL_OBS_RES,
+        pixelObsChannels=PIXEL_OBS_CHANNELS,
+        pixelMapObsSize=PIXEL_MAP_OBS_SIZE,
+        pixelObsSize=PIXEL_OBS_SIZE,
+    )
+
+
+def botTypes() -> dict:
+    return {
+        "none": NO_BOT,
+        "aim_nearest": AIM_NEAREST_BOT,
+        "strafe": STRAFE_BOT,
+        "pickup_seeker": PICKUP_SEEKER_BOT,
+        "dodge": DODGE_BOT,
+        "policy": POLICY_BOT,
+    }
+
+
+def statsConstants() -> pufferlib.Namespace:
+    return pufferlib.Namespace(
+        statsBufferSize=STATS_BUFFER_SIZE,
+        statFields=STAT_FIELDS,
+        droneStats=NUM_DRONE_STATS,
+        quantiles=[STAT_QUANTILES[i] for i in range(NUM_STAT_QUANTILES)],
+        numWeapons=NUM_WEAPONS,
     )
 
 
+def statsDtype() -> np.dtype:
+    # mirrors the layout written by readAndClearStats, drone stats are
+    # in the same order as the fields of droneStats
+    stat = np.dtype([
+        ("mean", np.float32),
+        ("var", np.float32),
+        ("min", np.float32),
+        ("max", np.float32),
+        ("quantiles", np.float32, (NUM_STAT_QUANTILES,)),
+    ])
+    drone = np.dtype([
+        ("reward", stat),
+        ("distanceTraveled", stat),
+        ("absDistanceTraveled", stat),
+        ("shotsFired", stat, (NUM_WEAPONS,)),
+        ("shotsHit", stat, (NUM_WEAPONS,)),
+        ("shotsTaken", stat, (NUM_WEAPONS,)),
+        ("ownShotsTaken", stat, (NUM_WEAPONS,)),
+        ("weaponsPickedUp", stat, (NUM_WEAPONS,)),
+        ("shotDistances", stat, (NUM_WEAPONS,)),
+        ("wins", stat),
+    ])
+    dtype = np.dtype([
+        ("episodes", np.float32),
+        ("length", stat),
+        ("drones", drone, (MAX_DRONES,)),
+    ])
+    assert dtype.itemsize == STATS_BUFFER_SIZE * sizeof(float)
+    return dtype
+
+
 cdef class CyImpulseWars:
     cdef:
         uint16_t numEnvs
         uint8_t numDrones
+        uint8_t numAgents
         bint render
         env* envs
-        logBuffer *logs
+        statsAccumulator *logs
+        float[:] rawLog
+        object statsView
         rayClient* rayClient
-        int[:, :, :] actions  # Define actions as a 3D integer array
+        envViewer *viewer
+        policyBots *opponents
+        mapLibrary *mapLibrary
 
-    def __init__(self, uint16_t numEnvs, uint8_t numDrones, uint8_t numAgents, uint8_t[:, :] observations, int[:, :, :] discrete_actions, float[:] rewards, uint8_t[:] terminals, uint64_t seed, bint render):
+    def __init__(self, uint16_t numEnvs, uint8_t numDrones, uint8_t numAgents, uint8_t[:, :] observations, int[:, :] actions, float[:] rewards, uint8_t[:] terminals, uint64_t seed, bint render):
         self.numEnvs = numEnvs
         self.numDrones = numDrones
+        self.numAgents = numAgents
         self.render = render
         self.envs = <env*>calloc(numEnvs, sizeof(env))
-        self.logs = createLogBuffer(LOG_BUFFER_SIZE)
+        self.logs = createStatsAccumulator(numDrones)
 
-        # Initialize the actions array
-        self.actions = np.zeros((numEnvs, numDrones, 4), dtype=np.int32).view(dtype=int[:, :, :])
+        # stats are read into the same buffer every report, Python only
+        # ever sees a structured view of it
+        rawLog = np.zeros(STATS_BUFFER_SIZE, dtype=np.float32)
+        self.rawLog = rawLog
+        self.statsView = rawLog.view(statsDtype())
 
         cdef int inc = numAgents
         cdef int i
@@ -305,17 +723,20 @@ cdef class CyImpulseWars:
                 numDrones,
                 numAgents,
                 &observations[i * inc, 0],
-                &self.actions[0, 0, 0],  # Pass the base pointer to actions
+                # every env reads the actions of its agents straight
+                # from the action buffer
+                &actions[i * inc, 0],
                 &rewards[i * inc],
                 &terminals[i * inc],
                 self.logs,
                 seed + i,
             )
-        self.discrete_actions = discrete_actions
 
-
-    cdef _initRaylib(self):
-        self.rayClient = createRayClient()
+    cdef _initRaylib(self, bint headless=False):
+        if headless:
+            self.rayClient = createHeadlessRayClient()
+        else:
+            self.rayClient = createRayClient()
         cdef int i
         for i in range(self.numEnvs):
             self.envs[i].client = self.rayClient
@@ -329,47 +750,220 @@ cdef class CyImpulseWars:
             resetEnv(&self.envs[i])
 
     def step(self):
-        cdef int i, j
-        cdef env* env_instance
-        cdef CC_Array* drone_array
-        cdef droneEntity* drone
-        cdef int aim_action, booster_action, fire_action, rotation_speed_action
+        cdef int i
+        if self.opponents != NULL:
+            policyBotsStep(self.opponents, self.envs)
+
+        for i in range(self.numEnvs):
+            stepEnv(&self.envs[i])
 
+    def setBotTypes(self, list types):
+        # sets the bots of the drones after the agents in every env
+        if len(types) != self.numDrones - self.numAgents:
+            raise ValueError(f"expected {self.numDrones - self.numAgents} bot types, got {len(types)}")
+
+        cdef int i, j
         for i in range(self.numEnvs):
-            env_instance = &self.envs[i]
-            drone_array = env_instance.drones  # Get CC_Array pointer
+            for j in range(len(types)):
+                envSetBotType(&self.envs[i], self.numAgents + j, <botType><int>types[j])
 
-            for j in range(self.numDrones):
-                # Access drone from CC_Array
-                drone = <droneEntity*>safe_array_get_at(drone_array, j)
-                
-                # Extract multidiscrete actions
-                aim_action = self.discrete_actions[i, j, 0]
-                booster_action = self.discrete_actions[i, j, 1]
-                fire_action = self.discrete_actions[i, j, 2]
-                rotation_speed_action = self.discrete_actions[i, j, 3]
+    def setMapWeights(self, list weights):
+        # sets how likely each map is to be picked when an env resets
+        if len(weights) != NUM_MAPS:
+            raise ValueError(f"expected {NUM_MAPS} map weights, got {len(weights)}")
 
-                # Assign actions to the drone
-                drone.aim_action = aim_action
-                drone.booster_action = booster_action
-                drone.fire_action = fire_action
-                drone.rotation_speed_action = rotation_speed_action
+        cdef float[_NUM_MAPS] cWeights
+        cdef int i
+        for i in range(NUM_MAPS):
+            cWeights[i] = weights[i]
+        for i in range(self.numEnvs):
+            envSetMapWeights(&self.envs[i], cWeights)
+
+    def setMapGen(self, dict params, uint32_t poolSize):
+        # every env generates its maps with params instead of picking
+        # predefined maps, params are validated by the caller
+        cdef mapGenParams cParams
+        cParams.columns = params["columns"]
+        cParams.rows = params["rows"]
+        cParams.wallDensity = params["wall_density"]
+        cParams.standardWallWeight = params["standard_wall_weight"]
+        cParams.bouncyWallWeight = params["bouncy_wall_weight"]
+        cParams.deathWallWeight = params["death_wall_weight"]
+        cParams.symmetry = <mapSymmetry><int>params["symmetry"]
+        cParams.floatingStandardWalls = params["floating_standard_walls"]
+        cParams.floatingBouncyWalls = params["floating_bouncy_walls"]
+        cParams.floatingDeathWalls = params["floating_death_walls"]
+        cParams.weaponPickups = params["weapon_pickups"]
+        cParams.defaultWeapon = <weaponType><int>params["default_weapon"]
+        cParams.numDrones = self.numDrones
 
-            # Step the environment
-            stepEnv(env_instance)
+        cdef int i
+        for i in range(self.numEnvs):
+            if not envSetMapGen(&self.envs[i], &cParams, poolSize):
+                raise ValueError(
+                    f"generated maps must fit in the {OBS_MAP_COLUMNS}x{OBS_MAP_ROWS} map obs "
+                    "and have room to spawn every drone, floating wall and weapon pickup"
+                )
+
+    def loadMapFile(self, str path):
+        # every env samples its maps from the map file, the file is
+        # memory mapped so processes loading the same file share it
+        cdef bytes pathBytes = path.encode()
+        cdef mapLibrary *library = openMapLibrary(pathBytes)
+        if library == NULL:
+            raise ValueError(f"failed to load map file {path}")
 
+        cdef int i
+        for i in range(self.numEnvs):
+            envSetMapLibrary(&self.envs[i], library)
+        if self.mapLibrary != NULL:
+            closeMapLibrary(self.mapLibrary)
+        self.mapLibrary = library
+
+    def setPixelObs(self, bint pixelObs):
+        # agents observe pixel obs instead of map cell obs, the obs
+        # buffers must have been sized for them
+        cdef int i
+        for i in range(self.numEnvs):
+            envSetPixelObs(&self.envs[i], pixelObs)
+
+    def loadOpponentPolicy(self, str path, bint quantize=False):
+        # policy bots of every env will be controlled by the exported
+        # policy weights at path
+        cdef bytes pathBytes = path.encode()
+        if self.opponents != NULL:
+            destroyPolicyBots(self.opponents)
+        self.opponents = createPolicyBots(pathBytes, self.numEnvs, quantize)
+        if self.opponents == NULL:
+            raise ValueError(f"failed to load opponent policy {path}")
+
+    def startRecording(self, int envIdx, str path):
+        # episodes of the env will be appended to the replay file
+        # starting with its next episode, only envs on predefined maps
+        # can be recorded
+        cdef bytes pathBytes = path.encode()
+        if not envStartRecording(&self.envs[envIdx], pathBytes):
+            raise ValueError(f"failed to record env {envIdx} to replay file {path}, envs with generated or map file maps can't be recorded")
+
+    def stopRecording(self, int envIdx):
+        envStopRecording(&self.envs[envIdx])
+
+    def startVideoRecording(self, int envIdx, str path, int videoFormat):
+        # the env will be rendered offscreen every step and its frames
+        # written to path on a background thread; envs are rendered with
+        # a hidden window if rendering isn't enabled
+        if self.viewer != NULL:
+            raise ValueError("envs can't be recorded to videos while they are being viewed")
+        if self.rayClient == NULL:
+            self._initRaylib(headless=not self.render)
+        cdef bytes pathBytes = path.encode()
+        if not envStartVideoRecording(&self.envs[envIdx], pathBytes, <videoFormat>videoFormat):
+            raise ValueError(f"failed to record env {envIdx} to video {path}")
+
+    def stopVideoRecording(self, int envIdx):
+        if not envStopVideoRecording(&self.envs[envIdx]):
+            raise IOError(f"failed to write video frames of env {envIdx}")
+
+    def startViewer(self, uint16_t numEnvs, uint16_t fps):
+        # the first numEnvs envs are drawn live in their own window on a
+        # background thread at fps frames per second, stepping never
+        # waits on it
+        if self.rayClient != NULL or self.render:
+            raise ValueError("envs can't be viewed while they are rendered or recorded to videos")
+        if numEnvs == 0 or numEnvs > self.numEnvs or fps == 0:
+            raise ValueError(f"numEnvs must be between 1 and {self.numEnvs} and fps must be positive")
+        if self.viewer != NULL:
+            destroyEnvViewer(self.viewer)
+        self.viewer = createEnvViewer(self.envs, numEnvs, fps)
+
+    def stopViewer(self):
+        if self.viewer != NULL:
+            destroyEnvViewer(self.viewer)
+            self.viewer = NULL
 
     def log(self):
-        cdef logEntry log = aggregateAndClearLogBuffer(self.numDrones, self.logs)
-        return log
+        # the returned view is overwritten by the next call
+        readAndClearStats(self.logs, &self.rawLog[0])
+        return self.statsView
 
     def close(self):
+        self.stopViewer()
+
         cdef int i
         for i in range(self.numEnvs):
             destroyEnv(&self.envs[i])
 
-        destroyLogBuffer(self.logs)
+        destroyStatsAccumulator(self.logs)
         free(self.envs)
 
+        if self.opponents != NULL:
+            destroyPolicyBots(self.opponents)
+
+        if self.mapLibrary != NULL:
+            closeMapLibrary(self.mapLibrary)
+
+        if self.rayClient != NULL:
+            destroyRayClient(self.rayClient)
+
+
+cdef class CyReplay:
+    # re-simulates a recorded replay file, the observations, rewards and
+    # terminals of every replayed step are written to the public arrays
+    cdef:
+        env e
+        replayReader *reader
+        statsAccumulator *logs
+        rayClient* rayClient
+        int[:, :] actions
+        public object observations
+        public object rewards
+        public object terminals
+
+    def __init__(self, str path, bint render=False):
+        cdef bytes pathBytes = path.encode()
+        self.reader = openReplay(pathBytes)
+        if self.reader == NULL:
+            raise ValueError(f"failed to open replay file {path}")
+
+        cdef uint8_t numDrones = self.reader.header.numDrones
+        cdef uint8_t numAgents = self.reader.header.numAgents
+        self.observations = np.zeros((numAgents, OBS_SIZE), dtype=np.uint8)
+        self.rewards = np.zeros(numAgents, dtype=np.float32)
+        self.terminals = np.zeros(numAgents, dtype=np.uint8)
+        self.actions = np.zeros((numAgents, 4), dtype=np.int32)
+        self.logs = createStatsAccumulator(numDrones)
+
+        cdef uint8_t[:, :] observations = self.observations
+        cdef float[:] rewards = self.rewards
+        cdef uint8_t[:] terminals = self.terminals
+        initEnv(
+            &self.e,
+            numDrones,
+            numAgents,
+            &observations[0, 0],
+            &self.actions[0, 0],
+            &rewards[0],
+            &terminals[0],
+            self.logs,
+            0,
+        )
+
+        if render:
+            self.rayClient = createRayClient()
+            self.e.client = self.rayClient
+
+    def step(self) -> bool:
+        # returns False once the replay has ended
+        if not replayStep(self.reader, &self.e):
+            return False
+        if self.rayClient != NULL:
+            renderEnv(&self.e)
+        return True
+
+    def close(self):
+        destroyEnv(&self.e)
+        destroyStatsAccumulator(self.logs)
+        closeReplay(self.reader)
+
         if self.rayClient != NULL:
             destroyRayClient(self.rayClient)
@@ -0,0 +1,201 @@
+import mmap
+import socket
+import struct
+
+import gymnasium
+import numpy as np
+
+import pufferlib
+
+from cy_impulse_wars import (
+    maxDrones,
+    obsConstants,
+    serverConstants,
+    serverLayout,
+    serverSend,
+    serverWait,
+    statsConstants,
+    statsDtype,
+)
+from impulse_wars import transformRawLog
+
+
+# mirrors serverSessionRequest and serverSessionReply in server.h
+sessionRequestFormat = "@IIHBB?Q"
+sessionReplyFormat = "@iQ"
+
+
+class ServerSession:
+    """A session of an env server, holds views of the session's shared memory."""
+
+    def __init__(self, socketPath: str, numEnvs: int, numDrones: int, numAgents: int, pixelObs: bool, seed: int):
+        constants = serverConstants()
+        if struct.calcsize(sessionRequestFormat) != constants.requestSize or struct.calcsize(sessionReplyFormat) != constants.replySize:
+            raise RuntimeError("env server session message formats don't match server.h")
+
+        # the session lasts as long as the socket is open
+        self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_SEQPACKET)
+        try:
+            self.sock.connect(socketPath)
+            self.sock.sendall(
+                struct.pack(
+                    sessionRequestFormat,
+                    constants.magic,
+                    constants.version,
+                    numEnvs,
+                    numDrones,
+                    numAgents,
+                    pixelObs,
+                    seed & 0xFFFFFFFFFFFFFFFF,
+                )
+            )
+            reply, fds, _, _ = socket.recv_fds(self.sock, constants.replySize, 1)
+            if len(reply) != constants.replySize:
+                raise RuntimeError(f"env server at {socketPath} closed the session")
+            status, size = struct.unpack(sessionReplyFormat, reply)
+            if status != constants.ok or len(fds) != 1:
+                raise RuntimeError(f"env server at {socketPath} failed to start the session with status {status}")
+
+            try:
+                self.shm = mmap.mmap(fds[0], size)
+            finally:
+                socket.close(fds[0])
+        except Exception:
+            self.sock.close()
+            raise
+
+        self.shmView = np.frombuffer(self.shm, dtype=np.uint8)
+        layout = serverLayout(self.shmView)
+        numAgents = layout["numEnvs"] * layout["numAgents"]
+        self.obs = self.sharedArray(layout["obsOffset"], np.uint8, (numAgents, layout["obsSize"]))
+        self.actions = self.sharedArray(layout["actionsOffset"], np.int32, (numAgents, 4))
+        self.rewards = self.sharedArray(layout["rewardsOffset"], np.float32, (numAgents,))
+        self.terminals = self.sharedArray(layout["terminalsOffset"], np.uint8, (numAgents,))
+        self.stats = np.frombuffer(self.shm, dtype=statsDtype(), count=1, offset=layout["statsOffset"])
+        self.seq = 0
+
+    def sharedArray(self, offset: int, dtype: np.dtype, shape: tuple) -> np.ndarray:
+        return np.frombuffer(self.shm, dtype=dtype, count=int(np.prod(shape)), offset=offset).reshape(shape)
+
+    def send(self, command: int):
+        self.seq = serverSend(self.shmView, command)
+
+    def wait(self):
+        if not serverWait(self.shmView, self.seq, self.sock.fileno()):
+            raise RuntimeError("env server closed the session or exited")
+
+    def close(self):
+        # the shared memory can't be unmapped while views of it exist
+        del self.obs, self.actions, self.rewards, self.terminals, self.stats, self.shmView
+        self.shm.close()
+        self.sock.close()
+
+
+class RemoteImpulseWars(pufferlib.PufferEnv):
+    """Impulse Wars envs that are stepped by an env server, see server.h.
+
+    The server is started separately with the path of its socket. Envs are
+    split evenly between num_sessions sessions of the server, each session
+    is stepped by its own server thread so sessions are stepped in parallel,
+    though env resets are partly serialized across sessions, see server.h.
+    Obs, actions, rewards and terminals are exchanged through shared
+    memory, so no env processes are needed.
+    """
+
+    def __init__(
+        self,
+        num_envs: int = 1,
+        num_drones: int = 2,
+        num_agents: int = 2,
+        seed: int = 0,
+        pixel_obs: bool = False,
+        socket_path: str = "/tmp/impulse_wars.sock",
+        num_sessions: int = 1,
+        report_interval=16,
+        buf=None,
+    ):
+        if num_drones > maxDrones() or num_drones <= 0:
+            raise ValueError(f"num_drones must greater than 0 and less than or equal to {maxDrones()}")
+        if num_agents > num_drones or num_agents <= 0:
+            raise ValueError(f"num_agents must greater than 0 and less than or equal to num_drones")
+        if num_sessions <= 0 or num_envs % num_sessions != 0:
+            raise ValueError("num_envs must be split evenly between num_sessions sessions")
+
+        self.numDrones = num_drones
+        self.obsInfo = obsConstants(num_drones)
+        self.obsSize = self.obsInfo.pixelObsSize if pixel_obs else self.obsInfo.obsSize
+        self.static_obs_idxs = None
+        if not pixel_obs:
+            self.static_obs_idxs = np.arange(0, self.obsInfo.mapObsSize, self.obsInfo.mapCellObsSize)
+        self.quantileNames = [f"p{round(q * 100)}" for q in statsConstants().quantiles]
+        self.commands = serverConstants()
+
+        self.single_action_space = gymnasium.spaces.MultiDiscrete([17, 5, 2, 4])
+        self.single_observation_space = gymnasium.spaces.Box(
+            low=0.0, high=255, shape=(self.obsSize,), dtype=np.uint8
+        )
+
+        self.report_interval = report_interval
+        self.render_mode = None
+        self.num_agents = num_agents * num_envs
+        self.tick = 0
+
+        super().__init__(buf)
+
+        # sessions are seeded like the envs of an ImpulseWars would be
+        sessionEnvs = num_envs // num_sessions
+        self.sessionAgents = sessionEnvs * num_agents
+        self.sessions = []
+        try:
+            for i in range(num_sessions):
+                self.sessions.append(
+                    ServerSession(socket_path, sessionEnvs, num_drones, num_agents, pixel_obs, seed + (i * sessionEnvs))
+                )
+        except Exception:
+            for session in self.sessions:
+                session.close()
+            raise
+
+    def run(self, command: int):
+        for session in self.sessions:
+            session.send(command)
+        for session in self.sessions:
+            session.wait()
+
+    def copyOutputs(self):
+        for i, session in enumerate(self.sessions):
+            agents = slice(i * self.sessionAgents, (i + 1) * self.sessionAgents)
+            self.observations[agents] = session.obs
+            self.rewards[agents] = session.rewards
+            self.terminals[agents] = session.terminals
+
+    def reset(self, seed=None):
+        self.run(self.commands.reset)
+        self.copyOutputs()
+        self.tick = 0
+        return self.observations, []
+
+    def step(self, actions):
+        self.actions[:] = actions
+        for i, session in enumerate(self.sessions):
+            session.actions[:] = self.actions[i * self.sessionAgents : (i + 1) * self.sessionAgents]
+        self.run(self.commands.step)
+        self.copyOutputs()
+
+        # every session reports its own stats
+        infos = []
+        self.tick += 1
+        if self.tick % self.report_interval == 0:
+            self.run(self.commands.log)
+            for session in self.sessions:
+                if session.stats["episodes"][0] > 0:
+                    infos.append(transformRawLog(self.numDrones, self.quantileNames, session.stats))
+
+        return self.observations, self.rewards, self.terminals, self.truncations, infos
+
+    def render(self):
+        pass
+
+    def close(self):
+        for session in self.sessions:
+            session.close()
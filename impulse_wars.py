@@ -1,4 +1,6 @@
-from typing import Dict
+import os
+from typing import Dict, List
+import uuid
 
 import gymnasium
 import numpy as np
@@ -6,30 +8,102 @@ import numpy as np
 import pufferlib
 
 from cy_impulse_wars import (
+    botTypes,
+    mapSymmetries,
     maxDrones,
+    numMaps,
     obsConstants,
+    statsConstants,
+    videoFormats,
+    weaponTypes,
     CyImpulseWars,
 )
 
 
-def transformRawLog(numDrones: int, rawLog: Dict[str, float]):
-    log = {"length": rawLog["length"]}
-
-    count = 0
-    for i, stats in enumerate(rawLog["stats"]):
-        log[f"drone_{i}_reward"] = stats["reward"]
-        log[f"drone_{i}_wins"] = stats["wins"]
-        log[f"drone_{i}_distance_traveled"] = stats["distanceTraveled"]
-        log[f"drone_{i}_abs_distance_traveled"] = stats["absDistanceTraveled"]
-        log[f"drone_{i}_shots_fired"] = sum(stats["shotsFired"])
-        log[f"drone_{i}_shots_hit"] = sum(stats["shotsHit"])
-        log[f"drone_{i}_shots_taken"] = sum(stats["shotsTaken"])
-        log[f"drone_{i}_own_shots_taken"] = sum(stats["ownShotsTaken"])
-        log[f"drone_{i}_weapons_picked_up"] = sum(stats["weaponsPickedUp"])
-        log[f"drone_{i}_shots_distance"] = sum(stats["shotDistances"])
-        count += 1
-        if count >= numDrones:
-            break
+# maps the logged name of drone stats to their field in the stats view,
+# sums of per weapon stats are logged
+droneStatNames = {
+    "reward": "reward",
+    "distance_traveled": "distanceTraveled",
+    "abs_distance_traveled": "absDistanceTraveled",
+    "shots_fired": "shotsFired",
+    "shots_hit": "shotsHit",
+    "shots_taken": "shotsTaken",
+    "own_shots_taken": "ownShotsTaken",
+    "weapons_picked_up": "weaponsPickedUp",
+    "shots_distance": "shotDistances",
+    "wins": "wins",
+}
+
+# parameters of generated maps, keys set in map_gen override these
+defaultMapGen = {
+    "columns": 21,
+    "rows": 21,
+    "wall_density": 0.1,
+    "standard_wall_weight": 1.0,
+    "bouncy_wall_weight": 0.5,
+    "death_wall_weight": 0.5,
+    "symmetry": "none",
+    "floating_standard_walls": 0,
+    "floating_bouncy_walls": 0,
+    "floating_death_walls": 0,
+    "weapon_pickups": 8,
+    "default_weapon": "standard",
+}
+
+
+def makeMapGenParams(mapGen: dict, obsMapColumns: int) -> dict:
+    unknown = set(mapGen) - set(defaultMapGen)
+    if unknown:
+        raise ValueError(f"unknown map_gen parameters {sorted(unknown)}, must be some of {list(defaultMapGen)}")
+    params = {**defaultMapGen, **mapGen}
+
+    # sudden death walls assume maps are square
+    if params["columns"] != params["rows"] or params["columns"] > obsMapColumns:
+        raise ValueError(f"generated maps must be square and fit in the {obsMapColumns} cell wide map obs")
+    if not 0.0 <= params["wall_density"] < 1.0:
+        raise ValueError("map_gen wall_density must be at least 0 and less than 1")
+    wallWeights = [params[f"{wall}_wall_weight"] for wall in ("standard", "bouncy", "death")]
+    if any(weight < 0 for weight in wallWeights) or sum(wallWeights) <= 0:
+        raise ValueError("map_gen wall weights must be non-negative and have a positive sum")
+
+    symmetries = mapSymmetries()
+    if params["symmetry"] not in symmetries:
+        raise ValueError(f"unknown map symmetry {params['symmetry']}, must be one of {list(symmetries)}")
+    params["symmetry"] = symmetries[params["symmetry"]]
+    weapons = weaponTypes()
+    if params["default_weapon"] not in weapons:
+        raise ValueError(f"unknown weapon {params['default_weapon']}, must be one of {list(weapons)}")
+    params["default_weapon"] = weapons[params["default_weapon"]]
+
+    return params
+
+
+# stats that have their variance, min, max and quantiles logged as well
+distributionStats = {"length", "reward", "wins"}
+
+
+def logDistribution(log: Dict[str, float], name: str, stat: np.ndarray, quantileNames: List[str]):
+    log[f"{name}_var"] = stat["var"]
+    log[f"{name}_min"] = stat["min"]
+    log[f"{name}_max"] = stat["max"]
+    for q, v in zip(quantileNames, stat["quantiles"]):
+        log[f"{name}_{q}"] = v
+
+
+def transformRawLog(numDrones: int, quantileNames: List[str], rawLog: np.ndarray):
+    length = rawLog["length"][0]
+    log = {"length": length["mean"]}
+    logDistribution(log, "length", length, quantileNames)
+
+    drones = rawLog["drones"][0, :numDrones]
+    for name, field in droneStatNames.items():
+        stats = drones[field]
+        means = stats["mean"].reshape(numDrones, -1).sum(axis=1)
+        for i in range(numDrones):
+            log[f"drone_{i}_{name}"] = means[i]
+            if name in distributionStats:
+                logDistribution(log, f"drone_{i}_{name}", stats[i], quantileNames)
 
     return log
 
@@ -43,6 +117,20 @@ class ImpulseWars(pufferlib.PufferEnv):
         seed: int = 0,
         render: bool = False,
         report_interval=16,
+        bot_types: List[str] = None,
+        map_weights: List[float] = None,
+        map_gen: dict = None,
+        map_pool_size: int = 0,
+        map_file: str = None,
+        pixel_obs: bool = False,
+        opponent_policy: str = None,
+        quantize_opponent: bool = False,
+        dataset_dir: str = None,
+        video_dir: str = None,
+        video_envs: int = 1,
+        video_format: str = "y4m",
+        viewer_envs: int = 0,
+        viewer_fps: int = 30,
         buf=None,
     ):
         if num_drones > maxDrones() or num_drones <= 0:
@@ -50,8 +138,55 @@ class ImpulseWars(pufferlib.PufferEnv):
         if num_agents > num_drones or num_agents <= 0:
             raise ValueError(f"num_agents must greater than 0 and less than or equal to num_drones")
 
+        # drones that aren't controlled by agents are controlled by bots
+        if bot_types is None:
+            bot_types = ["none"] * (num_drones - num_agents)
+        if len(bot_types) != num_drones - num_agents:
+            raise ValueError(f"bot_types must have a bot type for each of the {num_drones - num_agents} non-agent drones")
+        bots = botTypes()
+        for botType in bot_types:
+            if botType not in bots:
+                raise ValueError(f"unknown bot type {botType}, must be one of {list(bots)}")
+        # maps are picked uniformly by default
+        if map_weights is not None:
+            if len(map_weights) != numMaps():
+                raise ValueError(f"map_weights must have a weight for each of the {numMaps()} maps")
+            if any(weight < 0 for weight in map_weights) or sum(map_weights) <= 0:
+                raise ValueError("map_weights must be non-negative and have a positive sum")
+        # maps are generated instead of picked from the predefined maps
+        # if map_gen is set, only map_pool_size different maps are
+        # generated unless it's 0
+        if map_gen is not None:
+            mapGenParams = makeMapGenParams(map_gen, obsConstants(num_drones).obsMapColumns)
+        if map_pool_size < 0:
+            raise ValueError("map_pool_size must be non-negative")
+        if video_dir is not None:
+            if video_format not in videoFormats():
+                raise ValueError(f"unknown video format {video_format}, must be one of {list(videoFormats())}")
+            if video_envs <= 0 or video_envs > num_envs:
+                raise ValueError("video_envs must greater than 0 and less than or equal to num_envs")
+        if viewer_envs < 0 or viewer_envs > num_envs:
+            raise ValueError("viewer_envs must be non-negative and less than or equal to num_envs")
+        if viewer_envs > 0:
+            if render or video_dir is not None:
+                raise ValueError("envs can't be viewed while they are rendered or recorded to videos")
+            if viewer_fps <= 0:
+                raise ValueError("viewer_fps must be greater than 0")
+        if "policy" in bot_types and opponent_policy is None:
+            raise ValueError("opponent_policy must be set to use policy bots")
+
         self.numDrones = num_drones
         self.obsInfo = obsConstants(num_drones)
+        # pixel obs are images of the map followed by the same scalar obs
+        self.obsSize = self.obsInfo.pixelObsSize if pixel_obs else self.obsInfo.obsSize
+        # the static wall of each map obs cell only changes when an env
+        # resets or sudden death walls are spawned, so learners can store
+        # it once per change; the wall pixels of pixel obs include
+        # floating walls so pixel obs have no static parts
+        self.static_obs_idxs = None
+        if not pixel_obs:
+            self.static_obs_idxs = np.arange(0, self.obsInfo.mapObsSize, self.obsInfo.mapCellObsSize)
+        self.quantileNames = [f"p{round(q * 100)}" for q in statsConstants().quantiles]
 
         # Define the multidiscrete action space
         self.single_action_space = gymnasium.spaces.MultiDiscrete([
@@ -62,7 +197,7 @@ class ImpulseWars(pufferlib.PufferEnv):
         ])
 
         self.single_observation_space = gymnasium.spaces.Box(
-            low=0.0, high=255, shape=(self.obsInfo.obsSize,), dtype=np.uint8
+            low=0.0, high=255, shape=(self.obsSize,), dtype=np.uint8
         )
 
         self.report_interval = report_interval
@@ -82,6 +217,47 @@ class ImpulseWars(pufferlib.PufferEnv):
             seed,
             render,
         )
+        self.c_envs.setBotTypes([bots[botType] for botType in bot_types])
+        if pixel_obs:
+            self.c_envs.setPixelObs(True)
+        if map_file is not None:
+            self.c_envs.loadMapFile(map_file)
+        if map_gen is not None:
+            self.c_envs.setMapGen(mapGenParams, map_pool_size)
+        if map_weights is not None:
+            self.c_envs.setMapWeights([float(weight) for weight in map_weights])
+        if opponent_policy is not None:
+            self.c_envs.loadOpponentPolicy(opponent_policy, quantize_opponent)
+
+        # the first video_envs envs are recorded to videos, file names are
+        # unique as there may be multiple env processes recording to the
+        # same directory
+        if video_dir is not None:
+            os.makedirs(video_dir, exist_ok=True)
+            videoID = uuid.uuid4().hex
+            for i in range(video_envs):
+                path = os.path.join(video_dir, f"{videoID}_{i}")
+                if video_format == "y4m":
+                    path += ".y4m"
+                self.c_envs.startVideoRecording(i, path, videoFormats()[video_format])
+
+        # the first viewer_envs envs are drawn live in a window at a fixed
+        # frame rate without slowing down stepping
+        if viewer_envs > 0:
+            self.c_envs.startViewer(viewer_envs, viewer_fps)
+
+        # every env writes its own dataset, there may be multiple env
+        # processes writing to the same directory
+        self.dataset = None
+        if dataset_dir is not None:
+            from trajectories import TrajectoryWriter
+
+            self.dataset = TrajectoryWriter(
+                os.path.join(dataset_dir, uuid.uuid4().hex),
+                self.num_agents,
+                self.obsSize,
+                len(self.single_action_space.nvec),
+            )
 
     def reset(self, seed=None):
         self.c_envs.reset()
@@ -90,14 +266,18 @@ class ImpulseWars(pufferlib.PufferEnv):
 
     def step(self, actions):
         self.actions[:] = actions
+        if self.dataset is not None:
+            self.dataset.writeObservations(self.observations, self.actions)
         self.c_envs.step()
+        if self.dataset is not None:
+            self.dataset.writeOutcomes(self.rewards, self.terminals)
 
         infos = []
         self.tick += 1
         if self.tick % self.report_interval == 0:
             rawLog = self.c_envs.log()
-            if rawLog["length"] > 0:
-                infos.append(transformRawLog(self.numDrones, rawLog))
+            if rawLog["episodes"][0] > 0:
+                infos.append(transformRawLog(self.numDrones, self.quantileNames, rawLog))
 
         return self.observations, self.rewards, self.terminals, self.truncations, infos
 
@@ -106,6 +286,8 @@ class ImpulseWars(pufferlib.PufferEnv):
 
     def close(self):
         self.c_envs.close()
+        if self.dataset is not None:
+            self.dataset.close()
 
 
 def testPerf(timeout, actionCache, numEnvs):
@@ -18,8 +18,9 @@ install(show_locals=False)
 
 import clean_pufferl
 
-from policy import Policy, Recurrent
+from policy import Policy, Recurrent, exportInferenceWeights
 from impulse_wars import ImpulseWars
+from env_server import RemoteImpulseWars
 
 
 def make_policy(env, config):
@@ -36,21 +37,51 @@ def train(args) -> Deque[Dict[str, Any]] | None:
     elif not args.track and args.train.exp_id is None:
         args.train.exp_id = wandb.util.generate_id()
 
-    vecenv = pufferlib.vector.make(
-        ImpulseWars,
-        num_envs=args.vec.num_envs,
-        env_args=(args.train.num_internal_envs,),
-        env_kwargs=dict(
-            num_drones=args.train.num_drones,
-            num_agents=args.train.num_agents,
-            seed=args.seed,
-            render=args.render,
-        ),
-        num_workers=args.vec.num_workers,
-        batch_size=args.vec.env_batch_size,
-        zero_copy=args.vec.zero_copy,
-        backend=pufferlib.vector.Multiprocessing,
-    )
+    if args.env_server is not None:
+        # envs are stepped by an env server instead of env processes, each
+        # worker's envs are a session of the server
+        vecenv = pufferlib.vector.make(
+            RemoteImpulseWars,
+            num_envs=1,
+            env_args=(args.train.num_internal_envs * args.vec.num_envs,),
+            env_kwargs=dict(
+                num_drones=args.train.num_drones,
+                num_agents=args.train.num_agents,
+                seed=args.seed,
+                pixel_obs=args.train.pixel_obs,
+                socket_path=args.env_server,
+                num_sessions=args.vec.num_workers,
+            ),
+            backend=pufferlib.vector.Serial,
+        )
+    else:
+        vecenv = pufferlib.vector.make(
+            ImpulseWars,
+            num_envs=args.vec.num_envs,
+            env_args=(args.train.num_internal_envs,),
+            env_kwargs=dict(
+                num_drones=args.train.num_drones,
+                num_agents=args.train.num_agents,
+                seed=args.seed,
+                render=args.render,
+                bot_types=args.train.bot_types,
+                map_weights=args.train.map_weights,
+                map_gen=dict(wall_density=args.train.map_wall_density, symmetry=args.train.map_symmetry)
+                if args.train.generate_maps
+                else None,
+                map_pool_size=args.train.map_pool_size,
+                map_file=args.train.map_file,
+                pixel_obs=args.train.pixel_obs,
+                opponent_policy=args.train.opponent_policy,
+                quantize_opponent=args.train.quantize_opponent,
+                viewer_envs=args.viewer_envs,
+                viewer_fps=args.viewer_fps,
+            ),
+            num_workers=args.vec.num_workers,
+            batch_size=args.vec.env_batch_size,
+            zero_copy=args.vec.zero_copy,
+            backend=pufferlib.vector.Multiprocessing,
+        )
     if args.render:
         vecenv.reset()
 
@@ -133,12 +164,25 @@ if __name__ == "__main__":
         "--mode",
         type=str,
         default="train",
-        choices="train eval playtest autotune sweep".split(),
+        choices="train eval playtest autotune sweep export".split(),
     )
     parser.add_argument("--sweep-child", action="store_true")
     parser.add_argument("--eval-model-path", type=str, default=None, help="Path to model to evaluate")
+    parser.add_argument(
+        "--export-path", type=str, default=None, help="Path to export the weights of --eval-model-path to for opponent policies"
+    )
     parser.add_argument("--seed", type=int, default=-1)
     parser.add_argument("--render", action="store_true", help="Enable rendering")
+    parser.add_argument("--video-dir", type=str, default=None, help="Record evaluated envs to videos in this directory")
+    parser.add_argument("--video-format", type=str, default="y4m", choices=["y4m", "png"], help="Format of recorded videos")
+    parser.add_argument("--viewer-envs", type=int, default=0, help="Draw this many envs of each env process live in a window")
+    parser.add_argument("--viewer-fps", type=int, default=30, help="Frame rate of the live viewer")
+    parser.add_argument(
+        "--env-server",
+        type=str,
+        default=None,
+        help="Train with envs stepped by the env server listening on this socket path, map, bot and viewer options aren't used",
+    )
     parser.add_argument("--cell-id", type=int, default=0)
     parser.add_argument("--wandb-entity", type=str, default="xinpw8", help="WandB entity")
     parser.add_argument("--wandb-project", type=str, default="", help="WandB project")
@@ -171,6 +215,7 @@ if __name__ == "__main__":
     parser.add_argument("--train.max-grad-norm", type=float, default=0.5)
     parser.add_argument("--train.minibatch-size", type=int, default=32_768)
     parser.add_argument("--train.norm-adv", action="store_false")
+    parser.add_argument("--train.gae-threads", type=int, default=8)
     parser.add_argument("--train.update-epochs", type=int, default=1)
     parser.add_argument("--train.vf-clip-coef", type=float, default=0.1)
     parser.add_argument("--train.vf-coef", type=float, default=0.5321276235227259)
@@ -181,8 +226,65 @@ if __name__ == "__main__":
         "--train.num-agents",
         type=int,
         default=1,
-        help="Number of agents controlling drones, if this is less than --train.num-drones the other drones will do nothing",
+        help="Number of agents controlling drones, if this is less than --train.num-drones the other drones are controlled by --train.bot-types",
+    )
+
+    parser.add_argument(
+        "--train.bot-types",
+        type=str,
+        nargs="*",
+        default=None,
+        help="Bots controlling the drones that aren't controlled by agents: none, aim_nearest, strafe, pickup_seeker, dodge or policy",
+    )
+    parser.add_argument(
+        "--train.map-weights",
+        type=float,
+        nargs="*",
+        default=None,
+        help="Relative weight of each map being picked when an episode starts, maps are picked uniformly if unset",
+    )
+    parser.add_argument(
+        "--train.generate-maps",
+        action="store_true",
+        help="Generate maps procedurally instead of using the predefined maps",
+    )
+    parser.add_argument(
+        "--train.map-pool-size",
+        type=int,
+        default=0,
+        help="Number of different maps generated with --train.generate-maps, 0 generates a new map every episode",
+    )
+    parser.add_argument("--train.map-wall-density", type=float, default=0.1, help="Chance of a cell of a generated map having a wall")
+    parser.add_argument(
+        "--train.map-symmetry",
+        type=str,
+        default="none",
+        choices=["none", "mirror", "quad", "rotational"],
+        help="Symmetry of generated maps",
+    )
+    parser.add_argument(
+        "--train.map-file",
+        type=str,
+        default=None,
+        help="Map file to sample maps from instead of the predefined maps, see writeMapFile",
+    )
+    parser.add_argument(
+        "--train.pixel-obs",
+        action="store_true",
+        help="Observe rasterized images of the map instead of map cells",
+    )
+    parser.add_argument(
+        "--train.split-obs",
+        action="store_true",
+        help="Store the static walls of map obs once per change instead of in every stored obs",
+    )
+    parser.add_argument(
+        "--train.opponent-policy",
+        type=str,
+        default=None,
+        help="Exported policy weights that control policy bots, see --mode export",
     )
+    parser.add_argument("--train.quantize-opponent", action="store_true", help="Run the opponent policy with int8 weights")
 
     parser.add_argument("--vec.num-envs", type=int, default=288)
     parser.add_argument("--vec.num-workers", type=int, default=24)
@@ -231,8 +333,13 @@ if __name__ == "__main__":
             env_kwargs=dict(
                 num_drones=args.train.num_drones,
                 num_agents=args.train.num_agents,
-                render=True,
+                render=args.video_dir is None and args.viewer_envs == 0,
                 seed=args.seed,
+                pixel_obs=args.train.pixel_obs,
+                video_dir=args.video_dir,
+                video_format=args.video_format,
+                viewer_envs=args.viewer_envs,
+                viewer_fps=args.viewer_fps,
             ),
             num_workers=1,
             batch_size=1,
@@ -245,6 +352,13 @@ if __name__ == "__main__":
             policy = th.load(args.eval_model_path, map_location=args.train.device)
 
         eval_policy(vecenv, policy, args.train.device)
+        # recorded videos are finished when the env is closed
+        vecenv.close()
+    elif args.mode == "export":
+        if args.eval_model_path is None or args.export_path is None:
+            raise ValueError("--eval-model-path and --export-path must be set to export a policy")
+        policy = th.load(args.eval_model_path, map_location="cpu")
+        exportInferenceWeights(policy, args.export_path)
     elif args.mode == "sweep":
         from sweep import sweep
 
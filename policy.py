@@ -32,6 +32,7 @@ class Policy(nn.Module):
 
         self.numDrones = numDrones
         self.obsInfo = obsConstants(numDrones)
+        self.pixelObs = env.single_observation_space.shape[0] == self.obsInfo.pixelObsSize
 
         self.factors = np.array(
             [
@@ -46,13 +47,23 @@ class Policy(nn.Module):
         self.register_buffer("offsets", offsets)
         self.multihotDim = self.factors.sum()
 
-        self.mapCNN = nn.Sequential(
-            layer_init(nn.Conv2d(self.multihotDim, cnnChannels, kernel_size=5, stride=2)),
-            nn.LeakyReLU(),
-            layer_init(nn.Conv2d(cnnChannels, cnnChannels, kernel_size=3, stride=2)),
-            nn.LeakyReLU(),
-            nn.Flatten(),
-        )
+        if self.pixelObs:
+            # pixel obs are larger than the map obs, downsample more
+            self.mapCNN = nn.Sequential(
+                layer_init(nn.Conv2d(self.obsInfo.pixelObsChannels, cnnChannels, kernel_size=8, stride=4)),
+                nn.LeakyReLU(),
+                layer_init(nn.Conv2d(cnnChannels, cnnChannels, kernel_size=4, stride=2)),
+                nn.LeakyReLU(),
+                nn.Flatten(),
+            )
+        else:
+            self.mapCNN = nn.Sequential(
+                layer_init(nn.Conv2d(self.multihotDim, cnnChannels, kernel_size=5, stride=2)),
+                nn.LeakyReLU(),
+                layer_init(nn.Conv2d(cnnChannels, cnnChannels, kernel_size=3, stride=2)),
+                nn.LeakyReLU(),
+                nn.Flatten(),
+            )
         cnnOutputSize = self._computeCNNShape()
 
         self.droneEncoder = nn.Sequential(
@@ -78,9 +89,12 @@ class Policy(nn.Module):
         return actions, value
 
     def encode_observations(self, obs: th.Tensor) -> th.Tensor:
+        if self.pixelObs:
+            return self._encodePixelObservations(obs)
+
         batchSize = obs.shape[0]
         mapObs = obs[:, : self.obsInfo.mapObsSize].view(
-            batchSize, self.obsInfo.maxMapColumns, self.obsInfo.maxMapRows, self.obsInfo.mapCellObsSize
+            batchSize, self.obsInfo.obsMapColumns, self.obsInfo.obsMapRows, self.obsInfo.mapCellObsSize
         )
         droneObs = obs[:, self.obsInfo.mapObsSize : -self.obsInfo.weaponTypes].float() / 255.0
         droneWeapon = obs[:, -self.obsInfo.weaponTypes :].float()
@@ -88,8 +102,8 @@ class Policy(nn.Module):
         mapBuf = th.zeros(
             batchSize,
             self.multihotDim,
-            self.obsInfo.maxMapColumns,
-            self.obsInfo.maxMapRows,
+            self.obsInfo.obsMapColumns,
+            self.obsInfo.obsMapRows,
             device=obs.device,
             dtype=th.float32,
         )
@@ -104,6 +118,20 @@ class Policy(nn.Module):
 
         return self.encoder(features), None
 
+    def _encodePixelObservations(self, obs: th.Tensor) -> th.Tensor:
+        batchSize = obs.shape[0]
+        res = self.obsInfo.pixelObsRes
+        mapObs = obs[:, : self.obsInfo.pixelMapObsSize].view(batchSize, self.obsInfo.pixelObsChannels, res, res)
+        mapObs = self.mapCNN(mapObs.float() / 255.0)
+
+        droneObs = obs[:, self.obsInfo.pixelMapObsSize : -self.obsInfo.weaponTypes].float() / 255.0
+        droneWeapon = obs[:, -self.obsInfo.weaponTypes :].float()
+        droneObs = self.droneEncoder(th.cat((droneObs, droneWeapon), dim=-1))
+
+        features = th.cat((mapObs, droneObs), dim=-1)
+
+        return self.encoder(features), None
+
     def decode_actions(self, hidden: th.Tensor, lookup=None):
         actionMean = self.actorMean(hidden)
         actionLogStd = self.actorLogStd.expand_as(actionMean)
@@ -115,13 +143,71 @@ class Policy(nn.Module):
         return action, value
 
     def _computeCNNShape(self) -> int:
+        shape = (self.multihotDim, self.obsInfo.obsMapColumns, self.obsInfo.obsMapRows)
+        if self.pixelObs:
+            shape = (self.obsInfo.pixelObsChannels, self.obsInfo.pixelObsRes, self.obsInfo.pixelObsRes)
         mapSpace = spaces.Box(
             low=0,
             high=1,
-            shape=(self.multihotDim, self.obsInfo.maxMapColumns, self.obsInfo.maxMapRows),
+            shape=shape,
             dtype=np.float32,
         )
 
         with th.no_grad():
             t = th.as_tensor(mapSpace.sample()[None])
             return self.mapCNN(t).shape[1]
+
+
+# must match POLICY_MODEL_VERSION in src/inference.h
+inferenceWeightsVersion = 1
+
+
+def exportInferenceWeights(policy: nn.Module, path: str):
+    """Writes the weights of a trained policy in the format loaded by the
+    env's inference engine, so it can control opponent drones"""
+    # unwrap pufferlib's policy wrappers
+    while not isinstance(policy, Recurrent) and hasattr(policy, "policy"):
+        policy = policy.policy
+    if not isinstance(policy, Recurrent):
+        raise ValueError("only recurrent policies can be exported")
+    lstm = policy.recurrent
+    policy = policy.policy
+    if policy.pixelObs:
+        raise ValueError("policies trained on pixel obs can't be exported, opponents observe map cell obs")
+
+    conv1, conv2 = policy.mapCNN[0], policy.mapCNN[2]
+    droneEncoder = policy.droneEncoder[0]
+    encoder = policy.encoder[0]
+    dims = [
+        policy.obsInfo.obsMapColumns,
+        policy.obsInfo.obsMapRows,
+        cnnChannels,
+        policy.obsInfo.scalarObsSize,
+        droneEncOutputSize,
+        encoderOutputSize,
+        lstmOutputSize,
+        policy.actorMean.out_features,
+    ] + list(policy.factors)
+
+    tensors = [
+        conv1.weight,
+        conv1.bias,
+        conv2.weight,
+        conv2.bias,
+        droneEncoder.weight,
+        droneEncoder.bias,
+        encoder.weight,
+        encoder.bias,
+        lstm.weight_ih_l0,
+        lstm.weight_hh_l0,
+        lstm.bias_ih_l0,
+        lstm.bias_hh_l0,
+        policy.actorMean.weight,
+        policy.actorMean.bias,
+    ]
+
+    with open(path, "wb") as f:
+        f.write(b"IWPM")
+        f.write(np.array([inferenceWeightsVersion] + dims, dtype="<u4").tobytes())
+        for tensor in tensors:
+            f.write(tensor.detach().cpu().numpy().astype("<f4").tobytes())
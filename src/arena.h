@@ -0,0 +1,98 @@
+#ifndef IMPULSE_WARS_ARENA_H
+#define IMPULSE_WARS_ARENA_H
+
+#include "helpers.h"
+#include "settings.h"
+#include "types.h"
+
+// Every env allocates its entities from its own arena so envs never
+// share allocator state and can be stepped on different threads without
+// locking. Freed entities are kept on per size class free lists and
+// reused, and resetting the arena releases everything at once so clearing
+// an env doesn't need to free entities one by one. Blocks are kept after
+// a reset, so after the first few episodes an env doesn't allocate at all.
+//
+// Blocks come from the system allocator as it's thread safe, which the
+// global dlmalloc fastMalloc uses in release builds isn't.
+
+#define ARENA_BLOCK_SIZE (1 << 16)
+#define ARENA_ALIGNMENT 16
+#define ARENA_MAX_ALLOC_SIZE (ARENA_ALIGNMENT * _ARENA_SIZE_CLASSES)
+// blocks start with a pointer to the next block, padded to the alignment
+#define ARENA_BLOCK_HEADER_SIZE ARENA_ALIGNMENT
+
+#ifndef AUTOPXD
+_Static_assert(sizeof(wallEntity) <= ARENA_MAX_ALLOC_SIZE, "wallEntity is too large for the arena");
+_Static_assert(sizeof(weaponPickupEntity) <= ARENA_MAX_ALLOC_SIZE, "weaponPickupEntity is too large for the arena");
+_Static_assert(sizeof(projectileEntity) <= ARENA_MAX_ALLOC_SIZE, "projectileEntity is too large for the arena");
+#endif
+
+static inline uint8_t arenaSizeClass(const size_t size) {
+    ASSERTF(size != 0 && size <= ARENA_MAX_ALLOC_SIZE, "invalid arena allocation size %zu", size);
+    return (size - 1) / ARENA_ALIGNMENT;
+}
+
+void initArena(envArena *arena) {
+    memset(arena, 0x0, sizeof(envArena));
+}
+
+void destroyArena(envArena *arena) {
+    uint8_t *block = arena->blocks;
+    while (block != NULL) {
+        uint8_t *next = *(uint8_t **)block;
+        free(block);
+        block = next;
+    }
+    memset(arena, 0x0, sizeof(envArena));
+}
+
+// releases every allocation, but keeps the arena's blocks to reuse
+void resetArena(envArena *arena) {
+    arena->current = arena->blocks;
+    arena->used = ARENA_BLOCK_HEADER_SIZE;
+    memset(arena->freeLists, 0x0, sizeof(arena->freeLists));
+}
+
+void *arenaAlloc(envArena *arena, const size_t size) {
+    const uint8_t sizeClass = arenaSizeClass(size);
+    void *ptr = arena->freeLists[sizeClass];
+    if (ptr != NULL) {
+        arena->freeLists[sizeClass] = *(void **)ptr;
+        return ptr;
+    }
+
+    const size_t classSize = (sizeClass + 1) * ARENA_ALIGNMENT;
+    if (arena->current == NULL || arena->used + classSize > ARENA_BLOCK_SIZE) {
+        uint8_t *next = NULL;
+        if (arena->current != NULL) {
+            next = *(uint8_t **)arena->current;
+        }
+        // use a block kept from before the last reset if there is one
+        if (next == NULL) {
+            next = (uint8_t *)aligned_alloc(ARENA_ALIGNMENT, ARENA_BLOCK_SIZE);
+            if (next == NULL) {
+                ERROR("failed to allocate arena block");
+            }
+            *(uint8_t **)next = NULL;
+            if (arena->current == NULL) {
+                arena->blocks = next;
+            } else {
+                *(uint8_t **)arena->current = next;
+            }
+        }
+        arena->current = next;
+        arena->used = ARENA_BLOCK_HEADER_SIZE;
+    }
+
+    ptr = arena->current + arena->used;
+    arena->used += classSize;
+    return ptr;
+}
+
+void arenaFree(envArena *arena, void *ptr, const size_t size) {
+    const uint8_t sizeClass = arenaSizeClass(size);
+    *(void **)ptr = arena->freeLists[sizeClass];
+    arena->freeLists[sizeClass] = ptr;
+}
+
+#endif
@@ -1,38 +1,46 @@
 #include "env.h"
 
-void perfTest(const float testTime) {
-    const uint8_t NUM_DRONES = 2;
+typedef struct benchmarkConfig {
+    uint8_t numDrones;
+    uint8_t numAgents;
+} benchmarkConfig;
 
+// returns the agent steps per second of the env config, stepped with
+// the generic step function or the config's specialized variant
+float perfTest(const float testTime, const benchmarkConfig config, const bool generic) {
     env *e = (env *)fastCalloc(1, sizeof(env));
-    uint8_t *obs = (uint8_t *)fastCalloc(NUM_DRONES * OBS_SIZE, sizeof(uint8_t));
-    float *rewards = (float *)fastCalloc(NUM_DRONES, sizeof(float));
-    int *actions = (float *)fastCalloc(NUM_DRONES * ACTION_SIZE, sizeof(float));
-    unsigned char *terminals = (unsigned char *)fastCalloc(NUM_DRONES, sizeof(bool));
-    logBuffer *logs = createLogBuffer(1);
+    uint8_t *obs = (uint8_t *)fastCalloc(config.numAgents * OBS_SIZE, sizeof(uint8_t));
+    float *rewards = (float *)fastCalloc(config.numAgents, sizeof(float));
+    int *actions = (int *)fastCalloc(config.numAgents * ACTION_COMPONENTS, sizeof(int));
+    unsigned char *terminals = (unsigned char *)fastCalloc(config.numAgents, sizeof(bool));
+    statsAccumulator *logs = createStatsAccumulator(config.numDrones);
 
-    initEnv(e, NUM_DRONES, NUM_DRONES, obs, actions, rewards, terminals, logs, 0);
+    initEnv(e, config.numDrones, config.numAgents, obs, actions, rewards, terminals, logs, 0);
+    for (uint8_t i = config.numAgents; i < config.numDrones; i++) {
+        envSetBotType(e, i, AIM_NEAREST_BOT);
+    }
 
     const time_t start = time(NULL);
     int steps = 0;
     while (time(NULL) - start < testTime) {
-        uint8_t actionOffset = 0;
-        for (uint8_t i = 0; i < e->numDrones; i++) {
-            e->actions[actionOffset + 0] = randFloat(&e->randState, -1.0f, 1.0f);
-            e->actions[actionOffset + 1] = randFloat(&e->randState, -1.0f, 1.0f);
-            e->actions[actionOffset + 2] = randFloat(&e->randState, -1.0f, 1.0f);
-            e->actions[actionOffset + 3] = randFloat(&e->randState, -1.0f, 1.0f);
-            e->actions[actionOffset + 4] = randFloat(&e->randState, -1.0f, 1.0f);
-
-            actionOffset += ACTION_SIZE;
+        for (uint8_t i = 0; i < e->numAgents; i++) {
+            int *agentActions = e->actions + (i * ACTION_COMPONENTS);
+            agentActions[0] = randInt(&e->randState, 0, AIM_ACTIONS - 1);
+            agentActions[1] = randInt(&e->randState, 0, BOOST_ACTIONS - 1);
+            agentActions[2] = randInt(&e->randState, 0, FIRE_ACTIONS - 1);
+            agentActions[3] = randInt(&e->randState, 0, ROTATION_ACTIONS - 1);
         }
 
-        stepEnv(e);
+        if (generic) {
+            stepEnvGeneric(e);
+        } else {
+            stepEnv(e);
+        }
         steps++;
     }
 
     const time_t end = time(NULL);
-    printf("SPS: %f\n", (float)(NUM_DRONES * FRAMESKIP * steps) / (float)(end - start));
-    printf("Steps: %d\n", steps * FRAMESKIP);
+    const float sps = (float)(config.numAgents * FRAMESKIP * steps) / (float)(end - start);
 
     destroyEnv(e);
 
@@ -40,11 +48,22 @@ void perfTest(const float testTime) {
     fastFree(actions);
     fastFree(rewards);
     fastFree(terminals);
-    destroyLogBuffer(logs);
+    destroyStatsAccumulator(logs);
     fastFree(e);
+
+    return sps;
 }
 
 int main(void) {
-    perfTest(5.0f);
+    // the last config doesn't have a specialized variant, it shows the
+    // overhead of dispatching to the generic step function
+    const benchmarkConfig configs[] = {{2, 2}, {2, 1}, {4, 4}, {3, 3}};
+    const uint8_t numConfigs = sizeof(configs) / sizeof(benchmarkConfig);
+
+    for (uint8_t i = 0; i < numConfigs; i++) {
+        const float genericSPS = perfTest(5.0f, configs[i], true);
+        const float variantSPS = perfTest(5.0f, configs[i], false);
+        printf("%d drones, %d agents: generic SPS: %f, specialized SPS: %f, speedup: %.2fx\n", configs[i].numDrones, configs[i].numAgents, genericSPS, variantSPS, variantSPS / genericSPS);
+    }
     return 0;
 }
@@ -0,0 +1,188 @@
+#ifndef IMPULSE_WARS_BOTS_H
+#define IMPULSE_WARS_BOTS_H
+
+#include "game.h"
+#include "helpers.h"
+#include "settings.h"
+#include "types.h"
+
+// Scripted bots control drones that aren't controlled by agents. They
+// only read the drone, projectile and pickup state the env already keeps
+// and act through the same movement and shooting functions agents use.
+// Bots are deterministic given the env state and don't use the env's
+// RNG, so replays and seeded episodes aren't affected by them.
+
+// finds the closest living enemy drone, returns NULL if there are none
+static inline droneEntity *botNearestEnemy(env *e, const droneEntity *drone, const b2Vec2 pos) {
+    droneEntity *nearest = NULL;
+    float nearestDistance = FLT_MAX;
+    for (uint8_t i = 0; i < e->numDrones; i++) {
+        if (i == drone->idx) {
+            continue;
+        }
+        droneEntity *enemy = &e->drones[i];
+        if (enemy->dead) {
+            continue;
+        }
+        const float distance = b2DistanceSquared(pos, getCachedPos(enemy->bodyID, &enemy->pos));
+        if (distance < nearestDistance) {
+            nearest = enemy;
+            nearestDistance = distance;
+        }
+    }
+    return nearest;
+}
+
+// returns true if nothing is between the drone and the enemy
+static inline bool botHasLineOfSight(env *e, const b2Vec2 pos, const droneEntity *enemy, const b2Vec2 enemyPos) {
+    const b2Vec2 direction = b2Normalize(b2Sub(enemyPos, pos));
+    // start outside of the drone so its own shape isn't hit
+    const b2Vec2 origin = b2MulAdd(pos, DRONE_RADIUS + 0.1f, direction);
+    const b2QueryFilter filter = {.categoryBits = PROJECTILE_SHAPE, .maskBits = WALL_SHAPE | FLOATING_WALL_SHAPE | DRONE_SHAPE};
+    const b2RayResult rayRes = b2World_CastRayClosest(e->worldID, origin, b2Sub(enemyPos, origin), filter);
+    if (!rayRes.hit) {
+        return false;
+    }
+    const entity *ent = shapeEntity(e, rayRes.shapeId);
+    return ent != NULL && ent->type == DRONE_ENTITY && ent->entity == enemy;
+}
+
+// aims at where the enemy will be shortly and shoots if it can be hit
+static inline void botAimAndShoot(env *e, droneEntity *drone, const b2Vec2 pos, const droneEntity *enemy, const b2Vec2 enemyPos) {
+    const b2Vec2 enemyVel = b2Body_GetLinearVelocity(enemy->bodyID);
+    const b2Vec2 aim = b2Normalize(b2Sub(b2MulAdd(enemyPos, BOT_AIM_LEAD, enemyVel), pos));
+    if (b2VecEqual(aim, b2Vec2_zero)) {
+        return;
+    }
+    drone->lastAim = aim;
+
+    if (b2Distance(pos, enemyPos) > BOT_SHOOT_DISTANCE || !botHasLineOfSight(e, pos, enemy, enemyPos)) {
+        return;
+    }
+    droneShoot(e, drone, aim);
+}
+
+// moves towards or away from the enemy to stay around the preferred distance
+static inline b2Vec2 botKeepDistance(const b2Vec2 pos, const b2Vec2 enemyPos) {
+    const b2Vec2 toEnemy = b2Sub(enemyPos, pos);
+    const float distance = b2Length(toEnemy);
+    if (distance > BOT_PREFERRED_DISTANCE + BOT_DISTANCE_TOLERANCE) {
+        return b2Normalize(toEnemy);
+    } else if (distance < BOT_PREFERRED_DISTANCE - BOT_DISTANCE_TOLERANCE) {
+        return b2Normalize(b2Neg(toEnemy));
+    }
+    return b2Vec2_zero;
+}
+
+// returns the direction to move to avoid incoming enemy projectiles,
+// or zero if none are a threat
+static inline b2Vec2 botDodgeDirection(env *e, const droneEntity *drone, const b2Vec2 pos) {
+    b2Vec2 dodge = b2Vec2_zero;
+    for (SNode *cur = e->projectiles->head; cur != NULL; cur = cur->next) {
+        const projectileEntity *projectile = (projectileEntity *)cur->data;
+        if (projectile->droneIdx == drone->idx) {
+            continue;
+        }
+
+        const b2Vec2 vel = b2Body_GetLinearVelocity(projectile->bodyID);
+        const float speed = b2LengthSquared(vel);
+        if (speed == 0.0f) {
+            continue;
+        }
+        // time and position of the projectile's closest approach
+        const float t = b2Dot(b2Sub(pos, projectile->lastPos), vel) / speed;
+        if (t <= 0.0f || t > BOT_DODGE_HORIZON) {
+            continue;
+        }
+        const b2Vec2 closest = b2MulAdd(projectile->lastPos, t, vel);
+        const b2Vec2 away = b2Sub(pos, closest);
+        if (b2Length(away) > BOT_DODGE_DISTANCE) {
+            continue;
+        }
+
+        // move perpendicular to the projectile's path, sooner threats
+        // are weighted more
+        b2Vec2 perp = b2Normalize(away);
+        if (b2VecEqual(perp, b2Vec2_zero)) {
+            perp = b2Normalize(b2LeftPerp(vel));
+        }
+        dodge = b2MulAdd(dodge, 1.0f / t, perp);
+    }
+    return b2Normalize(dodge);
+}
+
+// returns the closest active weapon pickup, or NULL if there are none
+static inline weaponPickupEntity *botNearestPickup(env *e, const b2Vec2 pos, b2Vec2 *pickupPos) {
+    weaponPickupEntity *nearest = NULL;
+    float nearestDistance = FLT_MAX;
+    for (size_t i = 0; i < cc_array_size(e->pickups); i++) {
+        weaponPickupEntity *pickup = safe_array_get_at(e->pickups, i);
+        if (pickup->respawnWait != 0.0f) {
+            continue;
+        }
+        const b2Vec2 cellPos = e->cells.positions[pickup->mapCellIdx];
+        const float distance = b2DistanceSquared(pos, cellPos);
+        if (distance < nearestDistance) {
+            nearest = pickup;
+            nearestDistance = distance;
+            *pickupPos = cellPos;
+        }
+    }
+    return nearest;
+}
+
+void botStep(env *e, droneEntity *drone) {
+    const enum botType type = e->botTypes[drone->idx];
+    // policy bots act through botActions like agents do
+    if (type == NO_BOT || type == POLICY_BOT || drone->dead) {
+        return;
+    }
+
+    const b2Vec2 pos = getCachedPos(drone->bodyID, &drone->pos);
+    droneEntity *enemy = botNearestEnemy(e, drone, pos);
+    if (enemy == NULL) {
+        return;
+    }
+    const b2Vec2 enemyPos = getCachedPos(enemy->bodyID, &enemy->pos);
+
+    b2Vec2 move = b2Vec2_zero;
+    switch (type) {
+    case AIM_NEAREST_BOT:
+        move = botKeepDistance(pos, enemyPos);
+        break;
+    case STRAFE_BOT: {
+        // circle the enemy, switching directions periodically
+        const b2Vec2 toEnemy = b2Normalize(b2Sub(enemyPos, pos));
+        const float side = ((e->episodeLength + (drone->idx * BOT_STRAFE_FRAMES)) / BOT_STRAFE_FRAMES) % 2 == 0 ? 1.0f : -1.0f;
+        move = b2Normalize(b2MulAdd(botKeepDistance(pos, enemyPos), side, b2LeftPerp(toEnemy)));
+        break;
+    }
+    case PICKUP_SEEKER_BOT: {
+        // only go for pickups when holding the default weapon
+        b2Vec2 pickupPos = b2Vec2_zero;
+        if (drone->weaponInfo == e->defaultWeapon && botNearestPickup(e, pos, &pickupPos) != NULL) {
+            move = b2Normalize(b2Sub(pickupPos, pos));
+        } else {
+            move = botKeepDistance(pos, enemyPos);
+        }
+        break;
+    }
+    case DODGE_BOT:
+        move = botDodgeDirection(e, drone, pos);
+        if (b2VecEqual(move, b2Vec2_zero)) {
+            move = botKeepDistance(pos, enemyPos);
+        }
+        break;
+    default:
+        ERRORF("unknown bot type %d", type);
+    }
+
+    if (!b2VecEqual(move, b2Vec2_zero)) {
+        droneMove(drone, move);
+    }
+    drone->lastMove = move;
+
+    botAimAndShoot(e, drone, pos, enemy, enemyPos);
+}
+
+#endif
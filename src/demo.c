@@ -81,7 +81,7 @@ int main(void) {
     float *rewards = (float *)fastCalloc(NUM_DRONES, sizeof(float));
     float *actions = (float *)fastCalloc(NUM_DRONES * ACTION_SIZE, sizeof(float));
     uint8_t *terminals = (uint8_t *)fastCalloc(NUM_DRONES, sizeof(uint8_t));
-    logBuffer *logs = createLogBuffer(LOG_BUFFER_SIZE);
+    statsAccumulator *logs = createStatsAccumulator(NUM_DRONES);
 
     initEnv(e, NUM_DRONES, NUM_DRONES, obs, actions, rewards, terminals, logs, time(NULL));
 
@@ -95,15 +95,14 @@ int main(void) {
             fastFree(actions);
             fastFree(rewards);
             fastFree(terminals);
-            destroyLogBuffer(logs);
+            destroyStatsAccumulator(logs);
             fastFree(e);
             destroyRayClient(client);
             return 0;
         }
 
         for (uint8_t i = 0; i < e->numDrones; i++) {
-            droneEntity *drone;
-            cc_array_get_at(e->drones, i, (void **)&drone);
+            droneEntity *drone = &e->drones[i];
             getPlayerInputs(e, drone, i);
         }
 
@@ -0,0 +1,122 @@
+#ifndef IMPULSE_WARS_ENTITIES_H
+#define IMPULSE_WARS_ENTITIES_H
+
+#include "helpers.h"
+#include "settings.h"
+#include "types.h"
+
+// Shapes store a handle to their entity as user data instead of a
+// pointer. Handles are looked up in the env's entity table, which checks
+// the generation of the handle against the generation of the slot, so a
+// handle to an entity that was destroyed is detected instead of leaving
+// a dangling pointer. Slots of destroyed entities are reused.
+//
+// Pointers to slots are only valid until the next entity is created,
+// as creating an entity may grow the table. Handles don't outlive the
+// episode they were created in, the table is cleared when the env is.
+//
+// The table is allocated with the system allocator so envs can create
+// entities on different threads, see arena.h.
+//
+// Slots point to entities instead of entities being stored in dense per
+// type arrays. Game code keeps pointers to walls, pickups and projectiles
+// in the env's lists across steps and contact handlers, and dense arrays
+// would move entities whenever one is removed. Drones are already stored
+// densely in the env, and the other entities are allocated from the env's
+// arena so creating them doesn't hit the system allocator.
+
+#define ENTITY_TABLE_INITIAL_CAPACITY 512
+#define ENTITY_INDEX_BITS 16
+#define ENTITY_INDEX_MASK ((1 << ENTITY_INDEX_BITS) - 1)
+#define NO_FREE_ENTITY_SLOT UINT16_MAX
+
+void initEntityTable(entityTable *table) {
+    table->slots = (entity *)calloc(ENTITY_TABLE_INITIAL_CAPACITY, sizeof(entity));
+    table->size = 0;
+    table->capacity = ENTITY_TABLE_INITIAL_CAPACITY;
+    table->freeHead = NO_FREE_ENTITY_SLOT;
+}
+
+void destroyEntityTable(entityTable *table) {
+    free(table->slots);
+    table->slots = NULL;
+}
+
+// releases every slot, existing handles must not be used afterwards
+void clearEntityTable(entityTable *table) {
+    table->size = 0;
+    table->freeHead = NO_FREE_ENTITY_SLOT;
+}
+
+static inline entityHandle makeEntityHandle(const uint16_t idx, const uint16_t generation) {
+    return ((entityHandle)generation << ENTITY_INDEX_BITS) | idx;
+}
+
+// returns the entity the handle refers to, or NULL if it was destroyed
+static inline entity *getEntity(const entityTable *table, const entityHandle handle) {
+    const uint16_t idx = handle & ENTITY_INDEX_MASK;
+    const uint16_t generation = handle >> ENTITY_INDEX_BITS;
+    // generations start at 1 so NULL_ENTITY_HANDLE never matches
+    if (idx >= table->size || table->slots[idx].generation != generation) {
+        return NULL;
+    }
+    return &table->slots[idx];
+}
+
+entityHandle createEntity(entityTable *table, const enum entityType type, void *ent) {
+    uint16_t idx;
+    if (table->freeHead != NO_FREE_ENTITY_SLOT) {
+        idx = table->freeHead;
+        table->freeHead = table->slots[idx].nextFree;
+    } else {
+        if (table->size == table->capacity) {
+            if (table->capacity > NO_FREE_ENTITY_SLOT / 2) {
+                ERROR("entity table is full");
+            }
+            const uint16_t capacity = table->capacity * 2;
+            entity *slots = (entity *)realloc(table->slots, capacity * sizeof(entity));
+            if (slots == NULL) {
+                ERROR("failed to grow entity table");
+            }
+            table->slots = slots;
+            table->capacity = capacity;
+        }
+        idx = table->size++;
+        table->slots[idx].generation = 1;
+    }
+
+    entity *slot = &table->slots[idx];
+    slot->type = type;
+    slot->entity = ent;
+    return makeEntityHandle(idx, slot->generation);
+}
+
+void destroyEntity(entityTable *table, const entityHandle handle) {
+    entity *slot = getEntity(table, handle);
+    ASSERT(slot != NULL);
+
+    // invalidate every existing handle to the slot, 0 is skipped when
+    // the generation wraps around so handles are never NULL_ENTITY_HANDLE
+    slot->generation++;
+    if (slot->generation == 0) {
+        slot->generation = 1;
+    }
+    slot->entity = NULL;
+    slot->nextFree = table->freeHead;
+    table->freeHead = handle & ENTITY_INDEX_MASK;
+}
+
+static inline void *entityHandleToUserData(const entityHandle handle) {
+    return (void *)(uintptr_t)handle;
+}
+
+static inline entityHandle shapeEntityHandle(const b2ShapeId shapeID) {
+    return (entityHandle)(uintptr_t)b2Shape_GetUserData(shapeID);
+}
+
+// returns the entity of a shape, or NULL if it was destroyed
+static inline entity *shapeEntity(const env *e, const b2ShapeId shapeID) {
+    return getEntity(&e->entities, shapeEntityHandle(shapeID));
+}
+
+#endif
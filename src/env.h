@@ -1,229 +1,360 @@
 #ifndef IMPULSE_WARS_ENV_H
 #define IMPULSE_WARS_ENV_H
 
+#include "arena.h"
+#include "bots.h"
+#include "entities.h"
 #include "game.h"
+#include "inference.h"
 #include "map.h"
+#include "raster.h"
+#include "replay.h"
 #include "settings.h"
+#include "stats.h"
 #include "types.h"
 
+#ifndef AUTOPXD
+#include <pthread.h>
+#endif
+
 // autopdx can't parse raylib's headers for some reason, but that's ok
 // because the Cython code doesn't need to directly use raylib anyway
 // include the full render header if we're compiling C code, otherwise
 // just declare the necessary functions the Cython code needs
 #ifndef AUTOPXD
 #include "render.h"
+#include "viewer.h"
 #else
 rayClient *createRayClient();
+rayClient *createHeadlessRayClient();
 void destroyRayClient(rayClient *client);
+void renderEnv(env *e);
+envViewer *createEnvViewer(env *envs, const uint16_t numEnvs, const uint16_t fps);
+void destroyEnvViewer(envViewer *viewer);
 #endif
 
-static inline b2Vec2 b2Rotate(b2Vec2 v, float angle) {
-    float cosAngle = cosf(angle);
-    float sinAngle = sinf(angle);
-    return (b2Vec2){
-        .x = v.x * cosAngle - v.y * sinAngle,
-        .y = v.x * sinAngle + v.y * cosAngle
-    };
-}
+// the trainer's kernels aren't used by envs, they're only included so
+// the Cython code can use them
+#ifndef AUTOPXD
+#include "gae.h"
+#include "rollout.h"
+#else
+void computeGAE(const float *rewards, const float *dones, const float *values, float *advantages, float *returns, const int64_t *rowOffsets, const uint32_t numRows, const float gamma, const float gaeLambda, const bool normalize, uint8_t numThreads);
+bool sortRolloutSteps(const int32_t *envIds, const uint32_t numSteps, const uint32_t numEnvIds, int64_t *rowOffsets, int64_t *sortedIdxs, int64_t *segmentIdxs, const uint32_t bpttHorizon, const uint32_t numMinibatches);
+#endif
+
+#ifndef AUTOPXD
+// what each component of a discrete action decodes to, built once so
+// decoding an action is only table lookups
+b2Rot aimRotations[_AIM_ACTIONS][_ROTATION_ACTIONS];
+const b2Vec2 boostDirections[_BOOST_ACTIONS] = {
+    {.x = 0.0f, .y = 0.0f},  // No-op
+    {.x = -1.0f, .y = 0.0f}, // Left
+    {.x = 1.0f, .y = 0.0f},  // Right
+    {.x = 0.0f, .y = -1.0f}, // Up
+    {.x = 0.0f, .y = 1.0f},  // Down
+};
+// rotation steps aren't converted to radians to keep the behavior the
+// policies were trained with
+const float rotationSteps[_ROTATION_ACTIONS] = {0.0f, 5.0f, 15.0f, 30.0f};
+pthread_once_t actionTablesOnce = PTHREAD_ONCE_INIT;
+#endif
 
-logBuffer *createLogBuffer(uint16_t capacity) {
-    logBuffer *logs = (logBuffer *)fastCalloc(1, sizeof(logBuffer));
-    logs->logs = (logEntry *)fastCalloc(capacity, sizeof(logEntry));
-    logs->size = 0;
-    logs->capacity = capacity;
-    return logs;
+static void buildActionTables() {
+    for (uint8_t aim = 0; aim < AIM_ACTIONS; aim++) {
+        for (uint8_t rotation = 0; rotation < ROTATION_ACTIONS; rotation++) {
+            // the last aim action doesn't rotate the aim
+            if (aim == AIM_ACTIONS - 1) {
+                aimRotations[aim][rotation] = b2Rot_identity;
+                continue;
+            }
+            const float angle = rotationSteps[rotation];
+            aimRotations[aim][rotation] = (b2Rot){.c = cosf(angle), .s = sinf(angle)};
+        }
+    }
 }
 
-void destroyLogBuffer(logBuffer *buffer) {
-    fastFree(buffer->logs);
-    fastFree(buffer);
+// envs can be created on different threads, so the tables are only built
+// by the first one
+void initActionTables() {
+    pthread_once(&actionTablesOnce, buildActionTables);
 }
 
-void addLogEntry(logBuffer *logs, logEntry *log) {
-    if (logs->size == logs->capacity) {
-        return;
-    }
-    logs->logs[logs->size] = *log;
-    logs->size += 1;
+#ifndef AUTOPXD
+// Box2D claims and releases worlds in a process wide table without
+// locking, so envs reset on different threads take turns creating and
+// destroying worlds
+pthread_mutex_t worldLock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static inline b2WorldId createEnvWorld(const b2WorldDef *worldDef) {
+    pthread_mutex_lock(&worldLock);
+    const b2WorldId worldID = b2CreateWorld(worldDef);
+    pthread_mutex_unlock(&worldLock);
+    return worldID;
 }
 
-logEntry aggregateAndClearLogBuffer(uint8_t numDrones, logBuffer *logs) {
-    logEntry log = {0};
-    if (logs->size == 0) {
-        return log;
-    }
+static inline void destroyEnvWorld(const b2WorldId worldID) {
+    pthread_mutex_lock(&worldLock);
+    b2DestroyWorld(worldID);
+    pthread_mutex_unlock(&worldLock);
+}
 
-    DEBUG_LOGF("aggregating logs, size: %d", logs->size);
+static inline droneAction decodeDiscreteAction(const int *actions) {
+    uint8_t components[_ACTION_COMPONENTS];
+    normalizeDiscreteAction(actions, components);
+    return (droneAction){
+        .aimRotation = aimRotations[components[0]][components[3]],
+        .boost = boostDirections[components[1]],
+        .fire = components[2] == 1,
+    };
+}
 
-    const float logSize = logs->size;
-    for (uint16_t i = 0; i < logs->size; i++) {
-        log.length += logs->logs[i].length / logSize;
+// Hot loops are written as kernels that take the number of map cells,
+// drones and agents as arguments. They are always inlined, so variants
+// called with constants for common configurations get loops with
+// compile-time bounds the compiler can unroll, other configurations
+// call them with the runtime values.
 
-        for (uint8_t j = 0; j < numDrones; j++) {
-            log.stats[j].reward += logs->logs[i].stats[j].reward / logSize;
-            log.stats[j].wins += logs->logs[i].stats[j].wins / logSize;
+#ifndef AUTOPXD
+// env configurations that get specialized obs and step functions,
+// as (drones, agents)
+#define ENV_DRONE_VARIANTS(X, ...) \
+    X(2, 2, __VA_ARGS__)           \
+    X(2, 1, __VA_ARGS__)           \
+    X(4, 4, __VA_ARGS__)
+// number of cells of the built-in maps
+#define ENV_MAP_CELL_VARIANTS(X) \
+    X(400)                       \
+    X(441)
+#endif
 
-            for (uint8_t k = 0; k < NUM_WEAPONS; k++) {
-                log.stats[j].distanceTraveled += logs->logs[i].stats[j].distanceTraveled / logSize;
-                log.stats[j].absDistanceTraveled += logs->logs[i].stats[j].absDistanceTraveled / logSize;
-                log.stats[j].shotsFired[k] += logs->logs[i].stats[j].shotsFired[k] / logSize;
-                log.stats[j].shotsHit[k] += logs->logs[i].stats[j].shotsHit[k] / logSize;
-                log.stats[j].shotsTaken[k] += logs->logs[i].stats[j].shotsTaken[k] / logSize;
-                log.stats[j].ownShotsTaken[k] += logs->logs[i].stats[j].ownShotsTaken[k] / logSize;
-                log.stats[j].weaponsPickedUp[k] += logs->logs[i].stats[j].weaponsPickedUp[k] / logSize;
-                log.stats[j].shotDistances[k] += logs->logs[i].stats[j].shotDistances[k] / logSize;
-            }
-        }
+// computes the scalar obs of a drone, obs must hold SCALAR_OBS_SIZE bytes
+static FORCE_INLINE void droneScalarObs(env *e, const uint8_t droneIdx, uint8_t *obs) {
+    uint16_t offset = 0;
+    droneEntity *activeDrone = &e->drones[droneIdx];
+    const b2Vec2 pos = getCachedPos(activeDrone->bodyID, &activeDrone->pos);
+    const b2Vec2 vel = b2Body_GetLinearVelocity(activeDrone->bodyID);
+
+    int8_t maxAmmo = weaponAmmo(e->defaultWeapon->type, activeDrone->weaponInfo->type);
+    uint8_t scaledAmmo = 0;
+    if (activeDrone->ammo != INFINITE) {
+        scaledAmmo = scaleValue(activeDrone->ammo, maxAmmo, true);
     }
 
-    logs->size = 0;
-    return log;
+    obs[offset++] = scaleValue(pos.x, MAX_X_POS, false) * 255;
+    obs[offset++] = scaleValue(pos.y, MAX_Y_POS, false) * 255;
+    obs[offset++] = scaleValue(vel.x, MAX_SPEED, false) * 255;
+    obs[offset++] = scaleValue(vel.y, MAX_SPEED, false) * 255;
+    obs[offset++] = scaleValue(activeDrone->lastAim.x, 1.0f, false) * 255;
+    obs[offset++] = scaleValue(activeDrone->lastAim.y, 1.0f, false) * 255;
+    obs[offset++] = scaledAmmo * 255;
+    obs[offset++] = scaleValue(activeDrone->weaponCooldown, activeDrone->weaponInfo->coolDown, true) * 255;
+    obs[offset++] = scaleValue(activeDrone->charge, weaponCharge(activeDrone->weaponInfo->type), true) * 255;
+    oneHotEncode(obs, offset, activeDrone->weaponInfo->type, NUM_WEAPONS);
 }
 
-void computeObs(env *e) {
-    memset(e->obs, 0x0, OBS_SIZE * e->numAgents * sizeof(uint8_t));
-
-    for (uint8_t agent = 0; agent < e->numAgents; agent++) {
-        uint16_t offset = OBS_SIZE * agent;
-        const uint16_t obsStart = offset;
-
-        // compute map wall observations
-        // TODO: needs to be padded for smaller maps then max size
-        for (size_t i = 0; i < cc_array_size(e->cells); i++) {
-            const mapCell *cell = safe_array_get_at(e->cells, i);
-
-            if (cell->ent != NULL) {
-                uint8_t wallType = 0;
-                if (entityTypeIsWall(cell->ent->type)) {
-                    wallType = cell->ent->type + 1;
-                }
-                e->obs[offset++] = wallType;
+// computes the observation of a drone from its perspective, obs must
+// hold OBS_SIZE bytes
+static FORCE_INLINE void droneObsKernel(env *e, const uint8_t droneIdx, uint8_t *obs, const uint16_t numCells, const uint8_t numDrones) {
+    // compute map wall observations, every byte of the map obs is
+    // written once so the padding around smaller maps is only zeroed
+    // instead of the whole obs
+    const uint8_t columns = e->columns;
+    const uint16_t rows = numCells / columns;
+    const uint16_t rowPadding = (OBS_MAP_COLUMNS - columns) * MAP_CELL_OBS_SIZE;
+    uint16_t offset = e->obsCellOffset * MAP_CELL_OBS_SIZE;
+    memset(obs, 0x0, offset * sizeof(uint8_t));
+    uint16_t cellIdx = 0;
+    for (uint16_t row = 0; row < rows; row++) {
+        for (uint8_t col = 0; col < columns; col++) {
+            obs[offset] = e->cells.wallTypes[cellIdx];
+            obs[offset + 1] = e->cells.pickupWeapons[cellIdx];
+            obs[offset + PROJECTILE_OBS_OFFSET] = 0;
+            obs[offset + FLOATING_WALL_OBS_OFFSET] = 0;
+            obs[offset + DRONE_OBS_OFFSET] = 0;
+            offset += MAP_CELL_OBS_SIZE;
+            cellIdx++;
+        }
+        if (row != rows - 1) {
+            memset(obs + offset, 0x0, rowPadding * sizeof(uint8_t));
+            offset += rowPadding;
+        }
+    }
+    ASSERT(offset <= MAP_OBS_SIZE);
+    memset(obs + offset, 0x0, (MAP_OBS_SIZE - offset) * sizeof(uint8_t));
+
+    // compute projectile observations
+    for (SNode *cur = e->projectiles->head; cur != NULL; cur = cur->next) {
+        const projectileEntity *projectile = (projectileEntity *)cur->data;
+        const int16_t cellIdx = entityPosToCellIdx(e, projectile->lastPos);
+        if (cellIdx == -1) {
+            continue;
+        }
+        // don't add the projectile to the obs if it somehow
+        // overlaps with a static wall
+        if (cellIsWall(e, cellIdx)) {
+            continue;
+        }
 
-                uint8_t pickupWeaponType = 0;
-                if (cell->ent->type == WEAPON_PICKUP_ENTITY) {
-                    weaponPickupEntity *pickup = (weaponPickupEntity *)cell->ent->entity;
-                    pickupWeaponType = pickup->weapon + 1;
-                }
-                e->obs[offset++] = pickupWeaponType;
-                offset += MAP_CELL_OBS_SIZE - 2;
-            } else {
-                offset += MAP_CELL_OBS_SIZE;
-            }
+        const uint8_t projWeapon = projectile->weaponInfo->type + 1;
+        ASSERT(projWeapon <= NUM_WEAPONS + 1);
+        const uint16_t offset = (cellObsIdx(e, cellIdx) * MAP_CELL_OBS_SIZE) + PROJECTILE_OBS_OFFSET;
+        ASSERTF(offset <= OBS_SIZE, "offset: %d, max offset: %d, last pos: %f %f", offset, OBS_SIZE, projectile->lastPos.x, projectile->lastPos.y);
+        obs[offset] = projWeapon;
+    }
+    // compute floating wall observations
+    for (size_t i = 0; i < cc_array_size(e->floatingWalls); i++) {
+        const wallEntity *wall = safe_array_get_at(e->floatingWalls, i);
+        const int16_t cellIdx = entityPosToCellIdx(e, wall->pos.pos);
+        if (cellIdx == -1) {
+            continue;
+        }
+        // don't add the floating wall to the obs if it somehow
+        // overlaps with a static wall
+        if (cellIsWall(e, cellIdx)) {
+            continue;
+        }
 
-            ASSERT(i <= MAX_MAP_COLUMNS * MAX_MAP_ROWS);
-            ASSERT(offset <= (OBS_SIZE * agent) + MAP_OBS_SIZE);
+        const uint8_t wallType = wall->type + 1;
+        ASSERT(wallType <= NUM_WALL_TYPES + 1);
+        const uint16_t offset = (cellObsIdx(e, cellIdx) * MAP_CELL_OBS_SIZE) + FLOATING_WALL_OBS_OFFSET;
+        ASSERT(offset <= OBS_SIZE);
+        obs[offset] = wallType;
+    }
+    // compute drone observations
+    for (uint8_t i = 0; i < numDrones; i++) {
+        const droneEntity *drone = &e->drones[i];
+        const int16_t cellIdx = entityPosToCellIdx(e, drone->pos.pos);
+        if (cellIdx == -1) {
+            continue;
+        }
+        // don't add the drone to the obs if it somehow
+        // overlaps with a static wall
+        if (cellIsWall(e, cellIdx)) {
+            continue;
         }
 
-        // compute projectile observations
-        for (SNode *cur = e->projectiles->head; cur != NULL; cur = cur->next) {
-            const projectileEntity *projectile = (projectileEntity *)cur->data;
-            const int16_t cellIdx = entityPosToCellIdx(e, projectile->lastPos);
-            if (cellIdx == -1) {
-                continue;
-            }
-            // don't add the projectile to the obs if it somehow
-            // overlaps with a static wall
-            const mapCell *cell = safe_array_get_at(e->cells, cellIdx);
-            if (cell->ent != NULL && entityTypeIsWall(cell->ent->type)) {
-                continue;
-            }
+        const uint8_t droneWeapon = drone->weaponInfo->type + 1;
+        ASSERT(droneWeapon <= NUM_WEAPONS + 1);
+        const uint16_t offset = (cellObsIdx(e, cellIdx) * MAP_CELL_OBS_SIZE) + DRONE_OBS_OFFSET;
+        ASSERT(offset <= OBS_SIZE);
+        obs[offset] = droneWeapon;
+    }
 
-            const uint8_t projWeapon = projectile->weaponInfo->type + 1;
-            ASSERT(projWeapon <= NUM_WEAPONS + 1);
-            const uint16_t offset = obsStart + (cellIdx * MAP_CELL_OBS_SIZE) + PROJECTILE_OBS_OFFSET;
-            ASSERTF(offset <= OBS_SIZE * (agent + 1), "offset: %d, max offset: %d, last pos: %f %f", offset, OBS_SIZE * (agent + 1), projectile->lastPos.x, projectile->lastPos.y);
-            e->obs[offset] = projWeapon;
-        }
-        // compute floating wall observations
-        for (size_t i = 0; i < cc_array_size(e->floatingWalls); i++) {
-            const wallEntity *wall = safe_array_get_at(e->floatingWalls, i);
-            const int16_t cellIdx = entityPosToCellIdx(e, wall->pos.pos);
-            if (cellIdx == -1) {
-                continue;
-            }
-            // don't add the floating wall to the obs if it somehow
-            // overlaps with a static wall
-            const mapCell *cell = safe_array_get_at(e->cells, cellIdx);
-            if (cell->ent != NULL && entityTypeIsWall(cell->ent->type)) {
-                continue;
-            }
+    droneScalarObs(e, droneIdx, obs + MAP_OBS_SIZE);
+}
 
-            const uint8_t wallType = wall->type + 1;
-            ASSERT(wallType <= NUM_WALL_TYPES + 1);
-            const uint16_t offset = obsStart + (cellIdx * MAP_CELL_OBS_SIZE) + FLOATING_WALL_OBS_OFFSET;
-            ASSERT(offset <= OBS_SIZE * (agent + 1));
-            e->obs[offset] = wallType;
-        }
-        // compute drone observations
-        for (uint8_t i = 0; i < e->numDrones; i++) {
-            const droneEntity *drone = safe_array_get_at(e->drones, i);
-            const int16_t cellIdx = entityPosToCellIdx(e, drone->pos.pos);
-            if (cellIdx == -1) {
-                continue;
-            }
-            // don't add the drone to the obs if it somehow
-            // overlaps with a static wall
-            const mapCell *cell = safe_array_get_at(e->cells, cellIdx);
-            if (cell->ent != NULL && entityTypeIsWall(cell->ent->type)) {
-                continue;
-            }
+void computeDroneObs(env *e, const uint8_t droneIdx, uint8_t *obs) {
+    droneObsKernel(e, droneIdx, obs, e->cells.count, e->numDrones);
+}
+
+// computes the pixel obs of every agent, the channels that are the same
+// for every agent are drawn once and copied
+void computePixelObs(env *e) {
+    if (e->pixelWallsVersion != e->staticWallsVersion) {
+        rasterStaticWalls(e, e->pixelWalls);
+        e->pixelWallsVersion = e->staticWallsVersion;
+    }
 
-            const uint8_t droneWeapon = drone->weaponInfo->type + 1;
-            ASSERT(droneWeapon <= NUM_WEAPONS + 1);
-            const uint16_t offset = obsStart + (cellIdx * MAP_CELL_OBS_SIZE) + DRONE_OBS_OFFSET;
-            ASSERT(offset <= OBS_SIZE * (agent + 1));
-            e->obs[offset] = droneWeapon;
+    rasterSharedChannels(e, e->obs);
+    for (uint8_t agent = 0; agent < e->numAgents; agent++) {
+        uint8_t *obs = e->obs + (PIXEL_OBS_SIZE * agent);
+        if (agent != 0) {
+            // the shared channels come before the drone channels
+            memcpy(obs, e->obs, PIXEL_DRONE_CHANNEL * PIXEL_CHANNEL_SIZE * sizeof(uint8_t));
         }
+        rasterDroneChannels(e, agent, obs);
+        droneScalarObs(e, agent, obs + PIXEL_MAP_OBS_SIZE);
+    }
+}
 
-        // compute active drone observations
-        offset = obsStart + MAP_OBS_SIZE;
-        droneEntity *activeDrone = safe_array_get_at(e->drones, agent);
-        const b2Vec2 pos = getCachedPos(activeDrone->bodyID, &activeDrone->pos);
-        const b2Vec2 vel = b2Body_GetLinearVelocity(activeDrone->bodyID);
+static FORCE_INLINE void obsKernel(env *e, const uint16_t numCells, const uint8_t numDrones, const uint8_t numAgents) {
+    for (uint8_t agent = 0; agent < numAgents; agent++) {
+        droneObsKernel(e, agent, e->obs + (OBS_SIZE * agent), numCells, numDrones);
+    }
+}
 
-        int8_t maxAmmo = weaponAmmo(e->defaultWeapon->type, activeDrone->weaponInfo->type);
-        uint8_t scaledAmmo = 0;
-        if (activeDrone->ammo != INFINITE) {
-            scaledAmmo = scaleValue(activeDrone->ammo, maxAmmo, true);
-        }
+void computeObsGeneric(env *e) {
+    if (e->pixelObs) {
+        computePixelObs(e);
+        return;
+    }
+    obsKernel(e, e->cells.count, e->numDrones, e->numAgents);
+}
 
-        e->obs[offset++] = scaleValue(pos.x, MAX_X_POS, false) * 255;
-        e->obs[offset++] = scaleValue(pos.y, MAX_Y_POS, false) * 255;
-        e->obs[offset++] = scaleValue(vel.x, MAX_SPEED, false) * 255;
-        e->obs[offset++] = scaleValue(vel.y, MAX_SPEED, false) * 255;
-        e->obs[offset++] = scaleValue(activeDrone->lastAim.x, 1.0f, false) * 255;
-        e->obs[offset++] = scaleValue(activeDrone->lastAim.y, 1.0f, false) * 255;
-        e->obs[offset++] = scaledAmmo * 255;
-        e->obs[offset++] = scaleValue(activeDrone->weaponCooldown, activeDrone->weaponInfo->coolDown, true) * 255;
-        e->obs[offset++] = scaleValue(activeDrone->charge, weaponCharge(activeDrone->weaponInfo->type), true) * 255;
-        oneHotEncode(e->obs, offset, activeDrone->weaponInfo->type, NUM_WEAPONS);
+#ifndef AUTOPXD
+#define DEFINE_OBS_VARIANT(drones, agents, cells)                           \
+    void computeObs##cells##Cells##drones##Drones##agents##Agents(env *e) { \
+        obsKernel(e, cells, drones, agents);                                \
     }
+#define DEFINE_OBS_VARIANTS(cells) ENV_DRONE_VARIANTS(DEFINE_OBS_VARIANT, cells)
+ENV_MAP_CELL_VARIANTS(DEFINE_OBS_VARIANTS)
+#endif
+
+// computes the observations of all agents, using a specialized variant
+// if there is one for the env's configuration
+void computeObs(env *e) {
+    if (e->pixelObs) {
+        computePixelObs(e);
+        return;
+    }
+#ifndef AUTOPXD
+    const uint16_t numCells = e->cells.count;
+#define DISPATCH_OBS_VARIANT(drones, agents, cells)                              \
+    if (numCells == cells && e->numDrones == drones && e->numAgents == agents) { \
+        computeObs##cells##Cells##drones##Drones##agents##Agents(e);             \
+        return;                                                                  \
+    }
+#define DISPATCH_OBS_VARIANTS(cells) ENV_DRONE_VARIANTS(DISPATCH_OBS_VARIANT, cells)
+    ENV_MAP_CELL_VARIANTS(DISPATCH_OBS_VARIANTS)
+#undef DISPATCH_OBS_VARIANTS
+#undef DISPATCH_OBS_VARIANT
+#endif
+    computeObsGeneric(e);
 }
 
 void setupEnv(env *e) {
     e->needsReset = false;
+    // the RNG state is all that's needed to recreate the episode's
+    // initial state, save it before anything consumes it
+    const uint64_t episodeSeed = e->randState;
 
     b2WorldDef worldDef = b2DefaultWorldDef();
     worldDef.gravity = (b2Vec2){.x = 0.0f, .y = 0.0f};
-    e->worldID = b2CreateWorld(&worldDef);
+    e->worldID = createEnvWorld(&worldDef);
 
     e->stepsLeft = ROUND_STEPS;
     e->suddenDeathSteps = SUDDEN_DEATH_STEPS;
     e->suddenDeathWallCounter = 0;
+    e->staticWallsVersion++;
 
     DEBUG_LOG("creating map");
-    const int mapIdx = 0; // randInt(&e->randState, 0, NUM_MAPS - 1);
-    createMap(e, mapIdx);
-
-    mapBounds bounds = {.min = {.x = FLT_MAX, .y = FLT_MAX}, .max = {.x = FLT_MIN, .y = FLT_MIN}};
-    for (size_t i = 0; i < cc_array_size(e->walls); i++) {
-        const wallEntity *wall = safe_array_get_at(e->walls, i);
-        bounds.min.x = fminf(wall->pos.pos.x - wall->extent.x + WALL_THICKNESS, bounds.min.x);
-        bounds.min.y = fminf(wall->pos.pos.y - wall->extent.y + WALL_THICKNESS, bounds.min.y);
-        bounds.max.x = fmaxf(wall->pos.pos.x + wall->extent.x - WALL_THICKNESS, bounds.max.x);
-        bounds.max.y = fmaxf(wall->pos.pos.y + wall->extent.y - WALL_THICKNESS, bounds.max.y);
+    // cached templates can be evicted by envs reset on other threads, so
+    // the cache is locked until the env is done with the template
+    const bool cachedMap = e->generateMaps || e->mapLibrary != NULL;
+    if (cachedMap) {
+        pthread_mutex_lock(&mapCacheLock);
+    }
+    const mapTemplate *tmpl;
+    if (e->generateMaps) {
+        // maps of a pool are generated from the pool index so the same
+        // maps are reused and stay cached
+        uint64_t mapSeed = wyhash64(&e->randState);
+        if (e->mapPoolSize != 0) {
+            mapSeed %= e->mapPoolSize;
+        }
+        e->mapIdx = GENERATED_MAP_IDX;
+        tmpl = generatedMapTemplate(&e->mapGen, mapSeed);
+    } else if (e->mapLibrary != NULL) {
+        const uint32_t libraryIdx = wyhash64(&e->randState) % e->mapLibrary->numMaps;
+        e->mapIdx = LIBRARY_MAP_IDX;
+        tmpl = libraryMapTemplate(e->mapLibrary, libraryIdx);
+    } else {
+        e->mapIdx = sampleMap(e);
+        tmpl = &mapTemplates[e->mapIdx];
     }
-    e->bounds = bounds;
+    createMap(e, tmpl);
 
     DEBUG_LOG("creating drones");
     for (int i = 0; i < e->numDrones; i++) {
@@ -231,19 +362,29 @@ void setupEnv(env *e) {
     }
 
     DEBUG_LOG("placing floating walls");
-    placeRandFloatingWalls(e, mapIdx);
+    placeRandFloatingWalls(e, tmpl);
 
     DEBUG_LOG("creating weapon pickups");
-    for (int i = 0; i < maps[mapIdx]->weaponPickups; i++) {
+    for (int i = 0; i < tmpl->weaponPickups; i++) {
         createWeaponPickup(e);
     }
+    if (cachedMap) {
+        pthread_mutex_unlock(&mapCacheLock);
+    }
+
+    if (e->recorder != NULL) {
+        recordEpisodeStart(e->recorder, episodeSeed, e->mapIdx, e->botTypes);
+    }
 
     computeObs(e);
 }
 
-env *initEnv(env *e, uint8_t numDrones, uint8_t numAgents, uint8_t *obs, int *actions, float *rewards, uint8_t *terminals, logBuffer *logs, uint64_t seed) {
+env *initEnv(env *e, uint8_t numDrones, uint8_t numAgents, uint8_t *obs, int *actions, float *rewards, uint8_t *terminals, statsAccumulator *logs, uint64_t seed) {
     e->numDrones = numDrones;
     e->numAgents = numAgents;
+    for (uint8_t i = 0; i < _MAX_DRONES; i++) {
+        e->botTypes[i] = NO_BOT;
+    }
 
     e->obs = obs;
     e->actions = actions;
@@ -252,13 +393,27 @@ env *initEnv(env *e, uint8_t numDrones, uint8_t numAgents, uint8_t *obs, int *ac
 
     e->randState = seed;
     e->needsReset = false;
+    e->recorder = NULL;
+    e->videoRecorder = NULL;
+    e->pixelObs = false;
+    e->pixelWalls = NULL;
+    e->snapshotBuffer = NULL;
 
     e->logs = logs;
 
-    cc_array_new(&e->cells);
+    initActionTables();
+    initMapTemplates();
+    for (uint8_t i = 0; i < NUM_MAPS; i++) {
+        e->mapWeights[i] = 1.0f / NUM_MAPS;
+    }
+    e->generateMaps = false;
+    e->mapLibrary = NULL;
+
+    initArena(&e->arena);
+    initEntityTable(&e->entities);
+    e->cells.count = 0;
     cc_array_new(&e->walls);
     cc_array_new(&e->floatingWalls);
-    cc_array_new(&e->drones);
     cc_array_new(&e->pickups);
     cc_slist_new(&e->projectiles);
 
@@ -274,50 +429,47 @@ void clearEnv(env *e) {
     e->episodeLength = 0;
     memset(e->stats, 0x0, sizeof(e->stats));
 
-    for (size_t i = 0; i < cc_array_size(e->pickups); i++) {
-        weaponPickupEntity *pickup = safe_array_get_at(e->pickups, i);
-        destroyWeaponPickup(pickup);
-    }
-
-    for (uint8_t i = 0; i < e->numDrones; i++) {
-        droneEntity *drone = safe_array_get_at(e->drones, i);
-        destroyDrone(drone);
-    }
-
     destroyAllProjectiles(e);
 
-    for (size_t i = 0; i < cc_array_size(e->walls); i++) {
-        wallEntity *wall = safe_array_get_at(e->walls, i);
-        destroyWall(wall);
-    }
-
-    for (size_t i = 0; i < cc_array_size(e->floatingWalls); i++) {
-        wallEntity *wall = safe_array_get_at(e->floatingWalls, i);
-        destroyWall(wall);
-    }
-
-    for (size_t i = 0; i < cc_array_size(e->cells); i++) {
-        mapCell *cell = safe_array_get_at(e->cells, i);
-        fastFree(cell);
-    }
+    // bodies are destroyed with the world and entities are released with
+    // the arena, so entities don't need to be destroyed one by one
+    clearEntityTable(&e->entities);
+    resetArena(&e->arena);
 
-    cc_array_remove_all(e->cells);
+    e->cells.count = 0;
     cc_array_remove_all(e->walls);
     cc_array_remove_all(e->floatingWalls);
-    cc_array_remove_all(e->drones);
     cc_array_remove_all(e->pickups);
     cc_slist_remove_all(e->projectiles);
 
-    b2DestroyWorld(e->worldID);
+    destroyEnvWorld(e->worldID);
+}
+
+// writes the frames that haven't been written yet and closes the
+// video, returns false if any frames failed to be written
+bool envStopVideoRecording(env *e) {
+    if (e->videoRecorder == NULL) {
+        return true;
+    }
+    const bool ok = destroyVideoRecorder(e->videoRecorder);
+    e->videoRecorder = NULL;
+    return ok;
 }
 
 void destroyEnv(env *e) {
     clearEnv(e);
 
-    cc_array_destroy(e->cells);
+    if (e->recorder != NULL) {
+        destroyReplayRecorder(e->recorder);
+        e->recorder = NULL;
+    }
+    envStopVideoRecording(e);
+    fastFree(e->pixelWalls);
+
+    destroyEntityTable(&e->entities);
+    destroyArena(&e->arena);
     cc_array_destroy(e->walls);
     cc_array_destroy(e->floatingWalls);
-    cc_array_destroy(e->drones);
     cc_array_destroy(e->pickups);
     cc_slist_destroy(e->projectiles);
 }
@@ -330,7 +482,7 @@ void resetEnv(env *e) {
 float computeShotHitReward(env *e, const uint8_t enemyIdx) {
     // compute reward based off of how much the projectile(s) or explosion(s)
     // caused the enemy drone to change velocity
-    const droneEntity *enemyDrone = safe_array_get_at(e->drones, enemyIdx);
+    const droneEntity *enemyDrone = &e->drones[enemyIdx];
     const float prevEnemySpeed = b2Length(enemyDrone->lastVelocity);
     const float curEnemySpeed = b2Length(b2Body_GetLinearVelocity(enemyDrone->bodyID));
     return scaleValue(fabsf(curEnemySpeed - prevEnemySpeed), MAX_SPEED, true) * SHOT_HIT_REWARD_COEF;
@@ -366,7 +518,7 @@ void computeRewards(env *e, const bool roundOver, const uint8_t winner) {
     }
 
     for (int i = 0; i < e->numDrones; i++) {
-        const droneEntity *drone = safe_array_get_at(e->drones, i);
+        const droneEntity *drone = &e->drones[i];
         const float reward = computeReward(e, drone);
         if (i < e->numAgents) {
             e->rewards[i] += reward;
@@ -379,76 +531,75 @@ void computeRewards(env *e, const bool roundOver, const uint8_t winner) {
     }
 }
 
-void stepEnv(env *e) {
+// decodes the actions of every agent and policy bot, actions don't
+// change between frames so this only needs to be done once per step
+void decodeActions(env *e, droneAction *decoded) {
+    for (uint8_t i = 0; i < e->numDrones; i++) {
+        if (i < e->numAgents) {
+            decoded[i] = decodeDiscreteAction(e->actions + (i * ACTION_COMPONENTS));
+        } else if (e->botTypes[i] == POLICY_BOT) {
+            decoded[i] = decodeDiscreteAction(e->botActions + (i * ACTION_COMPONENTS));
+        }
+    }
+}
+
+// applies a decoded action of an agent or policy bot
+static inline void droneApplyAction(env *e, droneEntity *drone, const droneAction *action) {
+    drone->lastAim = b2RotateVector(action->aimRotation, drone->lastAim);
+
+    if (!b2VecEqual(action->boost, b2Vec2_zero)) {
+        droneMove(drone, action->boost);
+    }
+    drone->lastMove = action->boost;
+
+    if (action->fire) {
+        droneShoot(e, drone, drone->lastAim);
+    }
+}
+
+static FORCE_INLINE void stepEnvKernel(env *e, const uint8_t numDrones, const uint8_t numAgents) {
     if (e->needsReset) {
         DEBUG_LOG("Resetting environment");
         resetEnv(e);
     }
 
+    if (e->recorder != NULL) {
+        recordStep(e->recorder, e->actions, e->botTypes, e->botActions);
+    }
+
     // Reset reward buffer
-    memset(e->rewards, 0x0, e->numAgents * sizeof(float));
+    memset(e->rewards, 0x0, numAgents * sizeof(float));
+
+    droneAction actions[_MAX_DRONES];
+    decodeActions(e, actions);
 
     for (int frame = 0; frame < FRAMESKIP; frame++) {
         e->episodeLength++;
 
         // Handle actions
-        for (uint8_t i = 0; i < e->numDrones; i++) {
-            droneEntity *drone = safe_array_get_at(e->drones, i);
+        for (uint8_t i = 0; i < numDrones; i++) {
+            droneEntity *drone = &e->drones[i];
             drone->lastVelocity = b2Body_GetLinearVelocity(drone->bodyID);
             memset(&drone->hitInfo, 0x0, sizeof(stepHitInfo));
 
-            if (i >= e->numAgents) {
-                break;
-            }
-
-            const uint8_t offset = i * 4; // Each agent has 4 action components
-            uint8_t aim_action = e->actions[offset + 0];
-            uint8_t booster_action = e->actions[offset + 1];
-            uint8_t fire_action = e->actions[offset + 2];
-            uint8_t rotation_speed_action = e->actions[offset + 3];
-
-            // Handle aiming
-            float angle_step = 0.0f;
-            switch (rotation_speed_action) {
-                case 1: angle_step = 5.0f; break;  // Slow rotation
-                case 2: angle_step = 15.0f; break; // Medium rotation
-                case 3: angle_step = 30.0f; break; // Fast rotation
-                default: break; // No-op
-            }
-
-            if (aim_action < 16) { // 16 valid aiming directions
-                float angle = aim_action * (360.0f / 16.0f); // Map action to angle
-                b2Vec2 aim = {cosf(DEG_TO_RAD(angle)), sinf(DEG_TO_RAD(angle))};
-                // b2Vec2 normalized_aim = b2Normalize(aim);
-                drone->lastAim = b2Rotate(drone->lastAim, angle_step); // Apply rotation step
-            }
-
-            // Handle booster impulse
-            b2Vec2 boost = b2Vec2_zero;
-            switch (booster_action) {
-                case 1: boost = (b2Vec2){.x = -1.0f, .y = 0.0f}; break; // Left
-                case 2: boost = (b2Vec2){.x = 1.0f, .y = 0.0f}; break;  // Right
-                case 3: boost = (b2Vec2){.x = 0.0f, .y = -1.0f}; break; // Up
-                case 4: boost = (b2Vec2){.x = 0.0f, .y = 1.0f}; break;  // Down
-                default: break; // No-op
-            }
-            if (!b2VecEqual(boost, b2Vec2_zero)) {
-                droneMove(drone, boost);
+            if (i >= numAgents) {
+                if (e->botTypes[i] == POLICY_BOT) {
+                    droneApplyAction(e, drone, &actions[i]);
+                } else {
+                    botStep(e, drone);
+                }
+                continue;
             }
-            drone->lastMove = boost;
 
-            // Handle firing weapon
-            if (fire_action == 1) { // Fire
-                droneShoot(e, drone, drone->lastAim);
-            }
+            droneApplyAction(e, drone, &actions[i]);
         }
 
         // Step physics and handle events
         b2World_Step(e->worldID, DELTA_TIME, BOX2D_SUBSTEPS);
 
         // Mark old positions as invalid
-        for (uint8_t i = 0; i < e->numDrones; i++) {
-            droneEntity *drone = safe_array_get_at(e->drones, i);
+        for (uint8_t i = 0; i < numDrones; i++) {
+            droneEntity *drone = &e->drones[i];
             drone->pos.valid = false;
         }
         for (size_t i = 0; i < cc_array_size(e->floatingWalls); i++) {
@@ -475,8 +626,8 @@ void stepEnv(env *e) {
         // Step drones and check for round end conditions
         uint8_t dronesAlive = 0;
         uint8_t lastAlive = 0;
-        for (uint8_t i = 0; i < e->numDrones; i++) {
-            droneEntity *drone = safe_array_get_at(e->drones, i);
+        for (uint8_t i = 0; i < numDrones; i++) {
+            droneEntity *drone = &e->drones[i];
             droneStep(e, drone, DELTA_TIME);
             if (!drone->dead) {
                 dronesAlive++;
@@ -488,32 +639,63 @@ void stepEnv(env *e) {
 
         // Check if the round is over
         if (dronesAlive <= 1) {
-            memset(e->terminals, 1, e->numAgents * sizeof(uint8_t));
+            memset(e->terminals, 1, numAgents * sizeof(uint8_t));
 
             e->stats[lastAlive].wins = 1.0f;
 
-            for (uint8_t i = 0; i < e->numDrones; i++) {
-                droneEntity *drone = safe_array_get_at(e->drones, i);
+            for (uint8_t i = 0; i < numDrones; i++) {
+                droneEntity *drone = &e->drones[i];
                 e->stats[i].absDistanceTraveled = b2Distance(drone->initalPos, drone->pos.pos);
             }
 
-            logEntry log = {0};
-            log.length = e->episodeLength;
-            memcpy(log.stats, e->stats, sizeof(e->stats));
-            addLogEntry(e->logs, &log);
+            addEpisodeStats(e->logs, e->episodeLength, e->stats);
 
             e->needsReset = true;
             break;
         }
     }
 
-    // Compute observations for the next step
+    if (e->videoRecorder != NULL) {
+        renderEnv(e);
+    }
+    if (e->snapshotBuffer != NULL) {
+        publishEnvSnapshot(e);
+    }
+}
+
+// steps the env without specialized variants, used to compare against them
+void stepEnvGeneric(env *e) {
+    stepEnvKernel(e, e->numDrones, e->numAgents);
+    computeObsGeneric(e);
+}
+
+#ifndef AUTOPXD
+#define DEFINE_STEP_VARIANT(drones, agents, ...)           \
+    void stepEnv##drones##Drones##agents##Agents(env *e) { \
+        stepEnvKernel(e, drones, agents);                  \
+        computeObs(e);                                     \
+    }
+ENV_DRONE_VARIANTS(DEFINE_STEP_VARIANT, )
+#endif
+
+void stepEnv(env *e) {
+#ifndef AUTOPXD
+#define DISPATCH_STEP_VARIANT(drones, agents, ...)          \
+    if (e->numDrones == drones && e->numAgents == agents) { \
+        stepEnv##drones##Drones##agents##Agents(e);         \
+        return;                                             \
+    }
+    ENV_DRONE_VARIANTS(DISPATCH_STEP_VARIANT, )
+#undef DISPATCH_STEP_VARIANT
+#endif
+    stepEnvKernel(e, e->numDrones, e->numAgents);
     computeObs(e);
 }
 
+
 bool envTerminated(env *e) {
     for (uint8_t i = 0; i < e->numDrones; i++) {
-        droneEntity *drone = safe_array_get_at(e->drones, i);
+        droneEntity *drone = &e->drones[i];
         if (drone->dead) {
             return true;
         }
@@ -521,4 +703,216 @@ bool envTerminated(env *e) {
     return false;
 }
 
+// starts recording the env's episodes to a replay file, recording
+// begins with the next episode; returns false if the file couldn't be
+// used or the env's maps can't be replayed
+bool envStartRecording(env *e, const char *path) {
+    // replays only store the index of a predefined map
+    if (e->generateMaps || e->mapLibrary != NULL) {
+        DEBUG_LOG("can't record envs with generated or map file maps");
+        return false;
+    }
+    if (e->recorder != NULL) {
+        destroyReplayRecorder(e->recorder);
+    }
+    e->recorder = createReplayRecorder(path, e->numDrones, e->numAgents);
+    return e->recorder != NULL;
+}
+
+// starts rendering the env offscreen after every step and writing the
+// frames to a video, the env must have a ray client and be stepped on
+// the thread the client was created on; returns false if path couldn't
+// be used
+bool envStartVideoRecording(env *e, const char *path, const enum videoFormat format) {
+    ASSERT(e->client != NULL);
+    envStopVideoRecording(e);
+    e->videoRecorder = createVideoRecorder(path, format, e->client->width, e->client->height);
+    return e->videoRecorder != NULL;
+}
+
+// switches agents to observing PIXEL_OBS_SIZE bytes of pixel obs instead
+// of OBS_SIZE bytes of map cell obs, the obs buffer must be sized for the
+// obs type; takes effect on the next reset
+void envSetPixelObs(env *e, const bool pixelObs) {
+    e->pixelObs = pixelObs;
+    if (pixelObs && e->pixelWalls == NULL) {
+        e->pixelWalls = (uint8_t *)fastCalloc(PIXEL_CHANNEL_SIZE, sizeof(uint8_t));
+        // make sure the static walls are rasterized
+        e->pixelWallsVersion = e->staticWallsVersion - 1;
+    }
+}
+
+// sets how likely each map is to be picked when an episode starts,
+// weights don't need to sum to 1; takes effect on the next reset
+void envSetMapWeights(env *e, const float *weights) {
+    float total = 0.0f;
+    for (uint8_t i = 0; i < NUM_MAPS; i++) {
+        ASSERTF(weights[i] >= 0.0f, "map %d has a negative weight", i);
+        total += weights[i];
+    }
+    ASSERT(total > 0.0f);
+    for (uint8_t i = 0; i < NUM_MAPS; i++) {
+        e->mapWeights[i] = weights[i] / total;
+    }
+}
+
+// generates a new map with params every episode instead of sampling
+// predefined maps, if poolSize isn't 0 only that many different maps are
+// generated; takes effect on the next reset. Returns false if maps
+// generated with params wouldn't fit in the map obs or wouldn't have room
+// to spawn every entity
+bool envSetMapGen(env *e, const mapGenParams *params, const uint32_t poolSize) {
+    if (params->columns == 0 || params->rows == 0 || params->columns > OBS_MAP_COLUMNS || params->rows > OBS_MAP_ROWS) {
+        DEBUG_LOGF("%dx%d generated maps don't fit in the %dx%d map obs", params->columns, params->rows, OBS_MAP_COLUMNS, OBS_MAP_ROWS);
+        return false;
+    }
+    // sudden death walls are only placed correctly on square maps
+    ASSERT(params->columns == params->rows);
+    ASSERT(params->wallDensity >= 0.0f && params->wallDensity < 1.0f);
+    ASSERT(params->standardWallWeight >= 0.0f && params->bouncyWallWeight >= 0.0f && params->deathWallWeight >= 0.0f);
+    ASSERT(params->standardWallWeight + params->bouncyWallWeight + params->deathWallWeight > 0.0f);
+
+    mapGenParams mapGen = *params;
+    mapGen.numDrones = e->numDrones;
+    if (!mapGenParamsFeasible(&mapGen)) {
+        DEBUG_LOGF("%dx%d generated maps have no room to spawn every drone, floating wall and weapon pickup", params->columns, params->rows);
+        return false;
+    }
+
+    e->generateMaps = true;
+    e->mapGen = mapGen;
+    e->mapPoolSize = poolSize;
+    return true;
+}
+
+// samples maps uniformly from a map file instead of sampling predefined
+// maps unless maps are generated, library must outlive the env or be
+// unset with NULL; takes effect on the next reset
+void envSetMapLibrary(env *e, const mapLibrary *library) {
+    e->mapLibrary = library;
+}
+
+// sets the bot that controls a drone that isn't controlled by an agent,
+// takes effect immediately
+void envSetBotType(env *e, const uint8_t droneIdx, const enum botType type) {
+    ASSERTF(droneIdx >= e->numAgents && droneIdx < e->numDrones, "drone %d is not controlled by a bot", droneIdx);
+    ASSERT(type < NUM_BOT_TYPES);
+    // bot types are only recorded when an episode starts, so the rest of
+    // the episode can't be replayed
+    if (e->recorder != NULL && e->botTypes[droneIdx] != type) {
+        recordEpisodeEnd(e->recorder);
+    }
+    e->botTypes[droneIdx] = type;
+}
+
+// computes the actions of the policy bots of every env, observations
+// are batched across envs so the policy is run as few times as possible.
+// Must be called before the envs are stepped
+void policyBotsStep(policyBots *bots, env *envs) {
+    const uint16_t stateSize = policyStateSize(bots->model);
+    uint16_t batchSize = 0;
+    for (uint16_t i = 0; i < bots->numEnvs; i++) {
+        env *e = &envs[i];
+        for (uint8_t j = e->numAgents; j < e->numDrones; j++) {
+            if (e->botTypes[j] != POLICY_BOT) {
+                continue;
+            }
+
+            float *state = bots->states + (((i * _MAX_DRONES) + j) * stateSize);
+            // the round is over, the next step will start a new episode
+            if (e->needsReset) {
+                memset(state, 0x0, stateSize * sizeof(float));
+            }
+            computeDroneObs(e, j, bots->obs + (batchSize * OBS_SIZE));
+            bots->batchStates[batchSize] = state;
+            bots->batchActions[batchSize] = e->botActions + (j * 4);
+
+            batchSize++;
+            if (batchSize == POLICY_MAX_BATCH) {
+                policyBotsForward(bots, batchSize);
+                batchSize = 0;
+            }
+        }
+    }
+    policyBotsForward(bots, batchSize);
+}
+
+void envStopRecording(env *e) {
+    if (e->recorder == NULL) {
+        return;
+    }
+    destroyReplayRecorder(e->recorder);
+    e->recorder = NULL;
+}
+
+// re-simulates the next recorded step, resetting the env to the recorded
+// initial state first if a new episode starts; the env must have been
+// created with the numbers of drones and agents in the replay's header.
+// Returns false when the replay has ended
+bool replayStep(replayReader *reader, env *e) {
+    uint8_t type;
+    if (fread(&type, sizeof(uint8_t), 1, reader->file) != 1) {
+        return false;
+    }
+
+    if (type == REPLAY_EPISODE_RECORD) {
+        uint64_t seed;
+        uint8_t mapIdx;
+        uint8_t botTypes[_MAX_DRONES];
+        if (fread(&seed, sizeof(uint64_t), 1, reader->file) != 1 || fread(&mapIdx, sizeof(uint8_t), 1, reader->file) != 1 || fread(botTypes, sizeof(uint8_t), e->numDrones, reader->file) != e->numDrones) {
+            return false;
+        }
+        if (mapIdx >= NUM_MAPS) {
+            DEBUG_LOGF("replay has an unknown, generated or map file map %d", mapIdx);
+            return false;
+        }
+        for (uint8_t i = 0; i < e->numDrones; i++) {
+            if (botTypes[i] >= NUM_BOT_TYPES) {
+                DEBUG_LOGF("replay has an unknown bot type %d", botTypes[i]);
+                return false;
+            }
+        }
+        for (uint8_t i = 0; i < e->numDrones; i++) {
+            e->botTypes[i] = botTypes[i];
+        }
+        // only allow the recorded map to be picked, the map is still
+        // sampled so the RNG is used the same way it was when recording
+        float mapWeights[_NUM_MAPS] = {0};
+        mapWeights[mapIdx] = 1.0f;
+        envSetMapWeights(e, mapWeights);
+
+        e->randState = seed;
+        resetEnv(e);
+        e->needsReset = false;
+        ASSERTF(e->mapIdx == mapIdx, "replayed map %d, recorded map %d", e->mapIdx, mapIdx);
+
+        if (fread(&type, sizeof(uint8_t), 1, reader->file) != 1) {
+            return false;
+        }
+    }
+    if (type != REPLAY_STEP_RECORD) {
+        DEBUG_LOGF("invalid replay record type %d", type);
+        return false;
+    }
+
+    for (uint8_t i = 0; i < e->numDrones; i++) {
+        int *actions;
+        if (i < e->numAgents) {
+            actions = e->actions + (i * 4);
+        } else if (e->botTypes[i] == POLICY_BOT) {
+            actions = e->botActions + (i * 4);
+        } else {
+            continue;
+        }
+        uint16_t packed;
+        if (fread(&packed, sizeof(uint16_t), 1, reader->file) != 1) {
+            return false;
+        }
+        unpackAction(packed, actions);
+    }
+    stepEnv(e);
+
+    return true;
+}
+
 #endif
@@ -0,0 +1,182 @@
+#ifndef IMPULSE_WARS_GAE_H
+#define IMPULSE_WARS_GAE_H
+
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "helpers.h"
+
+// Computes generalized advantage estimates of rollout buffers for the
+// trainer. Buffers are env major: each row holds the steps of one env in
+// order, and advantages are never carried across rows. Following the
+// trainer, the reward and done of step t + 1 are the outcome of the
+// action taken at step t, so the last step of each row has no advantage.
+//
+// Each step depends on the next one so rows can't be vectorized, instead
+// rows are split between threads. The sums needed to normalize the
+// advantages are accumulated while they are computed, normalizing is a
+// separate pass over the buffer that is vectorized.
+
+#define GAE_MAX_THREADS 64
+#define GAE_NORM_EPSILON 1e-8f
+
+typedef struct gaeWorker {
+    const float *rewards;
+    const float *dones;
+    const float *values;
+    float *advantages;
+    float *returns;
+    const int64_t *rowOffsets;
+    uint32_t firstRow;
+    uint32_t lastRow;
+    float gamma;
+    float gaeLambda;
+
+    // set after advantages are computed
+    double sum;
+    double sumSquares;
+    // set before advantages are normalized
+    float mean;
+    float invStd;
+} gaeWorker;
+
+void *gaeWorkerThread(void *arg) {
+    gaeWorker *worker = (gaeWorker *)arg;
+    const float *rewards = worker->rewards;
+    const float *dones = worker->dones;
+    const float *values = worker->values;
+    float *advantages = worker->advantages;
+    float *returns = worker->returns;
+
+    double sum = 0.0;
+    double sumSquares = 0.0;
+    for (uint32_t row = worker->firstRow; row < worker->lastRow; row++) {
+        const int64_t start = worker->rowOffsets[row];
+        const int64_t end = worker->rowOffsets[row + 1];
+        if (start == end) {
+            continue;
+        }
+
+        float lastAdvantage = 0.0f;
+        advantages[end - 1] = 0.0f;
+        returns[end - 1] = values[end - 1];
+        for (int64_t t = end - 2; t >= start; t--) {
+            const float nextNonTerminal = 1.0f - dones[t + 1];
+            const float delta = rewards[t + 1] + (worker->gamma * values[t + 1] * nextNonTerminal) - values[t];
+            lastAdvantage = delta + (worker->gamma * worker->gaeLambda * nextNonTerminal * lastAdvantage);
+            advantages[t] = lastAdvantage;
+            returns[t] = lastAdvantage + values[t];
+            sum += lastAdvantage;
+            sumSquares += (double)lastAdvantage * lastAdvantage;
+        }
+    }
+    worker->sum = sum;
+    worker->sumSquares = sumSquares;
+
+    return NULL;
+}
+
+void *gaeNormalizeThread(void *arg) {
+    gaeWorker *worker = (gaeWorker *)arg;
+    const int64_t start = worker->rowOffsets[worker->firstRow];
+    const int64_t end = worker->rowOffsets[worker->lastRow];
+    float *advantages = worker->advantages;
+    const float mean = worker->mean;
+    const float invStd = worker->invStd;
+    for (int64_t i = start; i < end; i++) {
+        advantages[i] = (advantages[i] - mean) * invStd;
+    }
+
+    return NULL;
+}
+
+// runs fn on every worker, the first worker is run on the calling thread
+void runGAEWorkers(gaeWorker *workers, const uint8_t numWorkers, void *(*fn)(void *)) {
+    pthread_t threads[GAE_MAX_THREADS];
+    for (uint8_t i = 1; i < numWorkers; i++) {
+        if (pthread_create(&threads[i], NULL, fn, &workers[i]) != 0) {
+            ERROR("failed to start GAE thread");
+        }
+    }
+    fn(&workers[0]);
+    for (uint8_t i = 1; i < numWorkers; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+// writes the advantages and returns of numRows rows of steps, row i spans
+// [rowOffsets[i], rowOffsets[i + 1]). Returns are computed from the
+// advantages before they are normalized to a mean of 0 and a standard
+// deviation of 1 if normalize is set
+void computeGAE(const float *rewards, const float *dones, const float *values, float *advantages, float *returns, const int64_t *rowOffsets, const uint32_t numRows, const float gamma, const float gaeLambda, const bool normalize, uint8_t numThreads) {
+    if (numRows == 0) {
+        return;
+    }
+    if (numThreads == 0) {
+        numThreads = 1;
+    }
+    if (numThreads > GAE_MAX_THREADS) {
+        numThreads = GAE_MAX_THREADS;
+    }
+    if (numThreads > numRows) {
+        numThreads = numRows;
+    }
+
+    // rows are split so each thread has about the same number of steps
+    gaeWorker workers[GAE_MAX_THREADS];
+    const int64_t numSteps = rowOffsets[numRows] - rowOffsets[0];
+    uint32_t row = 0;
+    for (uint8_t i = 0; i < numThreads; i++) {
+        const int64_t target = rowOffsets[0] + ((numSteps * (i + 1)) / numThreads);
+        uint32_t lastRow = row;
+        while (lastRow < numRows && (rowOffsets[lastRow + 1] <= target || lastRow == row)) {
+            lastRow++;
+        }
+        if (i == numThreads - 1) {
+            lastRow = numRows;
+        }
+        workers[i] = (gaeWorker){
+            .rewards = rewards,
+            .dones = dones,
+            .values = values,
+            .advantages = advantages,
+            .returns = returns,
+            .rowOffsets = rowOffsets,
+            .firstRow = row,
+            .lastRow = lastRow,
+            .gamma = gamma,
+            .gaeLambda = gaeLambda,
+        };
+        row = lastRow;
+        // ran out of rows before threads
+        if (row == numRows) {
+            numThreads = i + 1;
+            break;
+        }
+    }
+
+    runGAEWorkers(workers, numThreads, gaeWorkerThread);
+    if (!normalize || numSteps < 2) {
+        return;
+    }
+
+    // the last step of every row has an advantage of 0 too
+    double sum = 0.0;
+    double sumSquares = 0.0;
+    for (uint8_t i = 0; i < numThreads; i++) {
+        sum += workers[i].sum;
+        sumSquares += workers[i].sumSquares;
+    }
+    const double mean = sum / numSteps;
+    // unbiased like torch.std
+    const double variance = fmax((sumSquares - (sum * mean)) / (numSteps - 1), 0.0);
+    for (uint8_t i = 0; i < numThreads; i++) {
+        workers[i].mean = (float)mean;
+        workers[i].invStd = 1.0f / ((float)sqrt(variance) + GAE_NORM_EPSILON);
+    }
+    runGAEWorkers(workers, numThreads, gaeNormalizeThread);
+}
+
+#endif
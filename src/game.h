@@ -1,6 +1,8 @@
 #ifndef IMPULSE_WARS_GAME_H
 #define IMPULSE_WARS_GAME_H
 
+#include "arena.h"
+#include "entities.h"
 #include "env.h"
 #include "helpers.h"
 #include "settings.h"
@@ -10,6 +12,18 @@ static inline bool entityTypeIsWall(const enum entityType type) {
     return type == STANDARD_WALL_ENTITY || type == BOUNCY_WALL_ENTITY || type == DEATH_WALL_ENTITY;
 }
 
+static inline bool cellIsWall(const env *e, const uint16_t cellIdx) {
+    return e->cells.wallTypes[cellIdx] != 0;
+}
+
+// returns the index of the map obs cell of a map cell, maps are centered
+// in the map obs
+static inline uint16_t cellObsIdx(const env *e, const uint16_t cellIdx) {
+    const uint16_t row = cellIdx / e->columns;
+    const uint16_t col = cellIdx - (row * e->columns);
+    return e->obsCellOffset + col + (row * OBS_MAP_COLUMNS);
+}
+
 static inline b2Vec2 getCachedPos(const b2BodyId bodyID, cachedPos *pos) {
     if (pos->valid) {
         return pos->pos;
@@ -27,7 +41,7 @@ static inline int16_t entityPosToCellIdx(const env *e, const b2Vec2 pos) {
     const uint16_t cell = cellCol + (cellRow * e->columns);
     // set the cell to -1 if it's out of bounds
     // TODO: this is a box2d issue, investigate more
-    if (cell >= cc_array_size(e->cells)) {
+    if (cell >= e->cells.count) {
         DEBUG_LOGF("invalid cell index: %d from position: (%f, %f)", cell, pos.x, pos.y);
         return -1;
     }
@@ -63,7 +77,7 @@ bool isOverlapping(env *e, const b2Vec2 pos, const float distance, const enum sh
 // that is an appropriate distance away from other entities if one exists
 bool findOpenPos(env *e, const enum shapeCategory type, b2Vec2 *emptyPos) {
     uint8_t checkedCells[BITNSLOTS(MAX_CELLS)] = {0};
-    const size_t nCells = cc_array_size(e->cells);
+    const uint16_t nCells = e->cells.count;
     uint16_t attempts = 0;
 
     while (true) {
@@ -77,29 +91,31 @@ bool findOpenPos(env *e, const enum shapeCategory type, b2Vec2 *emptyPos) {
         bitSet(checkedCells, cellIdx);
         attempts++;
 
-        const mapCell *cell = safe_array_get_at(e->cells, cellIdx);
-        if (cell->ent != NULL) {
+        if (e->cells.entities[cellIdx] != NULL_ENTITY_HANDLE) {
             continue;
         }
+        const b2Vec2 cellPos = e->cells.positions[cellIdx];
 
-        // ensure drones don't spawn too close to walls or other drones
+        // ensure drones don't spawn too close to walls or other drones,
+        // drones only spawn when the map's static walls are all there are
+        // so which cells are too close to walls is known ahead of time
         if (type == DRONE_SHAPE) {
-            if (isOverlapping(e, cell->pos, DRONE_WALL_SPAWN_DISTANCE, DRONE_SHAPE, WALL_SHAPE | DRONE_SHAPE)) {
+            if (e->cells.droneSpawnBlocked[cellIdx]) {
                 continue;
             }
-            if (isOverlapping(e, cell->pos, DRONE_DRONE_SPAWN_DISTANCE, DRONE_SHAPE, DRONE_SHAPE)) {
+            if (isOverlapping(e, cellPos, DRONE_DRONE_SPAWN_DISTANCE, DRONE_SHAPE, DRONE_SHAPE)) {
                 continue;
             }
         }
 
-        if (!isOverlapping(e, cell->pos, MIN_SPAWN_DISTANCE, type, FLOATING_WALL_SHAPE | WEAPON_PICKUP_SHAPE | DRONE_SHAPE)) {
-            *emptyPos = cell->pos;
+        if (!isOverlapping(e, cellPos, MIN_SPAWN_DISTANCE, type, FLOATING_WALL_SHAPE | WEAPON_PICKUP_SHAPE | DRONE_SHAPE)) {
+            *emptyPos = cellPos;
             return true;
         }
     }
 }
 
-entity *createWall(env *e, const float posX, const float posY, const float width, const float height, const enum entityType type, bool floating) {
+entityHandle createWall(env *e, const float posX, const float posY, const float width, const float height, const enum entityType type, bool floating) {
     ASSERT(entityTypeIsWall(type));
 
     const b2Vec2 pos = (b2Vec2){.x = posX, .y = posY};
@@ -132,18 +148,15 @@ entity *createWall(env *e, const float posX, const float posY, const float width
         wallShapeDef.enableContactEvents = true;
     }
 
-    wallEntity *wall = (wallEntity *)fastMalloc(sizeof(wallEntity));
+    wallEntity *wall = (wallEntity *)arenaAlloc(&e->arena, sizeof(wallEntity));
     wall->bodyID = wallBodyID;
     wall->pos = (cachedPos){.pos = pos, .valid = true};
     wall->extent = extent;
     wall->isFloating = floating;
     wall->type = type;
 
-    entity *ent = (entity *)fastMalloc(sizeof(entity));
-    ent->type = type;
-    ent->entity = wall;
-
-    wallShapeDef.userData = ent;
+    const entityHandle handle = createEntity(&e->entities, type, wall);
+    wallShapeDef.userData = entityHandleToUserData(handle);
     const b2Polygon wallPolygon = b2MakeBox(extent.x, extent.y);
     wall->shapeID = b2CreatePolygonShape(wallBodyID, &wallShapeDef, &wallPolygon);
 
@@ -153,15 +166,14 @@ entity *createWall(env *e, const float posX, const float posY, const float width
         cc_array_add(e->walls, wall);
     }
 
-    return ent;
+    return handle;
 }
 
-void destroyWall(wallEntity *wall) {
-    entity *ent = (entity *)b2Shape_GetUserData(wall->shapeID);
-    fastFree(ent);
+void destroyWall(env *e, wallEntity *wall) {
+    destroyEntity(&e->entities, shapeEntityHandle(wall->shapeID));
 
     b2DestroyBody(wall->bodyID);
-    fastFree(wall);
+    arenaFree(&e->arena, wall, sizeof(wallEntity));
 }
 
 void createSuddenDeathWalls(env *e, const b2Vec2 startPos, const b2Vec2 size) {
@@ -184,13 +196,16 @@ void createSuddenDeathWalls(env *e, const b2Vec2 startPos, const b2Vec2 size) {
     }
     const uint16_t startIdx = entityPosToCellIdx(e, startPos);
     for (uint16_t i = startIdx; i <= endIdx; i += indexIncrement) {
-        mapCell *cell = safe_array_get_at(e->cells, i);
-        if (cell->ent != NULL && cell->ent->type == WEAPON_PICKUP_ENTITY) {
-            weaponPickupEntity *pickup = (weaponPickupEntity *)cell->ent->entity;
+        if (e->cells.pickupWeapons[i] != 0) {
+            const entity *ent = getEntity(&e->entities, e->cells.entities[i]);
+            ASSERT(ent != NULL && ent->type == WEAPON_PICKUP_ENTITY);
+            weaponPickupEntity *pickup = (weaponPickupEntity *)ent->entity;
             pickup->respawnWait = PICKUP_RESPAWN_WAIT;
         }
-        entity *ent = createWall(e, cell->pos.x, cell->pos.y, WALL_THICKNESS, WALL_THICKNESS, DEATH_WALL_ENTITY, false);
-        cell->ent = ent;
+        const b2Vec2 cellPos = e->cells.positions[i];
+        e->cells.entities[i] = createWall(e, cellPos.x, cellPos.y, WALL_THICKNESS, WALL_THICKNESS, DEATH_WALL_ENTITY, false);
+        e->cells.wallTypes[i] = DEATH_WALL_ENTITY + 1;
+        e->cells.pickupWeapons[i] = 0;
     }
 }
 
@@ -244,37 +259,34 @@ void createWeaponPickup(env *e) {
     pickupShapeDef.filter.maskBits = WALL_SHAPE | FLOATING_WALL_SHAPE | WEAPON_PICKUP_SHAPE | DRONE_SHAPE;
     pickupShapeDef.isSensor = true;
 
-    weaponPickupEntity *pickup = (weaponPickupEntity *)fastMalloc(sizeof(weaponPickupEntity));
+    weaponPickupEntity *pickup = (weaponPickupEntity *)arenaAlloc(&e->arena, sizeof(weaponPickupEntity));
     pickup->bodyID = pickupBodyID;
     pickup->weapon = randWeaponPickupType(e);
     pickup->respawnWait = 0.0f;
     pickup->floatingWallsTouching = 0;
 
-    entity *ent = (entity *)fastMalloc(sizeof(entity));
-    ent->type = WEAPON_PICKUP_ENTITY;
-    ent->entity = pickup;
+    const entityHandle handle = createEntity(&e->entities, WEAPON_PICKUP_ENTITY, pickup);
 
     const int16_t cellIdx = entityPosToCellIdx(e, pickupBodyDef.position);
     if (cellIdx == -1) {
         ERRORF("invalid position for weapon pickup spawn: (%f, %f)", pickupBodyDef.position.x, pickupBodyDef.position.y);
     }
     pickup->mapCellIdx = cellIdx;
-    mapCell *cell = safe_array_get_at(e->cells, cellIdx);
-    cell->ent = ent;
+    e->cells.entities[cellIdx] = handle;
+    e->cells.pickupWeapons[cellIdx] = pickup->weapon + 1;
 
-    pickupShapeDef.userData = ent;
+    pickupShapeDef.userData = entityHandleToUserData(handle);
     const b2Polygon pickupPolygon = b2MakeBox(PICKUP_THICKNESS / 2.0f, PICKUP_THICKNESS / 2.0f);
     pickup->shapeID = b2CreatePolygonShape(pickupBodyID, &pickupShapeDef, &pickupPolygon);
 
     cc_array_add(e->pickups, pickup);
 }
 
-void destroyWeaponPickup(weaponPickupEntity *pickup) {
-    entity *ent = (entity *)b2Shape_GetUserData(pickup->shapeID);
-    fastFree(ent);
+void destroyWeaponPickup(env *e, weaponPickupEntity *pickup) {
+    destroyEntity(&e->entities, shapeEntityHandle(pickup->shapeID));
 
     b2DestroyBody(pickup->bodyID);
-    fastFree(pickup);
+    arenaFree(&e->arena, pickup, sizeof(weaponPickupEntity));
 }
 
 void createDrone(env *e, const uint8_t idx) {
@@ -296,7 +308,7 @@ void createDrone(env *e, const uint8_t idx) {
     droneShapeDef.enableSensorEvents = true;
     const b2Circle droneCircle = {.center = b2Vec2_zero, .radius = DRONE_RADIUS};
 
-    droneEntity *drone = (droneEntity *)fastMalloc(sizeof(droneEntity));
+    droneEntity *drone = &e->drones[idx];
     drone->bodyID = droneBodyID;
     drone->weaponInfo = e->defaultWeapon;
     drone->ammo = weaponAmmo(e->defaultWeapon->type, drone->weaponInfo->type);
@@ -316,22 +328,8 @@ void createDrone(env *e, const uint8_t idx) {
     drone->lives = DEFAULT_LIVES;
     memset(&drone->hitInfo, 0x0, sizeof(stepHitInfo));
 
-    entity *ent = (entity *)fastMalloc(sizeof(entity));
-    ent->type = DRONE_ENTITY;
-    ent->entity = drone;
-
-    droneShapeDef.userData = ent;
+    droneShapeDef.userData = entityHandleToUserData(createEntity(&e->entities, DRONE_ENTITY, drone));
     drone->shapeID = b2CreateCircleShape(droneBodyID, &droneShapeDef, &droneCircle);
-
-    cc_array_add(e->drones, drone);
-}
-
-void destroyDrone(droneEntity *drone) {
-    entity *ent = (entity *)b2Shape_GetUserData(drone->shapeID);
-    fastFree(ent);
-
-    b2DestroyBody(drone->bodyID);
-    fastFree(drone);
 }
 
 void droneMove(const droneEntity *drone, const b2Vec2 direction) {
@@ -373,7 +371,7 @@ void createProjectile(env *e, droneEntity *drone, const b2Vec2 normAim) {
     b2Vec2 fire = b2MulAdd(lateralVel, weaponFire(&e->randState, drone->weaponInfo->type), aim);
     b2Body_ApplyLinearImpulseToCenter(projectileBodyID, fire, true);
 
-    projectileEntity *projectile = (projectileEntity *)fastMalloc(sizeof(projectileEntity));
+    projectileEntity *projectile = (projectileEntity *)arenaAlloc(&e->arena, sizeof(projectileEntity));
     projectile->droneIdx = drone->idx;
     projectile->bodyID = projectileBodyID;
     projectile->shapeID = projectileShapeID;
@@ -383,11 +381,8 @@ void createProjectile(env *e, droneEntity *drone, const b2Vec2 normAim) {
     projectile->bounces = 0;
     cc_slist_add(e->projectiles, projectile);
 
-    entity *ent = (entity *)fastMalloc(sizeof(entity));
-    ent->type = PROJECTILE_ENTITY;
-    ent->entity = projectile;
-
-    b2Shape_SetUserData(projectile->shapeID, ent);
+    const entityHandle handle = createEntity(&e->entities, PROJECTILE_ENTITY, projectile);
+    b2Shape_SetUserData(projectile->shapeID, entityHandleToUserData(handle));
 }
 
 typedef struct explosionCallbackContext {
@@ -398,7 +393,8 @@ typedef struct explosionCallbackContext {
 
 bool explosionOverlapCallback(b2ShapeId shapeId, void *context) {
     explosionCallbackContext *ctx = (explosionCallbackContext *)context;
-    entity *ent = (entity *)b2Shape_GetUserData(shapeId);
+    const entity *ent = shapeEntity(ctx->e, shapeId);
+    ASSERT(ent != NULL);
     droneEntity *hitDrone = (droneEntity *)ent->entity;
     if (hitDrone->idx == ctx->drone->idx) {
         ctx->e->stats[hitDrone->idx].ownShotsTaken[ctx->weaponType]++;
@@ -434,7 +430,7 @@ void destroyProjectile(env *e, projectileEntity *projectile, const bool full) {
             .categoryBits = PROJECTILE_SHAPE,
             .maskBits = DRONE_SHAPE,
         };
-        droneEntity *drone = safe_array_get_at(e->drones, projectile->droneIdx);
+        droneEntity *drone = &e->drones[projectile->droneIdx];
         explosionCallbackContext ctx = {
             .drone = drone,
             .e = e,
@@ -443,8 +439,7 @@ void destroyProjectile(env *e, projectileEntity *projectile, const bool full) {
         b2World_OverlapCircle(e->worldID, &cir, transform, filter, explosionOverlapCallback, &ctx);
     }
 
-    entity *ent = (entity *)b2Shape_GetUserData(projectile->shapeID);
-    fastFree(ent);
+    destroyEntity(&e->entities, shapeEntityHandle(projectile->shapeID));
 
     if (full) {
         const enum cc_stat res = cc_slist_remove(e->projectiles, projectile, NULL);
@@ -457,7 +452,7 @@ void destroyProjectile(env *e, projectileEntity *projectile, const bool full) {
         e->stats[projectile->droneIdx].shotDistances[projectile->droneIdx] += projectile->distance;
     }
 
-    fastFree(projectile);
+    arenaFree(&e->arena, projectile, sizeof(projectileEntity));
 }
 
 void destroyAllProjectiles(env *e) {
@@ -472,6 +467,7 @@ void handleSuddenDeath(env *e) {
 
     // create new walls that will close in on the arena
     e->suddenDeathWallCounter++;
+    e->staticWallsVersion++;
 
     createSuddenDeathWalls(
         e,
@@ -517,7 +513,7 @@ void handleSuddenDeath(env *e) {
     // mark drones as dead if they touch a newly placed wall
     bool droneDead = false;
     for (uint8_t i = 0; i < e->numDrones; i++) {
-        droneEntity *drone = safe_array_get_at(e->drones, i);
+        droneEntity *drone = &e->drones[i];
         const b2Vec2 pos = getCachedPos(drone->bodyID, &drone->pos);
         if (isOverlapping(e, pos, DRONE_RADIUS, DRONE_SHAPE, WALL_SHAPE)) {
             drone->dead = true;
@@ -543,7 +539,7 @@ void handleSuddenDeath(env *e) {
             const enum cc_stat res = cc_array_iter_remove(&iter, NULL);
             MAYBE_UNUSED(res);
             ASSERT(res == CC_OK);
-            destroyWall(wall);
+            destroyWall(e, wall);
 
             DEBUG_LOGF("destroyed floating wall at %f, %f", pos.x, pos.y);
             continue;
@@ -673,7 +669,7 @@ void weaponPickupsStep(env *e, const float frameTime) {
                     MAYBE_UNUSED(res);
                     ASSERT(res == CC_OK);
                     DEBUG_LOG("destroying weapon pickup");
-                    destroyWeaponPickup(pickup);
+                    destroyWeaponPickup(e, pickup);
                     continue;
                 }
                 b2Body_SetTransform(pickup->bodyID, pos, b2Rot_identity);
@@ -685,9 +681,8 @@ void weaponPickupsStep(env *e, const float frameTime) {
                     ERRORF("invalid position for weapon pickup spawn: (%f, %f)", pos.x, pos.y);
                 }
                 pickup->mapCellIdx = cellIdx;
-                mapCell *cell = safe_array_get_at(e->cells, cellIdx);
-                entity *ent = (entity *)b2Shape_GetUserData(pickup->shapeID);
-                cell->ent = ent;
+                e->cells.entities[cellIdx] = shapeEntityHandle(pickup->shapeID);
+                e->cells.pickupWeapons[cellIdx] = pickup->weapon + 1;
             }
         }
     }
@@ -697,7 +692,7 @@ void weaponPickupsStep(env *e, const float frameTime) {
 // times, and update drone stats if a drone was hit
 bool handleProjectileBeginContact(env *e, const entity *proj, const entity *ent) {
     projectileEntity *projectile = (projectileEntity *)proj->entity;
-    // e (shape B in the collision) will be NULL if it's another
+    // ent (shape B in the collision) will be NULL if it's another
     // projectile that was just destroyed
     if (ent == NULL || (ent != NULL && ent->type == PROJECTILE_ENTITY)) {
         // always allow projectiles to bounce off each other
@@ -710,7 +705,7 @@ bool handleProjectileBeginContact(env *e, const entity *proj, const entity *ent)
         if (ent->type == DRONE_ENTITY) {
             const droneEntity *hitDrone = (droneEntity *)ent->entity;
             if (projectile->droneIdx != hitDrone->idx) {
-                droneEntity *shooterDrone = safe_array_get_at(e->drones, projectile->droneIdx);
+                droneEntity *shooterDrone = &e->drones[projectile->droneIdx];
                 shooterDrone->hitInfo.shotHit[hitDrone->idx] = true;
 
                 e->stats[shooterDrone->idx].shotsHit[projectile->weaponInfo->type]++;
@@ -744,28 +739,33 @@ void handleContactEvents(env *e) {
     b2ContactEvents events = b2World_GetContactEvents(e->worldID);
     for (int i = 0; i < events.beginCount; ++i) {
         const b2ContactBeginTouchEvent *event = events.beginEvents + i;
-        entity *e1 = NULL;
-        entity *e2 = NULL;
+        entityHandle h1 = NULL_ENTITY_HANDLE;
+        entityHandle h2 = NULL_ENTITY_HANDLE;
 
         if (b2Shape_IsValid(event->shapeIdA)) {
-            e1 = (entity *)b2Shape_GetUserData(event->shapeIdA);
-            ASSERT(e1 != NULL);
+            h1 = shapeEntityHandle(event->shapeIdA);
+            ASSERT(h1 != NULL_ENTITY_HANDLE);
         }
         if (b2Shape_IsValid(event->shapeIdB)) {
-            e2 = (entity *)b2Shape_GetUserData(event->shapeIdB);
-            ASSERT(e2 != NULL);
+            h2 = shapeEntityHandle(event->shapeIdB);
+            ASSERT(h2 != NULL_ENTITY_HANDLE);
         }
 
+        const entity *e1 = getEntity(&e->entities, h1);
+        const entity *e2 = getEntity(&e->entities, h2);
         if (e1 != NULL) {
             if (e1->type == PROJECTILE_ENTITY) {
-                if (handleProjectileBeginContact(e, e1, e2)) {
-                    e1 = NULL;
-                }
+                handleProjectileBeginContact(e, e1, e2);
             } else if (e1->type == DEATH_WALL_ENTITY && e2 != NULL && e2->type == DRONE_ENTITY) {
                 droneEntity *drone = (droneEntity *)e2->entity;
                 drone->dead = true;
             }
         }
+
+        // the projectile may have been destroyed, look the entities up
+        // again so it isn't used
+        e1 = getEntity(&e->entities, h1);
+        e2 = getEntity(&e->entities, h2);
         if (e2 != NULL) {
             if (e2->type == PROJECTILE_ENTITY) {
                 handleProjectileBeginContact(e, e2, e1);
@@ -778,15 +778,15 @@ void handleContactEvents(env *e) {
 
     for (int i = 0; i < events.endCount; ++i) {
         const b2ContactEndTouchEvent *event = events.endEvents + i;
-        entity *e1 = NULL;
-        entity *e2 = NULL;
+        const entity *e1 = NULL;
+        const entity *e2 = NULL;
 
         if (b2Shape_IsValid(event->shapeIdA)) {
-            e1 = (entity *)b2Shape_GetUserData(event->shapeIdA);
+            e1 = shapeEntity(e, event->shapeIdA);
             ASSERT(e1 != NULL);
         }
         if (b2Shape_IsValid(event->shapeIdB)) {
-            e2 = (entity *)b2Shape_GetUserData(event->shapeIdB);
+            e2 = shapeEntity(e, event->shapeIdB);
             ASSERT(e2 != NULL);
         }
 
@@ -801,7 +801,7 @@ void handleContactEvents(env *e) {
 
 // set pickup to respawn somewhere else randomly if a drone touched it,
 // mark the pickup as disabled if a floating wall is touching it
-void handleWeaponPickupBeginTouch(env *e, const entity *sensor, entity *visitor) {
+void handleWeaponPickupBeginTouch(env *e, const entity *sensor, const entity *visitor) {
     weaponPickupEntity *pickup = (weaponPickupEntity *)sensor->entity;
     if (pickup->respawnWait != 0.0f || pickup->floatingWallsTouching != 0) {
         return;
@@ -810,9 +810,9 @@ void handleWeaponPickupBeginTouch(env *e, const entity *sensor, entity *visitor)
     switch (visitor->type) {
     case DRONE_ENTITY:
         pickup->respawnWait = PICKUP_RESPAWN_WAIT;
-        mapCell *cell = safe_array_get_at(e->cells, pickup->mapCellIdx);
-        ASSERT(cell->ent != NULL);
-        cell->ent = NULL;
+        ASSERT(e->cells.entities[pickup->mapCellIdx] != NULL_ENTITY_HANDLE);
+        e->cells.entities[pickup->mapCellIdx] = NULL_ENTITY_HANDLE;
+        e->cells.pickupWeapons[pickup->mapCellIdx] = 0;
 
         droneEntity *drone = (droneEntity *)visitor->entity;
         droneChangeWeapon(e, drone, pickup->weapon);
@@ -839,7 +839,7 @@ void handleWeaponPickupBeginTouch(env *e, const entity *sensor, entity *visitor)
 }
 
 // mark the pickup as enabled if no floating walls are touching it
-void handleWeaponPickupEndTouch(const entity *sensor, entity *visitor) {
+void handleWeaponPickupEndTouch(const entity *sensor, const entity *visitor) {
     weaponPickupEntity *pickup = (weaponPickupEntity *)sensor->entity;
     if (pickup->respawnWait != 0.0f) {
         return;
@@ -866,7 +866,7 @@ void handleSensorEvents(env *e) {
             DEBUG_LOG("could not find sensor shape for begin touch event");
             continue;
         }
-        entity *s = (entity *)b2Shape_GetUserData(event->sensorShapeId);
+        const entity *s = shapeEntity(e, event->sensorShapeId);
         ASSERT(s != NULL);
         ASSERT(s->type == WEAPON_PICKUP_ENTITY);
 
@@ -874,7 +874,7 @@ void handleSensorEvents(env *e) {
             DEBUG_LOG("could not find visitor shape for begin touch event");
             continue;
         }
-        entity *v = (entity *)b2Shape_GetUserData(event->visitorShapeId);
+        const entity *v = shapeEntity(e, event->visitorShapeId);
         ASSERT(v != NULL);
 
         handleWeaponPickupBeginTouch(e, s, v);
@@ -886,7 +886,7 @@ void handleSensorEvents(env *e) {
             DEBUG_LOG("could not find sensor shape for end touch event");
             continue;
         }
-        entity *s = (entity *)b2Shape_GetUserData(event->sensorShapeId);
+        const entity *s = shapeEntity(e, event->sensorShapeId);
         ASSERT(s != NULL);
         ASSERT(s->type == WEAPON_PICKUP_ENTITY);
 
@@ -894,7 +894,7 @@ void handleSensorEvents(env *e) {
             DEBUG_LOG("could not find visitor shape for end touch event");
             continue;
         }
-        entity *v = (entity *)b2Shape_GetUserData(event->visitorShapeId);
+        const entity *v = shapeEntity(e, event->visitorShapeId);
         ASSERT(v != NULL);
 
         handleWeaponPickupEndTouch(s, v);
@@ -66,6 +66,14 @@
 // only used in debug builds
 #define MAYBE_UNUSED(x) (void)x
 
+// for kernels that need to be inlined so constant arguments can be
+// propagated into them
+#ifndef AUTOPXD
+#define FORCE_INLINE inline __attribute__((always_inline))
+#else
+#define FORCE_INLINE inline
+#endif
+
 #ifndef PI
 #define PI 3.14159265358979323846
 #endif
@@ -96,11 +104,13 @@
 #ifndef NDEBUG
 #define fastMalloc(size) malloc(size)
 #define fastCalloc(nmemb, size) calloc(nmemb, size)
+#define fastRealloc(ptr, size) realloc(ptr, size)
 #define fastFree(ptr) free(ptr)
 #else
 #include "include/dlmalloc.h"
 #define fastMalloc(size) dlmalloc(size)
 #define fastCalloc(nmemb, size) dlcalloc(nmemb, size)
+#define fastRealloc(ptr, size) dlrealloc(ptr, size)
 #define fastFree(ptr) dlfree(ptr)
 #endif
 
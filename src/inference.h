@@ -0,0 +1,606 @@
+#ifndef IMPULSE_WARS_INFERENCE_H
+#define IMPULSE_WARS_INFERENCE_H
+
+#include <stdio.h>
+
+#include "helpers.h"
+#include "settings.h"
+#include "types.h"
+
+// A small CPU inference engine for the recurrent policy in policy.py, it
+// lets frozen checkpoints control opponent drones inside the env process.
+// Weights are exported with exportInferenceWeights in policy.py.
+//
+// Format, all values little endian:
+//   header: "IWPM", version (u32), then u32 dims: map columns, map rows,
+//           cnn channels, scalar obs size, drone encoder size, encoder
+//           size, LSTM size, number of actions, followed by the number
+//           of multihot channels of each map cell feature
+//   float32 tensors in PyTorch layout: conv 1 weight and bias, conv 2
+//   weight and bias, drone encoder weight and bias, encoder weight and
+//   bias, LSTM input weight, hidden weight, input bias and hidden bias,
+//   actor mean weight and bias
+//
+// Every layer but the first conv layer is a GEMM over the whole batch.
+// The first conv layer's input is multihot with exactly one channel set
+// per cell feature, so it's computed by summing the weights of the set
+// channels instead of multiplying mostly zeros.
+
+#define POLICY_MODEL_VERSION 1
+
+const char POLICY_MODEL_MAGIC[4] = {'I', 'W', 'P', 'M'};
+
+#define CONV1_KERNEL 5
+#define CONV1_STRIDE 2
+#define CONV2_KERNEL 3
+#define CONV2_STRIDE 2
+#define LEAKY_RELU_SLOPE 0.01f
+// number of features of each map cell obs, must match MAP_CELL_OBS_SIZE
+#define MAP_CELL_FEATURES 5
+
+// max number of drones run through the model at once, bounds the size
+// of the intermediate buffers
+#define POLICY_MAX_BATCH 256
+
+// size of the register tiles of the GEMM kernels, layer outputs are
+// padded to a multiple of the tile columns so the inner loop has a fixed
+// length and can be vectorized
+#define GEMM_TILE_ROWS 4
+#define GEMM_TILE_COLS 16
+
+typedef struct denseLayer {
+    uint16_t inputs;
+    uint16_t outputs;
+    uint16_t paddedOutputs;
+    bool leaky;
+
+    // transposed to inputs x paddedOutputs so the inner loop runs over
+    // contiguous outputs
+    float *weights;
+    float *bias;
+
+    // set if the layer is quantized, weights are scaled per output
+    int8_t *qWeights;
+    float *qScales;
+} denseLayer;
+
+typedef struct policyModel {
+    // policy.py views the map obs as columns x rows, so the first spatial
+    // dimension of the conv layers has as many cells as there are columns
+    uint8_t mapColumns;
+    uint8_t mapRows;
+    uint8_t featureOffsets[MAP_CELL_FEATURES];
+    uint16_t multihotChannels;
+    uint16_t cnnChannels;
+    uint8_t conv1Rows;
+    uint8_t conv1Columns;
+    uint8_t conv2Rows;
+    uint8_t conv2Columns;
+    uint16_t cnnOutputSize;
+    uint16_t scalarObsSize;
+    uint16_t featuresSize;
+    uint16_t lstmSize;
+    uint8_t numActions;
+
+    // multihotChannels x kernel x kernel x cnnChannels
+    float *conv1Weights;
+    float *conv1Bias;
+    denseLayer conv2;
+    denseLayer droneEncoder;
+    denseLayer encoder;
+    // input and hidden weights are fused, the input is the encoder
+    // output followed by the previous hidden state
+    denseLayer lstm;
+    denseLayer actorMean;
+
+    // intermediate buffers sized for POLICY_MAX_BATCH
+    float *conv1Out;
+    float *conv2In;
+    float *conv2Out;
+    float *scalarIn;
+    float *features;
+    float *lstmIn;
+    float *gates;
+    float *hidden;
+    float *actionMeans;
+    int8_t *qInput;
+    float *qInputScales;
+} policyModel;
+
+static inline float leakyRelu(const float v) {
+    return v >= 0.0f ? v : LEAKY_RELU_SLOPE * v;
+}
+
+static inline float sigmoid(const float v) {
+    return 1.0f / (1.0f + expf(-v));
+}
+
+static inline uint8_t convOutputSize(const uint8_t size, const uint8_t kernel, const uint8_t stride) {
+    return ((size - kernel) / stride) + 1;
+}
+
+// C = A * W + bias where A is rows x inputs with a row stride of lda
+// and C has a row stride of ldc
+void gemm(const denseLayer *layer, const float *restrict A, const uint32_t lda, float *restrict C, const uint32_t ldc, const uint32_t rows) {
+    const uint16_t N = layer->paddedOutputs;
+    for (uint32_t m0 = 0; m0 < rows; m0 += GEMM_TILE_ROWS) {
+        const uint8_t tileRows = b2MinInt(GEMM_TILE_ROWS, rows - m0);
+        for (uint16_t n0 = 0; n0 < N; n0 += GEMM_TILE_COLS) {
+            float acc[GEMM_TILE_ROWS][GEMM_TILE_COLS] = {0};
+            for (uint16_t k = 0; k < layer->inputs; k++) {
+                const float *restrict w = layer->weights + (k * N) + n0;
+                for (uint8_t m = 0; m < tileRows; m++) {
+                    const float a = A[((m0 + m) * lda) + k];
+                    for (uint8_t n = 0; n < GEMM_TILE_COLS; n++) {
+                        acc[m][n] += a * w[n];
+                    }
+                }
+            }
+
+            const uint8_t tileCols = b2MinInt(GEMM_TILE_COLS, layer->outputs - n0);
+            for (uint8_t m = 0; m < tileRows; m++) {
+                float *out = C + ((m0 + m) * ldc) + n0;
+                for (uint8_t n = 0; n < tileCols; n++) {
+                    const float v = acc[m][n] + layer->bias[n0 + n];
+                    out[n] = layer->leaky ? leakyRelu(v) : v;
+                }
+            }
+        }
+    }
+}
+
+// same as gemm but the input rows are dynamically quantized to int8 and
+// multiplied with int8 weights, accumulating in int32
+void gemmInt8(const policyModel *model, const denseLayer *layer, const float *restrict A, const uint32_t lda, float *restrict C, const uint32_t ldc, const uint32_t rows) {
+    const uint16_t K = layer->inputs;
+    int8_t *restrict qA = model->qInput;
+    float *restrict aScales = model->qInputScales;
+    for (uint32_t m = 0; m < rows; m++) {
+        const float *a = A + (m * lda);
+        float maxAbs = 0.0f;
+        for (uint16_t k = 0; k < K; k++) {
+            maxAbs = fmaxf(maxAbs, fabsf(a[k]));
+        }
+        const float scale = maxAbs == 0.0f ? 1.0f : maxAbs / 127.0f;
+        const float invScale = 1.0f / scale;
+        for (uint16_t k = 0; k < K; k++) {
+            qA[(m * K) + k] = (int8_t)lrintf(a[k] * invScale);
+        }
+        aScales[m] = scale;
+    }
+
+    const uint16_t N = layer->paddedOutputs;
+    for (uint32_t m0 = 0; m0 < rows; m0 += GEMM_TILE_ROWS) {
+        const uint8_t tileRows = b2MinInt(GEMM_TILE_ROWS, rows - m0);
+        for (uint16_t n0 = 0; n0 < N; n0 += GEMM_TILE_COLS) {
+            int32_t acc[GEMM_TILE_ROWS][GEMM_TILE_COLS] = {0};
+            for (uint16_t k = 0; k < K; k++) {
+                const int8_t *restrict w = layer->qWeights + (k * N) + n0;
+                for (uint8_t m = 0; m < tileRows; m++) {
+                    const int32_t a = qA[((m0 + m) * K) + k];
+                    for (uint8_t n = 0; n < GEMM_TILE_COLS; n++) {
+                        acc[m][n] += a * (int32_t)w[n];
+                    }
+                }
+            }
+
+            const uint8_t tileCols = b2MinInt(GEMM_TILE_COLS, layer->outputs - n0);
+            for (uint8_t m = 0; m < tileRows; m++) {
+                float *out = C + ((m0 + m) * ldc) + n0;
+                const float aScale = aScales[m0 + m];
+                for (uint8_t n = 0; n < tileCols; n++) {
+                    const float v = ((float)acc[m][n] * aScale * layer->qScales[n0 + n]) + layer->bias[n0 + n];
+                    out[n] = layer->leaky ? leakyRelu(v) : v;
+                }
+            }
+        }
+    }
+}
+
+static inline void denseForward(const policyModel *model, const denseLayer *layer, const float *A, const uint32_t lda, float *C, const uint32_t ldc, const uint32_t rows) {
+    if (layer->qWeights != NULL) {
+        gemmInt8(model, layer, A, lda, C, ldc, rows);
+    } else {
+        gemm(layer, A, lda, C, ldc, rows);
+    }
+}
+
+// weights are in PyTorch layout, outputs x inputs
+void initDenseLayer(denseLayer *layer, const float *weights, const float *bias, const uint16_t inputs, const uint16_t outputs, const bool leaky, const bool quantize) {
+    layer->inputs = inputs;
+    layer->outputs = outputs;
+    layer->paddedOutputs = ((outputs + GEMM_TILE_COLS - 1) / GEMM_TILE_COLS) * GEMM_TILE_COLS;
+    layer->leaky = leaky;
+
+    const uint16_t N = layer->paddedOutputs;
+    layer->weights = (float *)fastCalloc(inputs * N, sizeof(float));
+    layer->bias = (float *)fastCalloc(N, sizeof(float));
+    for (uint16_t n = 0; n < outputs; n++) {
+        for (uint16_t k = 0; k < inputs; k++) {
+            layer->weights[(k * N) + n] = weights[(n * inputs) + k];
+        }
+        layer->bias[n] = bias[n];
+    }
+
+    layer->qWeights = NULL;
+    layer->qScales = NULL;
+    if (!quantize) {
+        return;
+    }
+
+    // symmetric quantization with a scale per output
+    layer->qWeights = (int8_t *)fastCalloc(inputs * N, sizeof(int8_t));
+    layer->qScales = (float *)fastCalloc(N, sizeof(float));
+    for (uint16_t n = 0; n < outputs; n++) {
+        float maxAbs = 0.0f;
+        for (uint16_t k = 0; k < inputs; k++) {
+            maxAbs = fmaxf(maxAbs, fabsf(weights[(n * inputs) + k]));
+        }
+        const float scale = maxAbs == 0.0f ? 1.0f : maxAbs / 127.0f;
+        for (uint16_t k = 0; k < inputs; k++) {
+            layer->qWeights[(k * N) + n] = (int8_t)lrintf(weights[(n * inputs) + k] / scale);
+        }
+        layer->qScales[n] = scale;
+    }
+}
+
+void destroyDenseLayer(denseLayer *layer) {
+    fastFree(layer->weights);
+    fastFree(layer->bias);
+    if (layer->qWeights != NULL) {
+        fastFree(layer->qWeights);
+        fastFree(layer->qScales);
+    }
+}
+
+bool readTensor(FILE *file, float *dst, const uint32_t count) {
+    return fread(dst, sizeof(float), count, file) == count;
+}
+
+void destroyPolicyModel(policyModel *model) {
+    fastFree(model->conv1Weights);
+    fastFree(model->conv1Bias);
+    destroyDenseLayer(&model->conv2);
+    destroyDenseLayer(&model->droneEncoder);
+    destroyDenseLayer(&model->encoder);
+    destroyDenseLayer(&model->lstm);
+    destroyDenseLayer(&model->actorMean);
+
+    fastFree(model->conv1Out);
+    fastFree(model->conv2In);
+    fastFree(model->conv2Out);
+    fastFree(model->scalarIn);
+    fastFree(model->features);
+    fastFree(model->lstmIn);
+    fastFree(model->gates);
+    fastFree(model->hidden);
+    fastFree(model->actionMeans);
+    fastFree(model->qInput);
+    fastFree(model->qInputScales);
+    fastFree(model);
+}
+
+// loads exported policy weights, returns NULL if the file couldn't be
+// read or the policy was trained with different observations or actions.
+// If quantize is set all layers but the first and last are run with int8
+// weights and activations
+policyModel *loadPolicyModel(const char *path, const bool quantize) {
+    ASSERT(MAP_CELL_FEATURES == MAP_CELL_OBS_SIZE);
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        DEBUG_LOGF("failed to open policy file %s", path);
+        return NULL;
+    }
+
+    char magic[4];
+    uint32_t version;
+    uint32_t dims[8 + MAP_CELL_FEATURES];
+    if (fread(magic, sizeof(magic), 1, file) != 1 || memcmp(magic, POLICY_MODEL_MAGIC, sizeof(magic)) != 0 || fread(&version, sizeof(uint32_t), 1, file) != 1 || version != POLICY_MODEL_VERSION || fread(dims, sizeof(dims), 1, file) != 1) {
+        DEBUG_LOGF("policy file %s has an invalid header", path);
+        fclose(file);
+        return NULL;
+    }
+    if (dims[0] != OBS_MAP_COLUMNS || dims[1] != OBS_MAP_ROWS || dims[3] != SCALAR_OBS_SIZE || dims[7] != ACTION_COMPONENTS) {
+        DEBUG_LOGF("policy file %s was exported for different observations or actions", path);
+        fclose(file);
+        return NULL;
+    }
+
+    policyModel *model = (policyModel *)fastCalloc(1, sizeof(policyModel));
+    model->mapColumns = dims[0];
+    model->mapRows = dims[1];
+    model->cnnChannels = dims[2];
+    model->scalarObsSize = dims[3];
+    const uint16_t droneEncoderSize = dims[4];
+    const uint16_t encoderSize = dims[5];
+    model->lstmSize = dims[6];
+    model->numActions = dims[7];
+    model->multihotChannels = 0;
+    for (uint8_t i = 0; i < MAP_CELL_FEATURES; i++) {
+        model->featureOffsets[i] = model->multihotChannels;
+        model->multihotChannels += dims[8 + i];
+    }
+
+    model->conv1Rows = convOutputSize(model->mapColumns, CONV1_KERNEL, CONV1_STRIDE);
+    model->conv1Columns = convOutputSize(model->mapRows, CONV1_KERNEL, CONV1_STRIDE);
+    model->conv2Rows = convOutputSize(model->conv1Rows, CONV2_KERNEL, CONV2_STRIDE);
+    model->conv2Columns = convOutputSize(model->conv1Columns, CONV2_KERNEL, CONV2_STRIDE);
+    const uint16_t conv2Positions = model->conv2Rows * model->conv2Columns;
+    model->cnnOutputSize = model->cnnChannels * conv2Positions;
+    model->featuresSize = model->cnnOutputSize + droneEncoderSize;
+
+    const uint16_t C = model->cnnChannels;
+    const uint16_t conv1Inputs = model->multihotChannels * CONV1_KERNEL * CONV1_KERNEL;
+    const uint16_t conv2Inputs = C * CONV2_KERNEL * CONV2_KERNEL;
+    const uint16_t lstmInputs = encoderSize + model->lstmSize;
+    const uint16_t gatesSize = 4 * model->lstmSize;
+
+    // the largest tensor is read into this and rearranged from there
+    uint32_t maxTensor = C * conv1Inputs;
+    maxTensor = b2MaxInt(maxTensor, encoderSize * model->featuresSize);
+    maxTensor = b2MaxInt(maxTensor, gatesSize * lstmInputs);
+    float *tensor = (float *)fastCalloc(maxTensor, sizeof(float));
+    float *tensor2 = (float *)fastCalloc(maxTensor, sizeof(float));
+    float *bias = (float *)fastCalloc(gatesSize, sizeof(float));
+    float *bias2 = (float *)fastCalloc(gatesSize, sizeof(float));
+
+    bool ok = true;
+
+    // conv 1, rearrange from (out, in, y, x) to (in, y, x, out) so the
+    // weights of a set input channel are contiguous
+    model->conv1Weights = (float *)fastCalloc(C * conv1Inputs, sizeof(float));
+    model->conv1Bias = (float *)fastCalloc(C, sizeof(float));
+    ok = ok && readTensor(file, tensor, C * conv1Inputs) && readTensor(file, model->conv1Bias, C);
+    for (uint16_t oc = 0; oc < C; oc++) {
+        for (uint16_t i = 0; i < conv1Inputs; i++) {
+            model->conv1Weights[(i * C) + oc] = tensor[(oc * conv1Inputs) + i];
+        }
+    }
+
+    // conv 2 is run on patches laid out as (y, x, in), rearrange from
+    // (out, in, y, x) to match
+    ok = ok && readTensor(file, tensor, C * conv2Inputs) && readTensor(file, bias, C);
+    for (uint16_t oc = 0; oc < C; oc++) {
+        for (uint16_t ic = 0; ic < C; ic++) {
+            for (uint8_t k = 0; k < CONV2_KERNEL * CONV2_KERNEL; k++) {
+                tensor2[(oc * conv2Inputs) + (k * C) + ic] = tensor[(oc * conv2Inputs) + (ic * CONV2_KERNEL * CONV2_KERNEL) + k];
+            }
+        }
+    }
+    initDenseLayer(&model->conv2, tensor2, bias, conv2Inputs, C, true, quantize);
+
+    ok = ok && readTensor(file, tensor, droneEncoderSize * model->scalarObsSize) && readTensor(file, bias, droneEncoderSize);
+    initDenseLayer(&model->droneEncoder, tensor, bias, model->scalarObsSize, droneEncoderSize, true, quantize);
+
+    // PyTorch flattens the conv output as (channel, position) but it's
+    // computed as (position, channel), rearrange the encoder's inputs
+    ok = ok && readTensor(file, tensor, encoderSize * model->featuresSize) && readTensor(file, bias, encoderSize);
+    memcpy(tensor2, tensor, encoderSize * model->featuresSize * sizeof(float));
+    for (uint16_t o = 0; o < encoderSize; o++) {
+        const float *src = tensor + (o * model->featuresSize);
+        float *dst = tensor2 + (o * model->featuresSize);
+        for (uint16_t c = 0; c < C; c++) {
+            for (uint16_t p = 0; p < conv2Positions; p++) {
+                dst[(p * C) + c] = src[(c * conv2Positions) + p];
+            }
+        }
+    }
+    initDenseLayer(&model->encoder, tensor2, bias, model->featuresSize, encoderSize, true, quantize);
+
+    // fuse the LSTM input and hidden weights and biases
+    ok = ok && readTensor(file, tensor, gatesSize * encoderSize) && readTensor(file, tensor2, gatesSize * model->lstmSize);
+    float *lstmWeights = (float *)fastCalloc(gatesSize * lstmInputs, sizeof(float));
+    for (uint16_t g = 0; g < gatesSize; g++) {
+        memcpy(lstmWeights + (g * lstmInputs), tensor + (g * encoderSize), encoderSize * sizeof(float));
+        memcpy(lstmWeights + (g * lstmInputs) + encoderSize, tensor2 + (g * model->lstmSize), model->lstmSize * sizeof(float));
+    }
+    ok = ok && readTensor(file, bias, gatesSize) && readTensor(file, bias2, gatesSize);
+    for (uint16_t g = 0; g < gatesSize; g++) {
+        bias[g] += bias2[g];
+    }
+    initDenseLayer(&model->lstm, lstmWeights, bias, lstmInputs, gatesSize, false, quantize);
+    fastFree(lstmWeights);
+
+    ok = ok && readTensor(file, tensor, model->numActions * model->lstmSize) && readTensor(file, bias, model->numActions);
+    initDenseLayer(&model->actorMean, tensor, bias, model->lstmSize, model->numActions, false, false);
+
+    fastFree(tensor);
+    fastFree(tensor2);
+    fastFree(bias);
+    fastFree(bias2);
+    fclose(file);
+
+    const uint16_t conv1Size = C * model->conv1Rows * model->conv1Columns;
+    const uint32_t maxQInput = b2MaxInt(conv2Positions * conv2Inputs, b2MaxInt(model->featuresSize, lstmInputs));
+    model->conv1Out = (float *)fastCalloc(POLICY_MAX_BATCH * conv1Size, sizeof(float));
+    model->conv2In = (float *)fastCalloc(POLICY_MAX_BATCH * conv2Positions * conv2Inputs, sizeof(float));
+    model->conv2Out = (float *)fastCalloc(POLICY_MAX_BATCH * model->cnnOutputSize, sizeof(float));
+    model->scalarIn = (float *)fastCalloc(POLICY_MAX_BATCH * model->scalarObsSize, sizeof(float));
+    model->features = (float *)fastCalloc(POLICY_MAX_BATCH * model->featuresSize, sizeof(float));
+    model->lstmIn = (float *)fastCalloc(POLICY_MAX_BATCH * lstmInputs, sizeof(float));
+    model->gates = (float *)fastCalloc(POLICY_MAX_BATCH * gatesSize, sizeof(float));
+    model->hidden = (float *)fastCalloc(POLICY_MAX_BATCH * model->lstmSize, sizeof(float));
+    model->actionMeans = (float *)fastCalloc(POLICY_MAX_BATCH * model->numActions, sizeof(float));
+    model->qInput = (int8_t *)fastCalloc(POLICY_MAX_BATCH * maxQInput, sizeof(int8_t));
+    model->qInputScales = (float *)fastCalloc(POLICY_MAX_BATCH * conv2Positions, sizeof(float));
+
+    if (!ok) {
+        DEBUG_LOGF("policy file %s is truncated", path);
+        destroyPolicyModel(model);
+        return NULL;
+    }
+    return model;
+}
+
+// number of floats of the recurrent state of a single drone
+static inline uint16_t policyStateSize(const policyModel *model) {
+    return 2 * model->lstmSize;
+}
+
+void conv1Forward(const policyModel *model, const uint8_t *obs, float *out) {
+    const uint16_t C = model->cnnChannels;
+    for (uint8_t oy = 0; oy < model->conv1Rows; oy++) {
+        for (uint8_t ox = 0; ox < model->conv1Columns; ox++) {
+            float *restrict acc = out + (((oy * model->conv1Columns) + ox) * C);
+            memcpy(acc, model->conv1Bias, C * sizeof(float));
+
+            for (uint8_t ky = 0; ky < CONV1_KERNEL; ky++) {
+                const uint8_t y = (oy * CONV1_STRIDE) + ky;
+                for (uint8_t kx = 0; kx < CONV1_KERNEL; kx++) {
+                    const uint8_t x = (ox * CONV1_STRIDE) + kx;
+                    const uint8_t *cell = obs + (((y * model->mapRows) + x) * MAP_CELL_OBS_SIZE);
+                    for (uint8_t f = 0; f < MAP_CELL_FEATURES; f++) {
+                        const uint16_t channel = model->featureOffsets[f] + cell[f];
+                        const float *restrict w = model->conv1Weights + ((((channel * CONV1_KERNEL) + ky) * CONV1_KERNEL) + kx) * C;
+                        for (uint16_t c = 0; c < C; c++) {
+                            acc[c] += w[c];
+                        }
+                    }
+                }
+            }
+
+            for (uint16_t c = 0; c < C; c++) {
+                acc[c] = leakyRelu(acc[c]);
+            }
+        }
+    }
+}
+
+// gathers the conv 2 patch of every output position into a row
+void conv2Patches(const policyModel *model, const float *in, float *patches) {
+    const uint16_t C = model->cnnChannels;
+    for (uint8_t oy = 0; oy < model->conv2Rows; oy++) {
+        for (uint8_t ox = 0; ox < model->conv2Columns; ox++) {
+            for (uint8_t ky = 0; ky < CONV2_KERNEL; ky++) {
+                const uint8_t y = (oy * CONV2_STRIDE) + ky;
+                const float *src = in + (((y * model->conv1Columns) + (ox * CONV2_STRIDE)) * C);
+                memcpy(patches, src, CONV2_KERNEL * C * sizeof(float));
+                patches += CONV2_KERNEL * C;
+            }
+        }
+    }
+}
+
+// runs a batch of drone observations through the policy, updating their
+// recurrent states in place and writing the most likely discrete action
+// of each drone to actions; states[i] points to the state of drone i
+void policyForward(policyModel *model, const uint8_t *obs, float *const *states, int *actions, const uint16_t batchSize) {
+    ASSERT(batchSize <= POLICY_MAX_BATCH);
+    if (batchSize == 0) {
+        return;
+    }
+
+    const uint16_t C = model->cnnChannels;
+    const uint16_t conv1Size = C * model->conv1Rows * model->conv1Columns;
+    const uint16_t conv2Positions = model->conv2Rows * model->conv2Columns;
+    const uint16_t H = model->lstmSize;
+    const uint16_t lstmInputs = model->lstm.inputs;
+    const uint16_t encoderSize = model->encoder.outputs;
+
+    for (uint16_t b = 0; b < batchSize; b++) {
+        const uint8_t *droneObs = obs + (b * OBS_SIZE);
+        conv1Forward(model, droneObs, model->conv1Out + (b * conv1Size));
+        conv2Patches(model, model->conv1Out + (b * conv1Size), model->conv2In + (b * conv2Positions * model->conv2.inputs));
+
+        // the scalar obs is scaled like in policy.py, the last values
+        // are passed through as is
+        const uint8_t *scalarObs = droneObs + MAP_OBS_SIZE;
+        float *scalarIn = model->scalarIn + (b * model->scalarObsSize);
+        const uint16_t scaledSize = model->scalarObsSize - (NUM_WEAPONS + 1);
+        for (uint16_t i = 0; i < model->scalarObsSize; i++) {
+            scalarIn[i] = i < scaledSize ? scalarObs[i] / 255.0f : scalarObs[i];
+        }
+    }
+
+    denseForward(model, &model->conv2, model->conv2In, model->conv2.inputs, model->conv2Out, C, batchSize * conv2Positions);
+    for (uint16_t b = 0; b < batchSize; b++) {
+        memcpy(model->features + (b * model->featuresSize), model->conv2Out + (b * model->cnnOutputSize), model->cnnOutputSize * sizeof(float));
+    }
+    denseForward(model, &model->droneEncoder, model->scalarIn, model->scalarObsSize, model->features + model->cnnOutputSize, model->featuresSize, batchSize);
+    denseForward(model, &model->encoder, model->features, model->featuresSize, model->lstmIn, lstmInputs, batchSize);
+
+    for (uint16_t b = 0; b < batchSize; b++) {
+        memcpy(model->lstmIn + (b * lstmInputs) + encoderSize, states[b], H * sizeof(float));
+    }
+    denseForward(model, &model->lstm, model->lstmIn, lstmInputs, model->gates, 4 * H, batchSize);
+
+    // PyTorch's gate order is input, forget, cell, output
+    for (uint16_t b = 0; b < batchSize; b++) {
+        const float *gates = model->gates + (b * 4 * H);
+        float *hidden = states[b];
+        float *cell = states[b] + H;
+        for (uint16_t i = 0; i < H; i++) {
+            const float inputGate = sigmoid(gates[i]);
+            const float forgetGate = sigmoid(gates[H + i]);
+            const float cellGate = tanhf(gates[(2 * H) + i]);
+            const float outputGate = sigmoid(gates[(3 * H) + i]);
+            cell[i] = (forgetGate * cell[i]) + (inputGate * cellGate);
+            hidden[i] = outputGate * tanhf(cell[i]);
+        }
+        memcpy(model->hidden + (b * H), hidden, H * sizeof(float));
+    }
+
+    denseForward(model, &model->actorMean, model->hidden, H, model->actionMeans, model->numActions, batchSize);
+
+    // the policy outputs the mean of each action component, the closest
+    // valid discrete action is taken
+    const uint8_t actionSizes[] = {AIM_ACTIONS, BOOST_ACTIONS, FIRE_ACTIONS, ROTATION_ACTIONS};
+    for (uint16_t b = 0; b < batchSize; b++) {
+        for (uint8_t i = 0; i < ACTION_COMPONENTS; i++) {
+            const int action = (int)lrintf(model->actionMeans[(b * model->numActions) + i]);
+            actions[(b * ACTION_COMPONENTS) + i] = b2ClampInt(action, 0, actionSizes[i] - 1);
+        }
+    }
+}
+
+// drones controlled by policy bots across a set of envs, see policyBotsStep
+typedef struct policyBots {
+    policyModel *model;
+    uint16_t numEnvs;
+    // recurrent state of every drone of every env
+    float *states;
+
+    // observations, states and where to write the actions of the drones
+    // in the current batch
+    uint8_t *obs;
+    float **batchStates;
+    int **batchActions;
+    int *actions;
+} policyBots;
+
+policyBots *createPolicyBots(const char *path, const uint16_t numEnvs, const bool quantize) {
+    policyModel *model = loadPolicyModel(path, quantize);
+    if (model == NULL) {
+        return NULL;
+    }
+
+    policyBots *bots = (policyBots *)fastCalloc(1, sizeof(policyBots));
+    bots->model = model;
+    bots->numEnvs = numEnvs;
+    bots->states = (float *)fastCalloc(numEnvs * _MAX_DRONES * policyStateSize(model), sizeof(float));
+    bots->obs = (uint8_t *)fastCalloc(POLICY_MAX_BATCH * OBS_SIZE, sizeof(uint8_t));
+    bots->batchStates = (float **)fastCalloc(POLICY_MAX_BATCH, sizeof(float *));
+    bots->batchActions = (int **)fastCalloc(POLICY_MAX_BATCH, sizeof(int *));
+    bots->actions = (int *)fastCalloc(POLICY_MAX_BATCH * ACTION_COMPONENTS, sizeof(int));
+    return bots;
+}
+
+void destroyPolicyBots(policyBots *bots) {
+    destroyPolicyModel(bots->model);
+    fastFree(bots->states);
+    fastFree(bots->obs);
+    fastFree(bots->batchStates);
+    fastFree(bots->batchActions);
+    fastFree(bots->actions);
+    fastFree(bots);
+}
+
+void policyBotsForward(policyBots *bots, const uint16_t batchSize) {
+    policyForward(bots->model, bots->obs, bots->batchStates, bots->actions, batchSize);
+    for (uint16_t i = 0; i < batchSize; i++) {
+        memcpy(bots->batchActions[i], bots->actions + (i * ACTION_COMPONENTS), ACTION_COMPONENTS * sizeof(int));
+    }
+}
+
+#endif
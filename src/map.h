@@ -4,7 +4,13 @@
 #include <errno.h>
 #include <string.h>
 
+#ifndef AUTOPXD
+#include <pthread.h>
+#endif
+
 #include "env.h"
+#include "mapfile.h"
+#include "mapgen.h"
 #include "settings.h"
 
 // clang-format off
@@ -184,8 +190,6 @@ const mapEntry clownHouseMap = {
 
 // clang-format on
 
-#define NUM_MAPS 5
-
 #ifndef AUTOPXD
 const mapEntry *maps[] = {
     (mapEntry *)&boringMap,
@@ -196,14 +200,32 @@ const mapEntry *maps[] = {
 };
 #endif
 
-void createMap(env *e, const int mapIdx) {
-    const uint8_t columns = maps[mapIdx]->columns;
-    const uint8_t rows = maps[mapIdx]->rows;
-    const char *layout = maps[mapIdx]->layout;
+#ifndef AUTOPXD
+mapTemplate mapTemplates[_NUM_MAPS];
+pthread_once_t mapTemplatesOnce = PTHREAD_ONCE_INIT;
+
+// generated and map file maps that were recently used, shared by every
+// env; mapCacheLock must be held while looking up or using an entry
+mapCacheEntry mapCache[_MAP_CACHE_SIZE];
+uint64_t mapCacheTick = 0;
+pthread_mutex_t mapCacheLock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+// parses the layout of a map into the template's cells and walls
+void compileMapLayout(const mapEntry *map, mapTemplate *tmpl) {
+    const uint8_t columns = map->columns;
+    const uint8_t rows = map->rows;
+    const char *layout = map->layout;
 
-    e->columns = columns;
-    e->rows = rows;
-    e->defaultWeapon = weaponInfos[maps[mapIdx]->defaultWeapon];
+    tmpl->columns = columns;
+    tmpl->rows = rows;
+    tmpl->floatingStandardWalls = map->floatingStandardWalls;
+    tmpl->floatingBouncyWalls = map->floatingBouncyWalls;
+    tmpl->floatingDeathWalls = map->floatingDeathWalls;
+    tmpl->weaponPickups = map->weaponPickups;
+    tmpl->defaultWeapon = map->defaultWeapon;
+    tmpl->numWalls = 0;
+    tmpl->numCells = 0;
 
     for (int row = 0; row < rows; row++) {
         for (int col = 0; col < columns; col++) {
@@ -212,11 +234,9 @@ void createMap(env *e, const int mapIdx) {
             float x = (col - (columns / 2.0f) + 0.5) * WALL_THICKNESS;
             float y = ((rows / 2.0f) - (rows - row) + 0.5f) * WALL_THICKNESS;
 
-            b2Vec2 pos = {.x = x, .y = y};
-            mapCell *cell = (mapCell *)fastMalloc(sizeof(mapCell));
-            cell->ent = NULL;
-            cell->pos = pos;
-            cc_array_add(e->cells, cell);
+            const uint16_t cellIdx = tmpl->numCells++;
+            tmpl->wallTypes[cellIdx] = 0;
+            tmpl->positions[cellIdx] = (b2Vec2){.x = x, .y = y};
 
             bool floating = false;
             float thickness = WALL_THICKNESS;
@@ -245,14 +265,235 @@ void createMap(env *e, const int mapIdx) {
                 ERRORF("unknown map layout cell %c", cellType);
             }
 
-            entity *ent = createWall(e, x, y, thickness, thickness, wallType, floating);
+            tmpl->walls[tmpl->numWalls++] = (mapTemplateWall){
+                .pos = {.x = x, .y = y},
+                .thickness = thickness,
+                .type = wallType,
+                .floating = floating,
+                .cellIdx = cellIdx,
+            };
             if (!floating) {
-                cell->ent = ent;
+                tmpl->wallTypes[cellIdx] = wallType + 1;
             }
         }
     }
 }
 
+// computes the area inside the map's static walls
+void computeMapBounds(mapTemplate *tmpl) {
+    tmpl->bounds = (mapBounds){.min = {.x = FLT_MAX, .y = FLT_MAX}, .max = {.x = FLT_MIN, .y = FLT_MIN}};
+    for (uint16_t i = 0; i < tmpl->numWalls; i++) {
+        const mapTemplateWall *wall = &tmpl->walls[i];
+        if (wall->floating) {
+            continue;
+        }
+        const float extent = wall->thickness / 2.0f;
+        tmpl->bounds.min.x = fminf(wall->pos.x - extent + WALL_THICKNESS, tmpl->bounds.min.x);
+        tmpl->bounds.min.y = fminf(wall->pos.y - extent + WALL_THICKNESS, tmpl->bounds.min.y);
+        tmpl->bounds.max.x = fmaxf(wall->pos.x + extent - WALL_THICKNESS, tmpl->bounds.max.x);
+        tmpl->bounds.max.y = fmaxf(wall->pos.y + extent - WALL_THICKNESS, tmpl->bounds.max.y);
+    }
+}
+
+// finds the cells a drone spawn query would find a static wall from, so
+// findOpenPos doesn't have to query the world for them
+void computeDroneSpawnBlocked(mapTemplate *tmpl) {
+    const int columns = tmpl->columns;
+    const int rows = tmpl->rows;
+    const int reach = spawnReachCells(DRONE_WALL_SPAWN_DISTANCE, WALL_THICKNESS / 2.0f);
+    for (int row = 0; row < rows; row++) {
+        for (int col = 0; col < columns; col++) {
+            bool blocked = false;
+            for (int r = row - reach; r <= row + reach && !blocked; r++) {
+                for (int c = col - reach; c <= col + reach; c++) {
+                    if (r >= 0 && r < rows && c >= 0 && c < columns && tmpl->wallTypes[c + (r * columns)] != 0) {
+                        blocked = true;
+                        break;
+                    }
+                }
+            }
+            tmpl->droneSpawnBlocked[col + (row * columns)] = blocked;
+        }
+    }
+}
+
+void compileMapTemplate(const mapEntry *map, mapTemplate *tmpl) {
+    compileMapLayout(map, tmpl);
+    computeMapBounds(tmpl);
+    computeDroneSpawnBlocked(tmpl);
+}
+
+// map file records already hold what is computed from the layout
+void compileMapRecord(const mapFileRecord *record, mapTemplate *tmpl) {
+    const mapEntry map = {
+        .layout = mapRecordLayout(record),
+        .columns = record->columns,
+        .rows = record->rows,
+        .floatingStandardWalls = record->floatingStandardWalls,
+        .floatingBouncyWalls = record->floatingBouncyWalls,
+        .floatingDeathWalls = record->floatingDeathWalls,
+        .weaponPickups = record->weaponPickups,
+        .defaultWeapon = record->defaultWeapon,
+    };
+    compileMapLayout(&map, tmpl);
+    tmpl->bounds = record->bounds;
+    memcpy(tmpl->droneSpawnBlocked, mapRecordDroneSpawnBlocked(record), tmpl->numCells * sizeof(bool));
+}
+
+static void compileMapTemplates() {
+    for (uint8_t i = 0; i < NUM_MAPS; i++) {
+        compileMapTemplate(maps[i], &mapTemplates[i]);
+    }
+}
+
+// envs can be created on different threads, so the predefined maps are
+// only compiled by the first one
+void initMapTemplates() {
+    pthread_once(&mapTemplatesOnce, compileMapTemplates);
+}
+
+static inline bool mapGenParamsEqual(const mapGenParams *a, const mapGenParams *b) {
+    return a->columns == b->columns && a->rows == b->rows && a->wallDensity == b->wallDensity && a->standardWallWeight == b->standardWallWeight && a->bouncyWallWeight == b->bouncyWallWeight && a->deathWallWeight == b->deathWallWeight && a->symmetry == b->symmetry && a->floatingStandardWalls == b->floatingStandardWalls && a->floatingBouncyWalls == b->floatingBouncyWalls && a->floatingDeathWalls == b->floatingDeathWalls && a->weaponPickups == b->weaponPickups && a->defaultWeapon == b->defaultWeapon && a->numDrones == b->numDrones;
+}
+
+// returns the cached map of a library's map, or the seed and params of
+// a generated map if libraryId is 0. If it isn't cached the least
+// recently used entry is returned invalidated so the map can be
+// compiled into it. mapCacheLock must be held
+mapCacheEntry *mapCacheLookup(const uint32_t libraryId, const uint32_t libraryIdx, const mapGenParams *params, const uint64_t seed) {
+    mapCacheTick++;
+    // entries that were never used have a lastUsed of 0 so they're
+    // picked before any entry is evicted
+    mapCacheEntry *lru = &mapCache[0];
+    for (uint8_t i = 0; i < _MAP_CACHE_SIZE; i++) {
+        mapCacheEntry *entry = &mapCache[i];
+        if (entry->valid && entry->libraryId == libraryId && (libraryId != 0 ? entry->libraryIdx == libraryIdx : (entry->seed == seed && mapGenParamsEqual(&entry->params, params)))) {
+            entry->lastUsed = mapCacheTick;
+            return entry;
+        }
+        if (entry->lastUsed < lru->lastUsed) {
+            lru = entry;
+        }
+    }
+
+    lru->valid = false;
+    lru->lastUsed = mapCacheTick;
+    lru->libraryId = libraryId;
+    lru->libraryIdx = libraryIdx;
+    lru->seed = seed;
+    if (params != NULL) {
+        lru->params = *params;
+    }
+    return lru;
+}
+
+// returns the template of the map generated from params and seed, the
+// map is only generated and compiled if it isn't cached already.
+// mapCacheLock must be held until the template is no longer used
+const mapTemplate *generatedMapTemplate(const mapGenParams *params, const uint64_t seed) {
+    mapCacheEntry *entry = mapCacheLookup(0, 0, params, seed);
+    if (entry->valid) {
+        return &entry->tmpl;
+    }
+
+    char layout[MAX_CELLS];
+    generateMapLayout(params, seed, layout);
+    const mapEntry map = {
+        .layout = layout,
+        .columns = params->columns,
+        .rows = params->rows,
+        .floatingStandardWalls = params->floatingStandardWalls,
+        .floatingBouncyWalls = params->floatingBouncyWalls,
+        .floatingDeathWalls = params->floatingDeathWalls,
+        .weaponPickups = params->weaponPickups,
+        .defaultWeapon = params->defaultWeapon,
+    };
+    compileMapTemplate(&map, &entry->tmpl);
+    entry->valid = true;
+    return &entry->tmpl;
+}
+
+// returns the template of a map of a map file, the map is only compiled
+// if it isn't cached already. mapCacheLock must be held until the
+// template is no longer used
+const mapTemplate *libraryMapTemplate(const mapLibrary *library, const uint32_t idx) {
+    const mapFileRecord *record = mapLibraryRecord(library, idx);
+    mapCacheEntry *entry = mapCacheLookup(library->id, idx, NULL, 0);
+    if (entry->valid) {
+        return &entry->tmpl;
+    }
+    compileMapRecord(record, &entry->tmpl);
+    entry->valid = true;
+    return &entry->tmpl;
+}
+
+// compiles a map and appends it to a map file, layout holds a cell type
+// per cell in the same format as the layouts of predefined maps
+void addMapToFile(mapFileWriter *writer, const char *layout, const uint8_t columns, const uint8_t rows, const uint8_t floatingStandardWalls, const uint8_t floatingBouncyWalls, const uint8_t floatingDeathWalls, const uint16_t weaponPickups, const enum weaponType defaultWeapon) {
+    ASSERT(columns <= MAX_MAP_COLUMNS && rows <= MAX_MAP_ROWS);
+    const mapEntry map = {
+        .layout = layout,
+        .columns = columns,
+        .rows = rows,
+        .floatingStandardWalls = floatingStandardWalls,
+        .floatingBouncyWalls = floatingBouncyWalls,
+        .floatingDeathWalls = floatingDeathWalls,
+        .weaponPickups = weaponPickups,
+        .defaultWeapon = defaultWeapon,
+    };
+    // templates of the biggest maps are too large for the stack
+    mapTemplate *tmpl = (mapTemplate *)fastMalloc(sizeof(mapTemplate));
+    compileMapTemplate(&map, tmpl);
+    writeMapRecord(writer, &map, tmpl);
+    fastFree(tmpl);
+}
+
+// sets up the map's cells and walls from its template
+void createMap(env *e, const mapTemplate *tmpl) {
+    if (tmpl->columns > OBS_MAP_COLUMNS || tmpl->rows > OBS_MAP_ROWS) {
+        ERRORF("%dx%d map doesn't fit in the %dx%d map obs", tmpl->columns, tmpl->rows, OBS_MAP_COLUMNS, OBS_MAP_ROWS);
+    }
+    e->columns = tmpl->columns;
+    e->rows = tmpl->rows;
+    e->obsCellOffset = ((OBS_MAP_COLUMNS - tmpl->columns) / 2) + (((OBS_MAP_ROWS - tmpl->rows) / 2) * OBS_MAP_COLUMNS);
+    e->defaultWeapon = weaponInfos[tmpl->defaultWeapon];
+    e->bounds = tmpl->bounds;
+
+    const uint16_t numCells = tmpl->numCells;
+    e->cells.count = numCells;
+    memcpy(e->cells.wallTypes, tmpl->wallTypes, numCells * sizeof(uint8_t));
+    memset(e->cells.pickupWeapons, 0x0, numCells * sizeof(uint8_t));
+    memset(e->cells.entities, NULL_ENTITY_HANDLE, numCells * sizeof(entityHandle));
+    memcpy(e->cells.positions, tmpl->positions, numCells * sizeof(b2Vec2));
+    memcpy(e->cells.droneSpawnBlocked, tmpl->droneSpawnBlocked, numCells * sizeof(bool));
+
+    for (uint16_t i = 0; i < tmpl->numWalls; i++) {
+        const mapTemplateWall *wall = &tmpl->walls[i];
+        const entityHandle ent = createWall(e, wall->pos.x, wall->pos.y, wall->thickness, wall->thickness, wall->type, wall->floating);
+        if (!wall->floating) {
+            e->cells.entities[wall->cellIdx] = ent;
+        }
+    }
+}
+
+// picks the map of the next episode according to the env's map weights
+uint8_t sampleMap(env *e) {
+    const float r = randFloat(&e->randState, 0.0f, 1.0f);
+    float cumulative = 0.0f;
+    uint8_t mapIdx = 0;
+    for (uint8_t i = 0; i < NUM_MAPS; i++) {
+        if (e->mapWeights[i] == 0.0f) {
+            continue;
+        }
+        mapIdx = i;
+        cumulative += e->mapWeights[i];
+        if (r < cumulative) {
+            break;
+        }
+    }
+    return mapIdx;
+}
+
 void placeRandFloatingWall(env *e, const enum entityType wallType) {
     b2Vec2 pos;
     if (!findOpenPos(e, FLOATING_WALL_SHAPE, &pos)) {
@@ -261,14 +502,14 @@ void placeRandFloatingWall(env *e, const enum entityType wallType) {
     createWall(e, pos.x, pos.y, FLOATING_WALL_THICKNESS, FLOATING_WALL_THICKNESS, wallType, true);
 }
 
-void placeRandFloatingWalls(env *e, const int mapIdx) {
-    for (int i = 0; i < maps[mapIdx]->floatingStandardWalls; i++) {
+void placeRandFloatingWalls(env *e, const mapTemplate *tmpl) {
+    for (int i = 0; i < tmpl->floatingStandardWalls; i++) {
         placeRandFloatingWall(e, STANDARD_WALL_ENTITY);
     }
-    for (int i = 0; i < maps[mapIdx]->floatingBouncyWalls; i++) {
+    for (int i = 0; i < tmpl->floatingBouncyWalls; i++) {
         placeRandFloatingWall(e, BOUNCY_WALL_ENTITY);
     }
-    for (int i = 0; i < maps[mapIdx]->floatingDeathWalls; i++) {
+    for (int i = 0; i < tmpl->floatingDeathWalls; i++) {
         placeRandFloatingWall(e, DEATH_WALL_ENTITY);
     }
 }
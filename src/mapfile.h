@@ -0,0 +1,210 @@
+#ifndef IMPULSE_WARS_MAPFILE_H
+#define IMPULSE_WARS_MAPFILE_H
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "helpers.h"
+#include "settings.h"
+#include "types.h"
+
+// Map files hold libraries of maps so maps can be added without
+// recompiling. Files are memory mapped read only and shared, so every
+// process using the same file shares one copy of it in the page cache.
+// Every record is validated when a file is opened, maps are only compiled
+// when an episode is first played on them. Besides the layout
+// records hold what would otherwise be computed from it: the bounds sudden
+// death walls are placed from and which cells drones can spawn at.
+//
+// Format, all values in native byte order:
+//   header: mapFileHeader
+//   map records, each 8 byte aligned: mapFileRecord, the layout (columns
+//                * rows u8) and whether drones can't spawn at each cell
+//                (columns * rows u8)
+//   index: offset (u64) of each map record, at the header's index offset
+
+#define MAP_FILE_VERSION 1
+#define MAP_FILE_ALIGNMENT 8
+
+const char MAP_FILE_MAGIC[4] = {'I', 'W', 'M', 'F'};
+
+#ifndef AUTOPXD
+// ids of opened libraries, 0 is used for generated maps
+uint32_t lastMapLibraryId = 0;
+#endif
+
+typedef struct mapFileWriter {
+    FILE *file;
+    uint64_t offset;
+    uint64_t *offsets;
+    uint32_t numMaps;
+    uint32_t capacity;
+} mapFileWriter;
+
+static inline uint64_t mapRecordSize(const uint8_t columns, const uint8_t rows) {
+    return sizeof(mapFileRecord) + (2 * (uint64_t)columns * rows);
+}
+
+static inline const mapFileRecord *mapLibraryRecord(const mapLibrary *library, const uint32_t idx) {
+    ASSERT(idx < library->numMaps);
+    return (const mapFileRecord *)((const uint8_t *)library->data + library->offsets[idx]);
+}
+
+static inline const char *mapRecordLayout(const mapFileRecord *record) {
+    return (const char *)(record + 1);
+}
+
+static inline const bool *mapRecordDroneSpawnBlocked(const mapFileRecord *record) {
+    return (const bool *)(mapRecordLayout(record) + (record->columns * record->rows));
+}
+
+// checks that a record's layout only holds known cell types and its spawn
+// flags are bools, so bad files are rejected when loaded instead of when
+// an episode is played on them
+static inline bool mapRecordCellsValid(const mapFileRecord *record) {
+    const char *layout = mapRecordLayout(record);
+    const uint8_t *droneSpawnBlocked = (const uint8_t *)mapRecordDroneSpawnBlocked(record);
+    const uint16_t cells = record->columns * record->rows;
+    for (uint16_t i = 0; i < cells; i++) {
+        if (layout[i] == '\0' || strchr("OWwBbDd", layout[i]) == NULL || droneSpawnBlocked[i] > 1) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// memory maps a map file, returns NULL if it couldn't be opened or isn't
+// a valid map file
+mapLibrary *openMapLibrary(const char *path) {
+    const int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        DEBUG_LOGF("failed to open map file %s", path);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(mapFileHeader)) {
+        DEBUG_LOGF("map file %s is too small", path);
+        close(fd);
+        return NULL;
+    }
+    const size_t size = st.st_size;
+    void *data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    // the mapping keeps the file open
+    close(fd);
+    if (data == MAP_FAILED) {
+        DEBUG_LOGF("failed to memory map map file %s", path);
+        return NULL;
+    }
+
+    const mapFileHeader *header = (const mapFileHeader *)data;
+    bool valid = memcmp(header->magic, MAP_FILE_MAGIC, sizeof(MAP_FILE_MAGIC)) == 0 && header->version == MAP_FILE_VERSION && header->numMaps != 0;
+    // offsets are compared against the space left after them so crafted
+    // offsets can't overflow
+    valid = valid && header->indexOffset % MAP_FILE_ALIGNMENT == 0 && header->indexOffset <= size && header->numMaps <= (size - header->indexOffset) / sizeof(uint64_t);
+    const uint64_t *offsets = (const uint64_t *)((const uint8_t *)data + header->indexOffset);
+    for (uint32_t i = 0; valid && i < header->numMaps; i++) {
+        if (offsets[i] % MAP_FILE_ALIGNMENT != 0 || offsets[i] > size || size - offsets[i] < sizeof(mapFileRecord)) {
+            valid = false;
+            break;
+        }
+        const mapFileRecord *record = (const mapFileRecord *)((const uint8_t *)data + offsets[i]);
+        // files may hold maps up to the biggest map size, but only maps
+        // that fit in the map obs can be played
+        valid = record->columns != 0 && record->rows != 0 && record->columns <= OBS_MAP_COLUMNS && record->rows <= OBS_MAP_ROWS && record->defaultWeapon < NUM_WEAPONS;
+        valid = valid && mapRecordSize(record->columns, record->rows) <= size - offsets[i] && mapRecordCellsValid(record);
+    }
+    if (!valid) {
+        DEBUG_LOGF("map file %s is invalid", path);
+        munmap(data, size);
+        return NULL;
+    }
+
+    mapLibrary *library = (mapLibrary *)fastCalloc(1, sizeof(mapLibrary));
+    library->id = __atomic_add_fetch(&lastMapLibraryId, 1, __ATOMIC_RELAXED);
+    library->data = data;
+    library->size = size;
+    library->numMaps = header->numMaps;
+    library->offsets = offsets;
+    return library;
+}
+
+void closeMapLibrary(mapLibrary *library) {
+    munmap(library->data, library->size);
+    fastFree(library);
+}
+
+mapFileWriter *createMapFileWriter(const char *path) {
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        DEBUG_LOGF("failed to create map file %s", path);
+        return NULL;
+    }
+
+    // the header is rewritten once the index offset is known
+    const mapFileHeader header = {0};
+    fwrite(&header, sizeof(mapFileHeader), 1, file);
+
+    mapFileWriter *writer = (mapFileWriter *)fastCalloc(1, sizeof(mapFileWriter));
+    writer->file = file;
+    writer->offset = sizeof(mapFileHeader);
+    return writer;
+}
+
+static inline void mapFileWriterPad(mapFileWriter *writer) {
+    const uint8_t padding[MAP_FILE_ALIGNMENT] = {0};
+    const uint64_t paddingSize = (MAP_FILE_ALIGNMENT - (writer->offset % MAP_FILE_ALIGNMENT)) % MAP_FILE_ALIGNMENT;
+    fwrite(padding, paddingSize, 1, writer->file);
+    writer->offset += paddingSize;
+}
+
+// appends a map compiled into tmpl from map to the file
+void writeMapRecord(mapFileWriter *writer, const mapEntry *map, const mapTemplate *tmpl) {
+    if (writer->numMaps == writer->capacity) {
+        writer->capacity = writer->capacity == 0 ? 64 : writer->capacity * 2;
+        writer->offsets = (uint64_t *)fastRealloc(writer->offsets, writer->capacity * sizeof(uint64_t));
+    }
+    mapFileWriterPad(writer);
+    writer->offsets[writer->numMaps++] = writer->offset;
+
+    const mapFileRecord record = {
+        .columns = map->columns,
+        .rows = map->rows,
+        .floatingStandardWalls = map->floatingStandardWalls,
+        .floatingBouncyWalls = map->floatingBouncyWalls,
+        .floatingDeathWalls = map->floatingDeathWalls,
+        .defaultWeapon = map->defaultWeapon,
+        .weaponPickups = map->weaponPickups,
+        .bounds = tmpl->bounds,
+    };
+    const uint16_t numCells = map->columns * map->rows;
+    fwrite(&record, sizeof(mapFileRecord), 1, writer->file);
+    fwrite(map->layout, sizeof(char), numCells, writer->file);
+    fwrite(tmpl->droneSpawnBlocked, sizeof(bool), numCells, writer->file);
+    writer->offset += mapRecordSize(map->columns, map->rows);
+}
+
+// writes the index and header and closes the file, returns false if
+// writing the file failed
+bool closeMapFileWriter(mapFileWriter *writer) {
+    mapFileWriterPad(writer);
+    mapFileHeader header = {
+        .version = MAP_FILE_VERSION,
+        .numMaps = writer->numMaps,
+        .indexOffset = writer->offset,
+    };
+    memcpy(header.magic, MAP_FILE_MAGIC, sizeof(MAP_FILE_MAGIC));
+    fwrite(writer->offsets, sizeof(uint64_t), writer->numMaps, writer->file);
+    fseek(writer->file, 0, SEEK_SET);
+    fwrite(&header, sizeof(mapFileHeader), 1, writer->file);
+
+    const bool ok = !ferror(writer->file);
+    fclose(writer->file);
+    fastFree(writer->offsets);
+    fastFree(writer);
+    return ok;
+}
+
+#endif
@@ -0,0 +1,274 @@
+#ifndef IMPULSE_WARS_MAPGEN_H
+#define IMPULSE_WARS_MAPGEN_H
+
+#include "helpers.h"
+#include "settings.h"
+#include "types.h"
+
+// Generates map layouts in the same format as the layouts of the
+// predefined maps from a seed and parameters. Generated maps are bordered
+// by static walls, every open cell can be reached from every other open
+// cell and there is always room to spawn every drone, floating wall and
+// weapon pickup, so findOpenPos can't fail while an episode is being set
+// up. The corners are kept clear so drones can spawn far apart, and if
+// the walls of a layout still leave too little room it's regenerated with
+// fewer walls.
+
+#define MAPGEN_MAX_ATTEMPTS 8
+// broadphase AABBs can be slightly larger than the shapes they bound
+#define MAPGEN_SPAWN_MARGIN 0.1f
+
+// returns how many cells away an entity with the given extent can be
+// from a cell and still overlap a spawn query of distance at that cell
+static inline uint8_t spawnReachCells(const float distance, const float extent) {
+    return (uint8_t)ceilf((distance + extent + MAPGEN_SPAWN_MARGIN) / WALL_THICKNESS) - 1;
+}
+
+static inline char mapGenWallCell(uint64_t *state, const mapGenParams *params) {
+    const float standard = params->standardWallWeight;
+    const float bouncy = params->bouncyWallWeight;
+    const float r = randFloat(state, 0.0f, standard + bouncy + params->deathWallWeight);
+    if (r < standard || (bouncy == 0.0f && params->deathWallWeight == 0.0f)) {
+        return 'W';
+    }
+    if (r < standard + bouncy || params->deathWallWeight == 0.0f) {
+        return 'B';
+    }
+    return 'D';
+}
+
+// returns the lowest index of the cells the map's symmetry maps the cell
+// to, only those cells are generated and the rest are copied from them
+static inline uint16_t mapGenSourceCell(const mapGenParams *params, const uint8_t col, const uint8_t row) {
+    const uint8_t mirroredCol = params->columns - 1 - col;
+    const uint8_t mirroredRow = params->rows - 1 - row;
+    const uint8_t minCol = col < mirroredCol ? col : mirroredCol;
+    const uint8_t minRow = row < mirroredRow ? row : mirroredRow;
+
+    switch (params->symmetry) {
+    case NO_SYMMETRY:
+        return col + (row * params->columns);
+    case MIRROR_SYMMETRY:
+        return minCol + (row * params->columns);
+    case QUAD_SYMMETRY:
+        return minCol + (minRow * params->columns);
+    case ROTATIONAL_SYMMETRY: {
+        const uint16_t cellIdx = col + (row * params->columns);
+        const uint16_t rotatedIdx = mirroredCol + (mirroredRow * params->columns);
+        return cellIdx < rotatedIdx ? cellIdx : rotatedIdx;
+    }
+    default:
+        ERRORF("unknown map symmetry %d", params->symmetry);
+    }
+}
+
+// clears walls from the corners inside the border so there is room for
+// drones to spawn far apart from each other; all corners are cleared so
+// the map stays symmetric
+void mapGenClearCorners(const mapGenParams *params, char *layout) {
+    const uint8_t reach = spawnReachCells(DRONE_WALL_SPAWN_DISTANCE, WALL_THICKNESS / 2.0f);
+    const uint8_t size = (2 * reach) + 1;
+    if (params->columns < (2 * size) + 2 || params->rows < (2 * size) + 2) {
+        return;
+    }
+
+    const uint8_t cols[2] = {1, params->columns - 1 - size};
+    const uint8_t rows[2] = {1, params->rows - 1 - size};
+    for (uint8_t i = 0; i < 4; i++) {
+        for (uint8_t row = rows[i / 2]; row < rows[i / 2] + size; row++) {
+            for (uint8_t col = cols[i % 2]; col < cols[i % 2] + size; col++) {
+                layout[col + (row * params->columns)] = 'O';
+            }
+        }
+    }
+}
+
+// fills open cells that can't be reached from the largest open area
+// with walls so drones can't spawn somewhere they are stuck
+void mapGenFillUnreachable(const mapGenParams *params, char *layout) {
+    const uint8_t columns = params->columns;
+    const uint16_t numCells = columns * params->rows;
+
+    // 0 means the cell hasn't been visited
+    uint16_t areas[MAX_CELLS] = {0};
+    uint16_t stack[MAX_CELLS];
+    uint16_t largestArea = 0;
+    uint16_t largestAreaSize = 0;
+    uint16_t numAreas = 0;
+
+    for (uint16_t start = 0; start < numCells; start++) {
+        if (layout[start] != 'O' || areas[start] != 0) {
+            continue;
+        }
+        const uint16_t area = ++numAreas;
+        uint16_t areaSize = 0;
+        uint16_t stackSize = 0;
+        areas[start] = area;
+        stack[stackSize++] = start;
+
+        while (stackSize != 0) {
+            const uint16_t cellIdx = stack[--stackSize];
+            areaSize++;
+
+            const uint8_t col = cellIdx % columns;
+            const uint16_t neighbors[4] = {cellIdx - 1, cellIdx + 1, cellIdx - columns, cellIdx + columns};
+            const bool valid[4] = {col != 0, col != columns - 1, cellIdx >= columns, cellIdx + columns < numCells};
+            for (uint8_t i = 0; i < 4; i++) {
+                if (!valid[i] || layout[neighbors[i]] != 'O' || areas[neighbors[i]] != 0) {
+                    continue;
+                }
+                areas[neighbors[i]] = area;
+                stack[stackSize++] = neighbors[i];
+            }
+        }
+
+        if (areaSize > largestAreaSize) {
+            largestArea = area;
+            largestAreaSize = areaSize;
+        }
+    }
+
+    for (uint16_t i = 0; i < numCells; i++) {
+        if (layout[i] == 'O' && areas[i] != largestArea) {
+            layout[i] = 'W';
+        }
+    }
+}
+
+// greedily picks candidate cells that are at least spacing cells apart
+// from each other in some direction, returns how many were picked,
+// stopping once needed cells are picked
+uint16_t mapGenSpreadCells(const mapGenParams *params, const bool *candidates, const uint8_t spacing, const uint16_t needed) {
+    const uint16_t numCells = params->columns * params->rows;
+    uint8_t pickedCols[MAX_CELLS];
+    uint8_t pickedRows[MAX_CELLS];
+    uint16_t numPicked = 0;
+
+    for (uint16_t i = 0; i < numCells && numPicked < needed; i++) {
+        if (!candidates[i]) {
+            continue;
+        }
+        const uint8_t col = i % params->columns;
+        const uint8_t row = i / params->columns;
+        bool tooClose = false;
+        for (uint16_t j = 0; j < numPicked; j++) {
+            if (abs(col - pickedCols[j]) < spacing && abs(row - pickedRows[j]) < spacing) {
+                tooClose = true;
+                break;
+            }
+        }
+        if (tooClose) {
+            continue;
+        }
+        pickedCols[numPicked] = col;
+        pickedRows[numPicked] = row;
+        numPicked++;
+    }
+
+    return numPicked;
+}
+
+// returns true if every entity spawned when an episode is set up will
+// find an open position. If there are n cells so far apart that a
+// spawned entity can only block one of them, the first n - 1 spawns
+// can't block all of them no matter where they are placed
+bool mapGenCanSpawn(const mapGenParams *params, const char *layout) {
+    const uint8_t columns = params->columns;
+    const uint8_t rows = params->rows;
+    const uint16_t numCells = columns * rows;
+
+    bool open[MAX_CELLS];
+    bool droneOpen[MAX_CELLS];
+    const int wallReach = spawnReachCells(DRONE_WALL_SPAWN_DISTANCE, WALL_THICKNESS / 2.0f);
+    for (uint16_t i = 0; i < numCells; i++) {
+        open[i] = layout[i] == 'O';
+        droneOpen[i] = open[i];
+        if (!open[i]) {
+            continue;
+        }
+
+        // drones can't spawn near static walls
+        const int col = i % columns;
+        const int row = i / columns;
+        for (int r = row - wallReach; r <= row + wallReach && droneOpen[i]; r++) {
+            for (int c = col - wallReach; c <= col + wallReach; c++) {
+                if (r < 0 || r >= rows || c < 0 || c >= columns) {
+                    continue;
+                }
+                if (layout[c + (r * columns)] != 'O') {
+                    droneOpen[i] = false;
+                    break;
+                }
+            }
+        }
+    }
+
+    const uint8_t droneReach = spawnReachCells(DRONE_DRONE_SPAWN_DISTANCE, DRONE_RADIUS);
+    if (mapGenSpreadCells(params, droneOpen, (2 * droneReach) + 1, params->numDrones) < params->numDrones) {
+        return false;
+    }
+
+    const float maxExtent = fmaxf(fmaxf(FLOATING_WALL_THICKNESS, PICKUP_THICKNESS) / 2.0f, DRONE_RADIUS);
+    const uint8_t reach = spawnReachCells(MIN_SPAWN_DISTANCE, maxExtent);
+    const uint16_t spawns = params->numDrones + params->floatingStandardWalls + params->floatingBouncyWalls + params->floatingDeathWalls + params->weaponPickups;
+    return mapGenSpreadCells(params, open, (2 * reach) + 1, spawns) == spawns;
+}
+
+// returns true if maps generated from params can always spawn every
+// entity, which is the case if a map with only the border does as that
+// is what the last attempt of generateMapLayout falls back to
+bool mapGenParamsFeasible(const mapGenParams *params) {
+    ASSERT(params->columns <= MAX_MAP_COLUMNS && params->rows <= MAX_MAP_ROWS);
+    char layout[MAX_CELLS];
+    for (uint8_t row = 0; row < params->rows; row++) {
+        for (uint8_t col = 0; col < params->columns; col++) {
+            const bool border = row == 0 || row == params->rows - 1 || col == 0 || col == params->columns - 1;
+            layout[col + (row * params->columns)] = border ? 'W' : 'O';
+        }
+    }
+    return mapGenCanSpawn(params, layout);
+}
+
+// writes the layout of the map generated from params and seed to layout
+void generateMapLayout(const mapGenParams *params, const uint64_t seed, char *layout) {
+    ASSERT(params->columns <= MAX_MAP_COLUMNS && params->rows <= MAX_MAP_ROWS);
+    uint64_t state = seed;
+
+    for (uint8_t attempt = 0; attempt < MAPGEN_MAX_ATTEMPTS; attempt++) {
+        // thin out the walls every failed attempt, the last attempt only
+        // has the border
+        const float density = params->wallDensity * (float)(MAPGEN_MAX_ATTEMPTS - 1 - attempt) / (float)(MAPGEN_MAX_ATTEMPTS - 1);
+        const char borderWall = mapGenWallCell(&state, params);
+
+        for (uint8_t row = 0; row < params->rows; row++) {
+            for (uint8_t col = 0; col < params->columns; col++) {
+                const uint16_t cellIdx = col + (row * params->columns);
+                if (row == 0 || row == params->rows - 1 || col == 0 || col == params->columns - 1) {
+                    layout[cellIdx] = borderWall;
+                    continue;
+                }
+                const uint16_t sourceIdx = mapGenSourceCell(params, col, row);
+                if (sourceIdx != cellIdx) {
+                    layout[cellIdx] = layout[sourceIdx];
+                    continue;
+                }
+
+                layout[cellIdx] = 'O';
+                if (randFloat(&state, 0.0f, 1.0f) < density) {
+                    layout[cellIdx] = mapGenWallCell(&state, params);
+                }
+            }
+        }
+
+        mapGenClearCorners(params, layout);
+        mapGenFillUnreachable(params, layout);
+        if (mapGenCanSpawn(params, layout)) {
+            return;
+        }
+        DEBUG_LOGF("generated map with wall density %f has no room to spawn, retrying", density);
+    }
+
+    ERRORF("%dx%d maps have no room to spawn %d drones, %d floating walls and %d weapon pickups", params->columns, params->rows, params->numDrones, params->floatingStandardWalls + params->floatingBouncyWalls + params->floatingDeathWalls, params->weaponPickups);
+}
+
+#endif
@@ -0,0 +1,215 @@
+#ifndef IMPULSE_WARS_RASTER_H
+#define IMPULSE_WARS_RASTER_H
+
+#include "game.h"
+#include "helpers.h"
+#include "settings.h"
+#include "types.h"
+
+// A scanline rasterizer that draws entities into the channels of pixel
+// obs without raylib or a GPU. Channels are single byte images stored
+// row by row, so every shape is drawn as one contiguous span per row
+// that is filled with memset, which is vectorized. Pixels are filled if
+// their centers are inside a shape, shapes smaller than a pixel fill the
+// pixel their center is in so small projectiles aren't lost.
+//
+// Pixel obs cover the same area as the map obs, centered on the middle
+// of the map.
+
+#define PIXELS_PER_X ((float)_PIXEL_OBS_RES / (_OBS_MAP_COLUMNS * WALL_THICKNESS))
+#define PIXELS_PER_Y ((float)_PIXEL_OBS_RES / (_OBS_MAP_ROWS * WALL_THICKNESS))
+
+static inline float worldToPixelX(const float x) {
+    return (x + ((_OBS_MAP_COLUMNS * WALL_THICKNESS) / 2.0f)) * PIXELS_PER_X;
+}
+
+static inline float worldToPixelY(const float y) {
+    return (y + ((_OBS_MAP_ROWS * WALL_THICKNESS) / 2.0f)) * PIXELS_PER_Y;
+}
+
+// finds the pixels whose centers are in [start, end], returns false if
+// there are none
+static inline bool pixelSpan(const float start, const float end, int *first, int *last) {
+    *first = (int)ceilf(start - 0.5f);
+    *last = (int)floorf(end - 0.5f);
+    if (*first < 0) {
+        *first = 0;
+    }
+    if (*last > PIXEL_OBS_RES - 1) {
+        *last = PIXEL_OBS_RES - 1;
+    }
+    return *first <= *last;
+}
+
+static inline void rasterPixel(uint8_t *channel, const float x, const float y, const uint8_t value) {
+    const int px = (int)floorf(x);
+    const int py = (int)floorf(y);
+    if (px < 0 || px >= PIXEL_OBS_RES || py < 0 || py >= PIXEL_OBS_RES) {
+        return;
+    }
+    channel[(py * PIXEL_OBS_RES) + px] = value;
+}
+
+// fills the pixels of a row whose centers are in [start, end], returns
+// false if there are none
+static inline bool rasterSpan(uint8_t *channel, const int row, const float start, const float end, const uint8_t value) {
+    int first, last;
+    if (!pixelSpan(start, end, &first, &last)) {
+        return false;
+    }
+    memset(channel + (row * PIXEL_OBS_RES) + first, value, (last - first + 1) * sizeof(uint8_t));
+    return true;
+}
+
+// draws an axis aligned rectangle centered at pos
+void rasterRect(uint8_t *channel, const b2Vec2 pos, const b2Vec2 extent, const uint8_t value) {
+    const float x = worldToPixelX(pos.x);
+    const float y = worldToPixelY(pos.y);
+    const float halfWidth = extent.x * PIXELS_PER_X;
+    const float halfHeight = extent.y * PIXELS_PER_Y;
+
+    int firstRow, lastRow, firstCol, lastCol;
+    if (!pixelSpan(y - halfHeight, y + halfHeight, &firstRow, &lastRow) || !pixelSpan(x - halfWidth, x + halfWidth, &firstCol, &lastCol)) {
+        rasterPixel(channel, x, y, value);
+        return;
+    }
+    for (int row = firstRow; row <= lastRow; row++) {
+        memset(channel + (row * PIXEL_OBS_RES) + firstCol, value, (lastCol - firstCol + 1) * sizeof(uint8_t));
+    }
+}
+
+void rasterCircle(uint8_t *channel, const b2Vec2 pos, const float radius, const uint8_t value) {
+    const float x = worldToPixelX(pos.x);
+    const float y = worldToPixelY(pos.y);
+    const float radiusX = radius * PIXELS_PER_X;
+    const float radiusY = radius * PIXELS_PER_Y;
+
+    int firstRow, lastRow;
+    bool filled = false;
+    if (pixelSpan(y - radiusY, y + radiusY, &firstRow, &lastRow)) {
+        for (int row = firstRow; row <= lastRow; row++) {
+            const float dy = (row + 0.5f - y) / radiusY;
+            const float halfWidth = radiusX * sqrtf(fmaxf(1.0f - (dy * dy), 0.0f));
+            filled |= rasterSpan(channel, row, x - halfWidth, x + halfWidth, value);
+        }
+    }
+    if (!filled) {
+        rasterPixel(channel, x, y, value);
+    }
+}
+
+// draws a square rotated by rot centered at pos, every row of a convex
+// polygon is a single span between its leftmost and rightmost edges
+void rasterRotatedSquare(uint8_t *channel, const b2Vec2 pos, const float halfSize, const b2Rot rot, const uint8_t value) {
+    const b2Vec2 corners[4] = {
+        {.x = -halfSize, .y = -halfSize},
+        {.x = halfSize, .y = -halfSize},
+        {.x = halfSize, .y = halfSize},
+        {.x = -halfSize, .y = halfSize},
+    };
+    float xs[4];
+    float ys[4];
+    float minY = FLT_MAX;
+    float maxY = -FLT_MAX;
+    for (uint8_t i = 0; i < 4; i++) {
+        const b2Vec2 corner = b2Add(pos, b2RotateVector(rot, corners[i]));
+        xs[i] = worldToPixelX(corner.x);
+        ys[i] = worldToPixelY(corner.y);
+        minY = fminf(minY, ys[i]);
+        maxY = fmaxf(maxY, ys[i]);
+    }
+
+    int firstRow, lastRow;
+    bool filled = false;
+    if (pixelSpan(minY, maxY, &firstRow, &lastRow)) {
+        for (int row = firstRow; row <= lastRow; row++) {
+            const float y = row + 0.5f;
+            float start = FLT_MAX;
+            float end = -FLT_MAX;
+            for (uint8_t i = 0; i < 4; i++) {
+                const uint8_t j = (i + 1) % 4;
+                if ((y < ys[i]) == (y < ys[j])) {
+                    continue;
+                }
+                const float x = xs[i] + ((y - ys[i]) * (xs[j] - xs[i]) / (ys[j] - ys[i]));
+                start = fminf(start, x);
+                end = fmaxf(end, x);
+            }
+            if (start <= end) {
+                filled |= rasterSpan(channel, row, start, end, value);
+            }
+        }
+    }
+    if (!filled) {
+        rasterPixel(channel, worldToPixelX(pos.x), worldToPixelY(pos.y), value);
+    }
+}
+
+// values of pixels of entities encode their type like the map obs does,
+// spread over the byte range
+static inline uint8_t wallPixel(const enum entityType type) {
+    return (type + 1) * (UINT8_MAX / NUM_WALL_TYPES);
+}
+
+static inline uint8_t weaponPixel(const enum weaponType type) {
+    return (type + 1) * (UINT8_MAX / NUM_WEAPONS);
+}
+
+// draws the static walls into the static wall channel
+void rasterStaticWalls(env *e, uint8_t *channel) {
+    memset(channel, 0x0, PIXEL_CHANNEL_SIZE * sizeof(uint8_t));
+    for (size_t i = 0; i < cc_array_size(e->walls); i++) {
+        const wallEntity *wall = safe_array_get_at(e->walls, i);
+        rasterRect(channel, b2Body_GetPosition(wall->bodyID), wall->extent, wallPixel(wall->type));
+    }
+}
+
+// draws the channels every agent sees the same, obs must hold
+// PIXEL_MAP_OBS_SIZE bytes
+void rasterSharedChannels(env *e, uint8_t *obs) {
+    uint8_t *walls = obs + (PIXEL_WALL_CHANNEL * PIXEL_CHANNEL_SIZE);
+    memcpy(walls, e->pixelWalls, PIXEL_CHANNEL_SIZE * sizeof(uint8_t));
+    for (size_t i = 0; i < cc_array_size(e->floatingWalls); i++) {
+        wallEntity *wall = safe_array_get_at(e->floatingWalls, i);
+        const b2Vec2 pos = getCachedPos(wall->bodyID, &wall->pos);
+        rasterRotatedSquare(walls, pos, wall->extent.x, b2Body_GetRotation(wall->bodyID), wallPixel(wall->type));
+    }
+
+    uint8_t *pickups = obs + (PIXEL_PICKUP_CHANNEL * PIXEL_CHANNEL_SIZE);
+    memset(pickups, 0x0, PIXEL_CHANNEL_SIZE * sizeof(uint8_t));
+    for (size_t i = 0; i < cc_array_size(e->pickups); i++) {
+        const weaponPickupEntity *pickup = safe_array_get_at(e->pickups, i);
+        if (pickup->respawnWait != 0.0f || pickup->floatingWallsTouching != 0) {
+            continue;
+        }
+        const b2Vec2 extent = {.x = PICKUP_THICKNESS / 2.0f, .y = PICKUP_THICKNESS / 2.0f};
+        rasterRect(pickups, e->cells.positions[pickup->mapCellIdx], extent, weaponPixel(pickup->weapon));
+    }
+
+    uint8_t *projectiles = obs + (PIXEL_PROJECTILE_CHANNEL * PIXEL_CHANNEL_SIZE);
+    memset(projectiles, 0x0, PIXEL_CHANNEL_SIZE * sizeof(uint8_t));
+    for (SNode *cur = e->projectiles->head; cur != NULL; cur = cur->next) {
+        const projectileEntity *projectile = (projectileEntity *)cur->data;
+        rasterCircle(projectiles, projectile->lastPos, projectile->weaponInfo->radius, weaponPixel(projectile->weaponInfo->type));
+    }
+}
+
+// draws the agent's drone and the other drones into their channels
+void rasterDroneChannels(env *e, const uint8_t droneIdx, uint8_t *obs) {
+    uint8_t *drones[2] = {
+        obs + (PIXEL_DRONE_CHANNEL * PIXEL_CHANNEL_SIZE),
+        obs + (PIXEL_ENEMY_CHANNEL * PIXEL_CHANNEL_SIZE),
+    };
+    memset(drones[0], 0x0, PIXEL_CHANNEL_SIZE * sizeof(uint8_t));
+    memset(drones[1], 0x0, PIXEL_CHANNEL_SIZE * sizeof(uint8_t));
+    for (uint8_t i = 0; i < e->numDrones; i++) {
+        droneEntity *drone = &e->drones[i];
+        if (drone->dead) {
+            continue;
+        }
+        const b2Vec2 pos = getCachedPos(drone->bodyID, &drone->pos);
+        rasterCircle(drones[i != droneIdx], pos, DRONE_RADIUS, weaponPixel(drone->weaponInfo->type));
+    }
+}
+
+#endif
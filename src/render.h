@@ -5,6 +5,7 @@
 
 #include "env.h"
 #include "helpers.h"
+#include "video.h"
 
 const float DEFAULT_SCALE = 11.0f;
 const int DEFAULT_WIDTH = 1500;
@@ -32,32 +33,52 @@ static inline b2Vec2 rayVecToB2Vec(const rayClient *c, const Vector2 v) {
     return (b2Vec2){.x = (v.x - c->halfWidth) / c->scale, .y = ((v.y - c->halfHeight - (2 * c->scale)) / c->scale)};
 }
 
+static inline void setClientSize(rayClient *client, const uint16_t width, const uint16_t height) {
+    client->width = width;
+    client->height = height;
+    client->scale = (float)client->height * (float)(DEFAULT_SCALE / DEFAULT_HEIGHT);
+
+    client->halfWidth = client->width / 2.0f;
+    client->halfHeight = client->height / 2.0f;
+}
+
 rayClient *createRayClient() {
     InitWindow(DEFAULT_WIDTH, DEFAULT_HEIGHT, "Impulse Wars");
     const int monitor = GetCurrentMonitor();
 
     rayClient *client = (rayClient *)fastCalloc(1, sizeof(rayClient));
 
-    if (client->height == 0) {
-        client->height = GetMonitorHeight(monitor) - HEIGHT_LEEWAY;
-    }
-    if (client->width == 0) {
-        client->width = (uint16_t)((float)GetMonitorWidth(monitor) * ((float)DEFAULT_HEIGHT / (float)DEFAULT_WIDTH));
-    }
-    client->scale = (float)client->height * (float)(DEFAULT_SCALE / DEFAULT_HEIGHT);
-
-    client->halfWidth = client->width / 2.0f;
-    client->halfHeight = client->height / 2.0f;
+    const uint16_t height = GetMonitorHeight(monitor) - HEIGHT_LEEWAY;
+    const uint16_t width = (uint16_t)((float)GetMonitorWidth(monitor) * ((float)DEFAULT_HEIGHT / (float)DEFAULT_WIDTH));
+    setClientSize(client, width, height);
 
     SetConfigFlags(FLAG_MSAA_4X_HINT);
     SetWindowSize(client->width, client->height);
 
     SetTargetFPS(FRAME_RATE);
 
+    client->staticLayer.texture = LoadRenderTexture(client->width, client->height);
+
+    return client;
+}
+
+// creates a client with a hidden window that envs can only be rendered
+// offscreen with, used to record videos without a display
+rayClient *createHeadlessRayClient() {
+    SetConfigFlags(FLAG_WINDOW_HIDDEN);
+    InitWindow(DEFAULT_WIDTH, DEFAULT_HEIGHT, "Impulse Wars");
+
+    rayClient *client = (rayClient *)fastCalloc(1, sizeof(rayClient));
+    client->headless = true;
+    setClientSize(client, DEFAULT_WIDTH, DEFAULT_HEIGHT);
+
+    client->staticLayer.texture = LoadRenderTexture(client->width, client->height);
+
     return client;
 }
 
 void destroyRayClient(rayClient *client) {
+    UnloadRenderTexture(client->staticLayer.texture);
     CloseWindow();
     fastFree(client);
 }
@@ -93,21 +114,22 @@ void renderEmptyCell(const env *e, const b2Vec2 emptyCell, const size_t idx) {
     DrawText(idxStr, rec.x, rec.y, 1.5f * e->client->scale, WHITE);
 }
 
-void renderWall(const env *e, const wallEntity *wall) {
-    Color color = {0};
-    switch (wall->type) {
+Color getWallColor(const enum entityType type) {
+    switch (type) {
     case STANDARD_WALL_ENTITY:
-        color = BLUE;
-        break;
+        return BLUE;
     case BOUNCY_WALL_ENTITY:
-        color = YELLOW;
-        break;
+        return YELLOW;
     case DEATH_WALL_ENTITY:
-        color = RED;
-        break;
+        return RED;
     default:
-        ERRORF("unknown wall type %d", wall->type);
+        ERRORF("unknown wall type %d", type);
+        return WHITE;
     }
+}
+
+void renderWall(const env *e, const wallEntity *wall) {
+    const Color color = getWallColor(wall->type);
 
     b2Vec2 wallPos = b2Body_GetPosition(wall->bodyID);
     Vector2 pos = b2VecToRayVec(e->client, wallPos);
@@ -208,7 +230,7 @@ void renderDroneGuides(const env *e, const droneEntity *drone, const int droneId
     const b2Vec2 translation = b2Sub(rayEnd, pos);
     const b2QueryFilter filter = {.categoryBits = PROJECTILE_SHAPE, .maskBits = WALL_SHAPE | FLOATING_WALL_SHAPE | DRONE_SHAPE};
     const b2RayResult rayRes = b2World_CastRayClosest(e->worldID, pos, translation, filter);
-    const entity *ent = (entity *)b2Shape_GetUserData(rayRes.shapeId);
+    const entity *ent = shapeEntity(e, rayRes.shapeId);
 
     b2SimplexCache cache = {0};
     bool shapeIsCircle = false;
@@ -322,33 +344,65 @@ void renderProjectiles(env *e) {
     }
 }
 
-void renderEnv(env *e) {
-    BeginDrawing();
+// draws the env's static walls into the static layer if they changed
+// since it was last drawn or it was last drawn for a different env
+void updateStaticLayer(env *e, staticLayer *layer) {
+    if (layer->env == e && layer->wallsVersion == e->staticWallsVersion) {
+        return;
+    }
+
+    BeginTextureMode(layer->texture);
+    ClearBackground(BLANK);
+
+    for (size_t i = 0; i < cc_array_size(e->walls); i++) {
+        const wallEntity *wall = safe_array_get_at(e->walls, i);
+        renderWall(e, wall);
+    }
+
+    // for (uint16_t i = 0; i < e->cells.count; i++)
+    // {
+    //     if (e->cells.entities[i] == NULL_ENTITY_HANDLE)
+    //     {
+    //         renderEmptyCell(e->cells.positions[i], i);
+    //     }
+    // }
+
+    EndTextureMode();
+
+    layer->env = e;
+    layer->wallsVersion = e->staticWallsVersion;
+}
 
+// render textures are stored flipped vertically
+static inline void drawRenderTexture(const RenderTexture2D *target) {
+    const Texture2D texture = target->texture;
+    const Rectangle rec = {.x = 0.0f, .y = 0.0f, .width = texture.width, .height = -texture.height};
+    DrawTextureRec(texture, rec, (Vector2){.x = 0.0f, .y = 0.0f}, WHITE);
+}
+
+// draws a frame of the env to the current render target
+void renderFrame(env *e, const staticLayer *layer) {
     ClearBackground(BLACK);
     DrawFPS(e->client->scale, e->client->scale);
 
     renderUI(e);
 
     for (uint8_t i = 0; i < e->numDrones; i++) {
-        const droneEntity *drone = safe_array_get_at(e->drones, i);
+        const droneEntity *drone = &e->drones[i];
         if (drone->dead) {
             continue;
         }
         renderDroneGuides(e, drone, i);
     }
     for (uint8_t i = 0; i < e->numDrones; i++) {
-        const droneEntity *drone = safe_array_get_at(e->drones, i);
+        const droneEntity *drone = &e->drones[i];
         if (drone->dead) {
             continue;
         }
         renderDrone(e, drone, i);
     }
 
-    for (size_t i = 0; i < cc_array_size(e->walls); i++) {
-        const wallEntity *wall = safe_array_get_at(e->walls, i);
-        renderWall(e, wall);
-    }
+    drawRenderTexture(&layer->texture);
 
     for (size_t i = 0; i < cc_array_size(e->floatingWalls); i++) {
         const wallEntity *wall = safe_array_get_at(e->floatingWalls, i);
@@ -363,24 +417,37 @@ void renderEnv(env *e) {
     renderProjectiles(e);
 
     for (uint8_t i = 0; i < e->numDrones; i++) {
-        const droneEntity *drone = safe_array_get_at(e->drones, i);
+        const droneEntity *drone = &e->drones[i];
         if (drone->dead) {
             continue;
         }
         renderDroneLabels(e, drone);
     }
+}
 
-    // for (size_t i = 0; i < cc_array_size(e->cells); i++)
-    // {
-    //     mapCell *cell;
-    //     cc_array_get_at(e->cells, i, (void **)&cell);
-    //     if (cell->ent == NULL)
-    //     {
-    //         renderEmptyCell(cell->pos, i);
-    //     }
-    // }
+void renderEnv(env *e) {
+    videoRecorder *recorder = e->videoRecorder;
+    if (recorder == NULL) {
+        updateStaticLayer(e, &e->client->staticLayer);
+        BeginDrawing();
+        renderFrame(e, &e->client->staticLayer);
+        EndDrawing();
+        return;
+    }
 
-    EndDrawing();
+    // recorded envs are rendered offscreen, and shown in the window if
+    // there is one
+    updateStaticLayer(e, &recorder->staticLayer);
+    BeginTextureMode(recorder->frame);
+    renderFrame(e, &recorder->staticLayer);
+    EndTextureMode();
+    recordVideoFrame(recorder);
+
+    if (!e->client->headless) {
+        BeginDrawing();
+        drawRenderTexture(&recorder->frame);
+        EndDrawing();
+    }
 }
 
 #endif
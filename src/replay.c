@@ -0,0 +1,46 @@
+#include "env.h"
+#include "render.h"
+
+// renders a recorded replay file, re-simulating every step
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s REPLAY_FILE\n", argv[0]);
+        return 1;
+    }
+
+    replayReader *reader = openReplay(argv[1]);
+    if (reader == NULL) {
+        fprintf(stderr, "failed to open replay file %s\n", argv[1]);
+        return 1;
+    }
+    const uint8_t numDrones = reader->header.numDrones;
+    const uint8_t numAgents = reader->header.numAgents;
+
+    env *e = (env *)fastCalloc(1, sizeof(env));
+    uint8_t *obs = (uint8_t *)fastCalloc(numAgents * OBS_SIZE, sizeof(uint8_t));
+    float *rewards = (float *)fastCalloc(numAgents, sizeof(float));
+    int *actions = (int *)fastCalloc(numAgents * 4, sizeof(int));
+    uint8_t *terminals = (uint8_t *)fastCalloc(numAgents, sizeof(uint8_t));
+    statsAccumulator *logs = createStatsAccumulator(numDrones);
+
+    initEnv(e, numDrones, numAgents, obs, actions, rewards, terminals, logs, 0);
+
+    rayClient *client = createRayClient();
+    e->client = client;
+
+    while (!WindowShouldClose() && replayStep(reader, e)) {
+        renderEnv(e);
+    }
+
+    destroyEnv(e);
+    fastFree(obs);
+    fastFree(actions);
+    fastFree(rewards);
+    fastFree(terminals);
+    destroyStatsAccumulator(logs);
+    fastFree(e);
+    destroyRayClient(client);
+    closeReplay(reader);
+
+    return 0;
+}
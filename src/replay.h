@@ -0,0 +1,189 @@
+#ifndef IMPULSE_WARS_REPLAY_H
+#define IMPULSE_WARS_REPLAY_H
+
+#include <stdio.h>
+
+#include "helpers.h"
+#include "settings.h"
+#include "types.h"
+
+// Replays store only what is needed to re-simulate an episode: the RNG
+// state the episode was set up with, which bots control the other drones
+// and the discrete actions of every agent and policy bot each step. The env is
+// deterministic given those, so observations, rewards and frames can be
+// regenerated from a replay on demand.
+//
+// Format, all values in native byte order:
+//   header: "IWRP", version (u8), numDrones (u8), numAgents (u8), reserved (u8)
+//   episode record: REPLAY_EPISODE_RECORD (u8), seed (u64), map index (u8),
+//                   bot type (u8) per drone
+//   step record: REPLAY_STEP_RECORD (u8), packed action (u16) per agent,
+//                followed by a packed action per policy bot
+//
+// Files are only ever appended to, so recording can be stopped and
+// resumed later with the same file as long as the env config matches.
+
+#define REPLAY_VERSION 2
+#define REPLAY_WRITE_BUFFER_SIZE (1 << 16)
+
+const char REPLAY_MAGIC[4] = {'I', 'W', 'R', 'P'};
+
+enum replayRecordType {
+    REPLAY_EPISODE_RECORD = 1,
+    REPLAY_STEP_RECORD = 2,
+};
+
+typedef struct replayHeader {
+    char magic[4];
+    uint8_t version;
+    uint8_t numDrones;
+    uint8_t numAgents;
+    uint8_t reserved;
+} replayHeader;
+
+typedef struct replayRecorder {
+    FILE *file;
+    uint8_t numDrones;
+    uint8_t numAgents;
+    // steps are only recorded once an episode was started, so steps of
+    // an episode that was in progress when recording began are skipped
+    bool started;
+} replayRecorder;
+
+typedef struct replayReader {
+    FILE *file;
+    replayHeader header;
+} replayReader;
+
+// out of range components are packed as the no-ops the env executed
+static inline uint16_t packAction(const int *actions) {
+    uint8_t components[_ACTION_COMPONENTS];
+    normalizeDiscreteAction(actions, components);
+    return components[0] + (AIM_ACTIONS * (components[1] + (BOOST_ACTIONS * (components[2] + (FIRE_ACTIONS * components[3])))));
+}
+
+static inline void unpackAction(uint16_t packed, int *actions) {
+    actions[0] = packed % AIM_ACTIONS;
+    packed /= AIM_ACTIONS;
+    actions[1] = packed % BOOST_ACTIONS;
+    packed /= BOOST_ACTIONS;
+    actions[2] = packed % FIRE_ACTIONS;
+    actions[3] = packed / FIRE_ACTIONS;
+}
+
+static inline bool replayHeaderValid(const replayHeader *header) {
+    return memcmp(header->magic, REPLAY_MAGIC, sizeof(REPLAY_MAGIC)) == 0 && header->version == REPLAY_VERSION;
+}
+
+// opens or creates a replay file for appending, returns NULL if the
+// file couldn't be opened or was recorded with a different env config
+replayRecorder *createReplayRecorder(const char *path, const uint8_t numDrones, const uint8_t numAgents) {
+    FILE *file = fopen(path, "a+b");
+    if (file == NULL) {
+        DEBUG_LOGF("failed to open replay file %s", path);
+        return NULL;
+    }
+    setvbuf(file, NULL, _IOFBF, REPLAY_WRITE_BUFFER_SIZE);
+
+    replayHeader header = {0};
+    if (fread(&header, sizeof(replayHeader), 1, file) == 1) {
+        if (!replayHeaderValid(&header) || header.numDrones != numDrones || header.numAgents != numAgents) {
+            DEBUG_LOGF("replay file %s has an incompatible header", path);
+            fclose(file);
+            return NULL;
+        }
+        // switching from reading to writing requires a seek
+        fseek(file, 0, SEEK_END);
+    } else {
+        fseek(file, 0, SEEK_END);
+        memcpy(header.magic, REPLAY_MAGIC, sizeof(REPLAY_MAGIC));
+        header.version = REPLAY_VERSION;
+        header.numDrones = numDrones;
+        header.numAgents = numAgents;
+        fwrite(&header, sizeof(replayHeader), 1, file);
+    }
+
+    replayRecorder *recorder = (replayRecorder *)fastCalloc(1, sizeof(replayRecorder));
+    recorder->file = file;
+    recorder->numDrones = numDrones;
+    recorder->numAgents = numAgents;
+    return recorder;
+}
+
+void destroyReplayRecorder(replayRecorder *recorder) {
+    fclose(recorder->file);
+    fastFree(recorder);
+}
+
+void recordEpisodeStart(replayRecorder *recorder, const uint64_t seed, const uint8_t mapIdx, const enum botType *botTypes) {
+    // maps may have been switched to generated or map file maps after
+    // recording started, episodes on them can't be replayed
+    if (mapIdx >= NUM_MAPS) {
+        recorder->started = false;
+        return;
+    }
+    const uint8_t type = REPLAY_EPISODE_RECORD;
+    fwrite(&type, sizeof(uint8_t), 1, recorder->file);
+    fwrite(&seed, sizeof(uint64_t), 1, recorder->file);
+    fwrite(&mapIdx, sizeof(uint8_t), 1, recorder->file);
+    for (uint8_t i = 0; i < recorder->numDrones; i++) {
+        const uint8_t botType = botTypes[i];
+        fwrite(&botType, sizeof(uint8_t), 1, recorder->file);
+    }
+    recorder->started = true;
+}
+
+// stops recording steps until the next episode is recorded, used when
+// the env changes mid-episode in ways the episode record doesn't capture
+void recordEpisodeEnd(replayRecorder *recorder) {
+    recorder->started = false;
+}
+
+// policy bots aren't deterministic given the env state like other bots
+// are, so their actions are recorded as well
+void recordStep(replayRecorder *recorder, const int *actions, const enum botType *botTypes, const int *botActions) {
+    if (!recorder->started) {
+        return;
+    }
+    uint8_t record[1 + (_MAX_DRONES * sizeof(uint16_t))];
+    record[0] = REPLAY_STEP_RECORD;
+    uint8_t numActions = 0;
+    for (uint8_t i = 0; i < recorder->numDrones; i++) {
+        uint16_t packed;
+        if (i < recorder->numAgents) {
+            packed = packAction(actions + (i * 4));
+        } else if (botTypes[i] == POLICY_BOT) {
+            packed = packAction(botActions + (i * 4));
+        } else {
+            continue;
+        }
+        memcpy(record + 1 + (numActions * sizeof(uint16_t)), &packed, sizeof(uint16_t));
+        numActions++;
+    }
+    fwrite(record, 1 + (numActions * sizeof(uint16_t)), 1, recorder->file);
+}
+
+replayReader *openReplay(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        DEBUG_LOGF("failed to open replay file %s", path);
+        return NULL;
+    }
+
+    replayReader *reader = (replayReader *)fastCalloc(1, sizeof(replayReader));
+    reader->file = file;
+    if (fread(&reader->header, sizeof(replayHeader), 1, file) != 1 || !replayHeaderValid(&reader->header)) {
+        DEBUG_LOGF("replay file %s has an invalid header", path);
+        fclose(file);
+        fastFree(reader);
+        return NULL;
+    }
+    return reader;
+}
+
+void closeReplay(replayReader *reader) {
+    fclose(reader->file);
+    fastFree(reader);
+}
+
+#endif
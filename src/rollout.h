@@ -0,0 +1,53 @@
+#ifndef IMPULSE_WARS_ROLLOUT_H
+#define IMPULSE_WARS_ROLLOUT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// Orders the trainer's rollout buffers for training. Steps are stored in
+// the order they were collected, so sorting them by env id with a stable
+// sort puts every env's steps together in the order they were taken. Env
+// ids are bounded by the number of agents, so a counting sort does it in
+// two passes without comparisons or allocating.
+
+// writes the indices of the numSteps stored steps sorted by env id to
+// sortedIdxs, and the steps of env i span [rowOffsets[i], rowOffsets[i + 1])
+// of them. Sorted steps are split into segments of bpttHorizon steps, the
+// segments are dealt out to numMinibatches minibatches in turn and
+// segmentIdxs holds the indices of each minibatch's steps. Returns false
+// if an env id isn't less than numEnvIds
+bool sortRolloutSteps(const int32_t *envIds, const uint32_t numSteps, const uint32_t numEnvIds, int64_t *rowOffsets, int64_t *sortedIdxs, int64_t *segmentIdxs, const uint32_t bpttHorizon, const uint32_t numMinibatches) {
+    memset(rowOffsets, 0x0, (numEnvIds + 1) * sizeof(int64_t));
+    for (uint32_t i = 0; i < numSteps; i++) {
+        const int32_t envId = envIds[i];
+        if (envId < 0 || (uint32_t)envId >= numEnvIds) {
+            return false;
+        }
+        rowOffsets[envId + 1]++;
+    }
+    for (uint32_t i = 0; i < numEnvIds; i++) {
+        rowOffsets[i + 1] += rowOffsets[i];
+    }
+
+    // each env's offset is advanced as its steps are placed, leaving it
+    // at the start of the next env's steps
+    const uint32_t minibatchRows = numSteps / (bpttHorizon * numMinibatches);
+    for (uint32_t i = 0; i < numSteps; i++) {
+        const int64_t pos = rowOffsets[envIds[i]]++;
+        sortedIdxs[pos] = i;
+
+        const uint32_t segment = pos / bpttHorizon;
+        const uint32_t row = segment / numMinibatches;
+        const uint32_t minibatch = segment % numMinibatches;
+        segmentIdxs[(((minibatch * minibatchRows) + row) * bpttHorizon) + (pos % bpttHorizon)] = i;
+    }
+    for (uint32_t i = numEnvIds; i > 0; i--) {
+        rowOffsets[i] = rowOffsets[i - 1];
+    }
+    rowOffsets[0] = 0;
+
+    return true;
+}
+
+#endif
@@ -0,0 +1,291 @@
+// memfd_create needs GNU extensions
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "env.h"
+#include "server.h"
+
+// dlmalloc leaks a macro named unlink
+#undef unlink
+
+// serves envs to learners in other processes, see server.h for the
+// protocol. Every session's envs are stepped on their own thread, so one
+// server can feed several learners
+
+#define SERVER_MAX_SESSIONS 64
+
+typedef struct serverSession {
+    int sock;
+    bool started;
+    int shmFd;
+    // the learner can write anything to the shared memory, so the
+    // session's layout is kept here and the header is never read back
+    serverShm *shm;
+    uint64_t size;
+    uint64_t statsOffset;
+    uint16_t numEnvs;
+    env *envs;
+    statsAccumulator *logs;
+    pthread_t thread;
+} serverSession;
+
+volatile sig_atomic_t stopServer = false;
+
+void handleStopSignal(int sig) {
+    (void)sig;
+    stopServer = true;
+}
+
+void *sessionThread(void *arg) {
+    serverSession *session = (serverSession *)arg;
+    serverShm *shm = session->shm;
+    uint8_t *shmData = (uint8_t *)shm;
+
+    uint32_t seq = 0;
+    while (waitForDoorbell(&shm->request, seq + 1, &shm->closed, -1)) {
+        seq++;
+        const uint32_t command = shm->command;
+        switch (command) {
+        case SERVER_STEP:
+            for (uint16_t i = 0; i < session->numEnvs; i++) {
+                stepEnv(&session->envs[i]);
+            }
+            break;
+        case SERVER_RESET:
+            for (uint16_t i = 0; i < session->numEnvs; i++) {
+                resetEnv(&session->envs[i]);
+            }
+            break;
+        case SERVER_LOG:
+            readAndClearStats(session->logs, (float *)(shmData + session->statsOffset));
+            break;
+        default:
+            DEBUG_LOGF("unknown server command %d", command);
+        }
+        ringDoorbell(&shm->response, seq);
+    }
+
+    return NULL;
+}
+
+bool validSessionRequest(const serverSessionRequest *req) {
+    return req->magic == SERVER_MAGIC && req->version == SERVER_VERSION && req->numEnvs != 0 && req->numDrones != 0 && req->numDrones <= MAX_DRONES && req->numAgents != 0 && req->numAgents <= req->numDrones;
+}
+
+// creates the shared memory and envs of a session and starts stepping
+// them, returns the status to reply with
+enum serverStatus startSession(serverSession *session, const serverSessionRequest *req) {
+    if (!validSessionRequest(req)) {
+        return SERVER_INVALID_REQUEST;
+    }
+
+    const uint32_t totalAgents = req->numEnvs * req->numAgents;
+    const uint32_t obsSize = req->pixelObs ? PIXEL_OBS_SIZE : OBS_SIZE;
+    const uint64_t obsOffset = serverAlign(sizeof(serverShm));
+    const uint64_t actionsOffset = serverAlign(obsOffset + ((uint64_t)totalAgents * obsSize));
+    const uint64_t rewardsOffset = serverAlign(actionsOffset + (totalAgents * ACTION_COMPONENTS * sizeof(int)));
+    const uint64_t terminalsOffset = serverAlign(rewardsOffset + (totalAgents * sizeof(float)));
+    const uint64_t statsOffset = serverAlign(terminalsOffset + (totalAgents * sizeof(uint8_t)));
+    const uint64_t size = serverAlign(statsOffset + (STATS_BUFFER_SIZE * sizeof(float)));
+
+    session->shmFd = memfd_create("impulse-wars-session", MFD_CLOEXEC);
+    if (session->shmFd == -1) {
+        DEBUG_LOG("failed to create session shared memory");
+        return SERVER_FAILED;
+    }
+    if (ftruncate(session->shmFd, size) != 0) {
+        DEBUG_LOG("failed to size session shared memory");
+        close(session->shmFd);
+        return SERVER_FAILED;
+    }
+    void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, session->shmFd, 0);
+    if (data == MAP_FAILED) {
+        DEBUG_LOG("failed to map session shared memory");
+        close(session->shmFd);
+        return SERVER_FAILED;
+    }
+
+    serverShm *shm = (serverShm *)data;
+    shm->magic = SERVER_MAGIC;
+    shm->version = SERVER_VERSION;
+    shm->numEnvs = req->numEnvs;
+    shm->numDrones = req->numDrones;
+    shm->numAgents = req->numAgents;
+    shm->obsSize = obsSize;
+    shm->obsOffset = obsOffset;
+    shm->actionsOffset = actionsOffset;
+    shm->rewardsOffset = rewardsOffset;
+    shm->terminalsOffset = terminalsOffset;
+    shm->statsOffset = statsOffset;
+    shm->size = size;
+    session->shm = shm;
+    session->size = size;
+    session->numEnvs = req->numEnvs;
+    session->statsOffset = statsOffset;
+
+    uint8_t *shmData = (uint8_t *)data;
+    session->logs = createStatsAccumulator(req->numDrones);
+    session->envs = (env *)fastCalloc(req->numEnvs, sizeof(env));
+    for (uint16_t i = 0; i < req->numEnvs; i++) {
+        const uint32_t agent = i * req->numAgents;
+        env *e = &session->envs[i];
+        initEnv(
+            e,
+            req->numDrones,
+            req->numAgents,
+            shmData + obsOffset + ((uint64_t)agent * obsSize),
+            (int *)(shmData + actionsOffset) + (agent * ACTION_COMPONENTS),
+            (float *)(shmData + rewardsOffset) + agent,
+            shmData + terminalsOffset + agent,
+            session->logs,
+            req->seed + i
+        );
+        envSetPixelObs(e, req->pixelObs);
+    }
+
+    if (pthread_create(&session->thread, NULL, sessionThread, session) != 0) {
+        ERROR("failed to start session thread");
+    }
+    session->started = true;
+    return SERVER_OK;
+}
+
+void sendSessionReply(serverSession *session, const enum serverStatus status) {
+    const serverSessionReply reply = {.status = status, .size = status == SERVER_OK ? session->size : 0};
+    struct iovec iov = {.iov_base = (void *)&reply, .iov_len = sizeof(reply)};
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1};
+
+    // the shared memory is sent with the reply
+    char control[CMSG_SPACE(sizeof(int))] = {0};
+    if (status == SERVER_OK) {
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &session->shmFd, sizeof(int));
+    }
+    if (sendmsg(session->sock, &msg, MSG_NOSIGNAL) == -1) {
+        DEBUG_LOG("failed to send session reply");
+    }
+}
+
+void closeSession(serverSession *session) {
+    if (session->started) {
+        atomic_store(&session->shm->closed, 1);
+        futexWake(&session->shm->request);
+        futexWake(&session->shm->response);
+        pthread_join(session->thread, NULL);
+
+        for (uint16_t i = 0; i < session->numEnvs; i++) {
+            destroyEnv(&session->envs[i]);
+        }
+        fastFree(session->envs);
+        destroyStatsAccumulator(session->logs);
+        munmap(session->shm, session->size);
+        close(session->shmFd);
+    }
+    close(session->sock);
+    *session = (serverSession){.sock = -1};
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s SOCKET_PATH\n", argv[0]);
+        return 1;
+    }
+    const char *path = argv[1];
+
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "socket path %s is too long\n", path);
+        return 1;
+    }
+    strcpy(addr.sun_path, path);
+
+    // message boundaries are kept so requests are never split
+    const int listenSock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    unlink(path);
+    if (listenSock == -1 || bind(listenSock, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listenSock, SERVER_MAX_SESSIONS) != 0) {
+        fprintf(stderr, "failed to listen on %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    signal(SIGINT, handleStopSignal);
+    signal(SIGTERM, handleStopSignal);
+
+    // the first poll entry is the listening socket, the rest are the
+    // sessions' sockets
+    serverSession sessions[SERVER_MAX_SESSIONS];
+    struct pollfd fds[SERVER_MAX_SESSIONS + 1];
+    fds[0] = (struct pollfd){.fd = listenSock, .events = POLLIN};
+    for (uint8_t i = 0; i < SERVER_MAX_SESSIONS; i++) {
+        sessions[i] = (serverSession){.sock = -1};
+        fds[i + 1] = (struct pollfd){.fd = -1, .events = POLLIN};
+    }
+
+    printf("serving envs on %s\n", path);
+    while (!stopServer) {
+        if (poll(fds, SERVER_MAX_SESSIONS + 1, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ERRORF("failed to poll sockets: %s", strerror(errno));
+        }
+
+        if ((fds[0].revents & POLLIN) != 0) {
+            const int sock = accept4(listenSock, NULL, NULL, SOCK_CLOEXEC);
+            uint8_t i = 0;
+            while (i < SERVER_MAX_SESSIONS && sessions[i].sock != -1) {
+                i++;
+            }
+            if (sock != -1 && i == SERVER_MAX_SESSIONS) {
+                DEBUG_LOG("too many sessions, rejecting learner");
+                close(sock);
+            } else if (sock != -1) {
+                sessions[i].sock = sock;
+                fds[i + 1].fd = sock;
+            }
+        }
+
+        for (uint8_t i = 0; i < SERVER_MAX_SESSIONS; i++) {
+            serverSession *session = &sessions[i];
+            if (session->sock == -1 || fds[i + 1].revents == 0) {
+                continue;
+            }
+
+            serverSessionRequest req = {0};
+            const ssize_t n = recv(session->sock, &req, sizeof(req), 0);
+            // learners only send a request once, anything else means
+            // the learner is done
+            if (n != sizeof(req) || session->started) {
+                closeSession(session);
+                fds[i + 1].fd = -1;
+                continue;
+            }
+            const enum serverStatus status = startSession(session, &req);
+            sendSessionReply(session, status);
+            if (status != SERVER_OK) {
+                closeSession(session);
+                fds[i + 1].fd = -1;
+            }
+        }
+    }
+
+    for (uint8_t i = 0; i < SERVER_MAX_SESSIONS; i++) {
+        if (sessions[i].sock != -1) {
+            closeSession(&sessions[i]);
+        }
+    }
+    close(listenSock);
+    unlink(path);
+
+    return 0;
+}
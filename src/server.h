@@ -0,0 +1,166 @@
+#ifndef IMPULSE_WARS_SERVER_H
+#define IMPULSE_WARS_SERVER_H
+
+#include <linux/futex.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "helpers.h"
+#include "settings.h"
+#include "types.h"
+
+// Env servers step envs in their own process for learners in other
+// processes, see server.c. Learners connect to the server's Unix socket
+// and send a serverSessionRequest, the server creates the requested envs
+// and replies with a serverSessionReply and the file descriptor of a
+// shared memory region that holds the session's buffers. The socket is
+// only used to set up the session and to tell the server the learner is
+// gone when it's closed.
+//
+// The region starts with a serverShm header followed by the obs,
+// actions, rewards, terminals and stats of every agent at the offsets in
+// the header. Commands are sent by writing the command and ringing the
+// request doorbell, which is a sequence number that is incremented and
+// woken with a futex; the server rings the response doorbell with the
+// same number once the command is done. Both sides spin for a bit before
+// sleeping on a doorbell as steps are usually quick.
+//
+// Every session is stepped on its own server thread, so sessions step
+// in parallel but share the server process. Box2D's world table isn't
+// thread safe, so creating and destroying worlds when envs reset is
+// serialized across sessions (see createEnvWorld), and sessions that
+// reset often contend on it. Sessions only use predefined maps, which
+// need no shared mutable state.
+//
+// Only Linux is supported as futexes and memfds are Linux specific.
+
+#define SERVER_MAGIC 0x53574d49
+#define SERVER_VERSION 1
+#define SERVER_CACHE_LINE 64
+#define SERVER_SPIN_ITERS 4096
+// sleeping on a doorbell wakes up this often to check if the session
+// was closed or the other side is gone
+#define SERVER_WAIT_TIMEOUT_NS 100000000
+
+enum serverCommand {
+    SERVER_STEP,
+    SERVER_RESET,
+    // copies the stats of finished episodes to the stats buffer and
+    // clears them
+    SERVER_LOG,
+};
+
+enum serverStatus {
+    SERVER_OK,
+    SERVER_INVALID_REQUEST,
+    SERVER_FAILED,
+};
+
+typedef struct serverSessionRequest {
+    uint32_t magic;
+    uint32_t version;
+    uint16_t numEnvs;
+    uint8_t numDrones;
+    uint8_t numAgents;
+    bool pixelObs;
+    uint64_t seed;
+} serverSessionRequest;
+
+typedef struct serverSessionReply {
+    int32_t status;
+    uint64_t size;
+} serverSessionReply;
+
+typedef struct serverShm {
+    uint32_t magic;
+    uint32_t version;
+    uint16_t numEnvs;
+    uint8_t numDrones;
+    // agents per env
+    uint8_t numAgents;
+    uint32_t obsSize;
+    uint64_t obsOffset;
+    uint64_t actionsOffset;
+    uint64_t rewardsOffset;
+    uint64_t terminalsOffset;
+    uint64_t statsOffset;
+    uint64_t size;
+
+    // the doorbells are on their own cache lines so ringing one doesn't
+    // invalidate the other
+    _Alignas(SERVER_CACHE_LINE) uint32_t command;
+    _Atomic uint32_t request;
+    _Alignas(SERVER_CACHE_LINE) _Atomic uint32_t response;
+    // set by the server when the session is closed
+    _Atomic uint32_t closed;
+} serverShm;
+
+static inline uint64_t serverAlign(const uint64_t offset) {
+    return (offset + SERVER_CACHE_LINE - 1) & ~(uint64_t)(SERVER_CACHE_LINE - 1);
+}
+
+// futexes aren't private as doorbells are shared between processes
+static inline void futexWait(_Atomic uint32_t *addr, const uint32_t value, const struct timespec *timeout) {
+    syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAIT, value, timeout, NULL, 0);
+}
+
+static inline void futexWake(_Atomic uint32_t *addr) {
+    syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+}
+
+// returns true if the other end of the session's socket was closed, which
+// is how learners notice the server died without closing the session
+static inline bool serverPeerGone(const int sock) {
+    struct pollfd fd = {.fd = sock, .events = POLLIN};
+    return poll(&fd, 1, 0) == 1 && (fd.revents & (POLLHUP | POLLERR | POLLNVAL)) != 0;
+}
+
+// waits until the doorbell is rung with seq, returns false if the
+// session was closed first or, if peerSock isn't -1, the other end of
+// peerSock is gone
+bool waitForDoorbell(_Atomic uint32_t *doorbell, const uint32_t seq, _Atomic uint32_t *closed, const int peerSock) {
+    for (uint16_t i = 0; i < SERVER_SPIN_ITERS; i++) {
+        if (atomic_load(doorbell) == seq) {
+            return true;
+        }
+    }
+
+    const struct timespec timeout = {.tv_sec = 0, .tv_nsec = SERVER_WAIT_TIMEOUT_NS};
+    while (true) {
+        const uint32_t value = atomic_load(doorbell);
+        if (value == seq) {
+            return true;
+        }
+        if (atomic_load(closed) != 0 || (peerSock != -1 && serverPeerGone(peerSock))) {
+            return false;
+        }
+        futexWait(doorbell, value, &timeout);
+    }
+}
+
+static inline void ringDoorbell(_Atomic uint32_t *doorbell, const uint32_t seq) {
+    atomic_store(doorbell, seq);
+    futexWake(doorbell);
+}
+
+// sends a command to the server without waiting for it, used by learners
+// to run commands on several sessions at once; returns the sequence number
+// to wait for
+uint32_t envServerSend(serverShm *shm, const uint32_t command) {
+    const uint32_t seq = atomic_load(&shm->request) + 1;
+    shm->command = command;
+    ringDoorbell(&shm->request, seq);
+    return seq;
+}
+
+// waits for the command sent with seq to be done, sock is the learner's
+// end of the session's socket; returns false if the server closed the
+// session or exited
+bool envServerWait(serverShm *shm, const uint32_t seq, const int sock) {
+    return waitForDoorbell(&shm->response, seq, &shm->closed, sock);
+}
+
+#endif
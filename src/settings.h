@@ -15,10 +15,6 @@
 
 #define FRAMESKIP 4
 
-#define _MAX_MAP_COLUMNS 21
-#define _MAX_MAP_ROWS 21
-#define MAX_CELLS _MAX_MAP_COLUMNS *_MAX_MAP_ROWS + 1
-
 #define MIN_SPAWN_DISTANCE 6.0f
 
 #define ROUND_STEPS 91.0f * FRAME_RATE
@@ -28,7 +24,17 @@ const uint8_t MAX_DRONES = _MAX_DRONES;
 
 #define EXPLOSION_STEPS 5
 
-const uint16_t LOG_BUFFER_SIZE = 1024;
+// quantiles estimated for every logged stat
+#ifndef AUTOPXD
+const float STAT_QUANTILES[_NUM_STAT_QUANTILES] = {0.1f, 0.5f, 0.9f};
+#endif
+const uint8_t NUM_STAT_QUANTILES = _NUM_STAT_QUANTILES;
+const uint8_t NUM_DRONE_STATS = _NUM_DRONE_STATS;
+const uint16_t NUM_LOG_STATS = _NUM_LOG_STATS;
+// mean, variance, min, max and quantiles of each stat
+const uint8_t STAT_FIELDS = 4 + _NUM_STAT_QUANTILES;
+// episode count followed by the fields of every stat
+const uint16_t STATS_BUFFER_SIZE = 1 + (_NUM_LOG_STATS * (4 + _NUM_STAT_QUANTILES));
 
 // env constants
 #define DEFAULT_LIVES 5
@@ -43,21 +49,59 @@ const uint16_t LOG_BUFFER_SIZE = 1024;
 // observation constants
 const uint8_t MAX_MAP_COLUMNS = _MAX_MAP_COLUMNS;
 const uint8_t MAX_MAP_ROWS = _MAX_MAP_ROWS;
+const uint8_t OBS_MAP_COLUMNS = _OBS_MAP_COLUMNS;
+const uint8_t OBS_MAP_ROWS = _OBS_MAP_ROWS;
 const uint8_t PROJECTILE_OBS_OFFSET = 2;
 const uint8_t FLOATING_WALL_OBS_OFFSET = PROJECTILE_OBS_OFFSET + 1;
 const uint8_t DRONE_OBS_OFFSET = FLOATING_WALL_OBS_OFFSET + 1;
 const uint8_t MAP_CELL_OBS_SIZE = DRONE_OBS_OFFSET + 1;
-const uint16_t MAP_OBS_SIZE = MAP_CELL_OBS_SIZE * MAX_MAP_COLUMNS * MAX_MAP_ROWS;
+const uint16_t MAP_OBS_SIZE = MAP_CELL_OBS_SIZE * OBS_MAP_COLUMNS * OBS_MAP_ROWS;
 const uint8_t DRONE_OBS_SIZE = 9;
 const uint8_t SCALAR_OBS_SIZE = DRONE_OBS_SIZE + NUM_WEAPONS;
 const uint16_t OBS_SIZE = MAP_OBS_SIZE + SCALAR_OBS_SIZE;
 
-#define MAX_X_POS 40.0f
-#define MAX_Y_POS 40.0f
+// pixel obs are images of PIXEL_OBS_CHANNELS channels stored one after
+// another, followed by the scalar obs
+const uint8_t PIXEL_OBS_RES = _PIXEL_OBS_RES;
+const uint8_t PIXEL_OBS_CHANNELS = _PIXEL_OBS_CHANNELS;
+const uint8_t PIXEL_WALL_CHANNEL = 0;
+const uint8_t PIXEL_PICKUP_CHANNEL = 1;
+const uint8_t PIXEL_PROJECTILE_CHANNEL = 2;
+const uint8_t PIXEL_DRONE_CHANNEL = 3;
+const uint8_t PIXEL_ENEMY_CHANNEL = 4;
+const uint16_t PIXEL_CHANNEL_SIZE = _PIXEL_OBS_RES * _PIXEL_OBS_RES;
+const uint32_t PIXEL_MAP_OBS_SIZE = _PIXEL_OBS_CHANNELS * _PIXEL_OBS_RES * _PIXEL_OBS_RES;
+const uint32_t PIXEL_OBS_SIZE = PIXEL_MAP_OBS_SIZE + SCALAR_OBS_SIZE;
+
+// the furthest a drone can be from the center of the biggest map that fits in the obs
+#define MAX_X_POS ((_OBS_MAP_COLUMNS - 1) * WALL_THICKNESS / 2.0f)
+#define MAX_Y_POS ((_OBS_MAP_ROWS - 1) * WALL_THICKNESS / 2.0f)
 #define MAX_SPEED 250.0f
 
 const uint8_t ACTION_SIZE = 28;
 
+// number of components of an action and the sizes of each component
+// of the MultiDiscrete action space
+#define _ACTION_COMPONENTS 4
+const uint8_t ACTION_COMPONENTS = _ACTION_COMPONENTS;
+#define _AIM_ACTIONS 17
+const uint8_t AIM_ACTIONS = _AIM_ACTIONS;
+#define _BOOST_ACTIONS 5
+const uint8_t BOOST_ACTIONS = _BOOST_ACTIONS;
+const uint8_t FIRE_ACTIONS = 2;
+#define _ROTATION_ACTIONS 4
+const uint8_t ROTATION_ACTIONS = _ROTATION_ACTIONS;
+
+// continuous policies' sampled actions are cast to ints so components may
+// be out of range, writes the components of an action with out of range
+// components replaced by their no-op
+static inline void normalizeDiscreteAction(const int *actions, uint8_t *components) {
+    components[0] = (unsigned)actions[0] < AIM_ACTIONS ? actions[0] : AIM_ACTIONS - 1;
+    components[1] = (unsigned)actions[1] < BOOST_ACTIONS ? actions[1] : 0;
+    components[2] = (unsigned)actions[2] < FIRE_ACTIONS ? actions[2] : 0;
+    components[3] = (unsigned)actions[3] < ROTATION_ACTIONS ? actions[3] : 0;
+}
+
 // wall settings
 #define WALL_THICKNESS 4.0f
 #define FLOATING_WALL_THICKNESS 3.0f
@@ -78,6 +122,20 @@ const uint8_t ACTION_SIZE = 28;
 #define DRONE_LINEAR_DAMPING 1.0f
 #define DRONE_MOVE_AIM_DIVISOR 10.0f
 
+// bot settings
+// how far ahead of enemies bots aim in seconds
+#define BOT_AIM_LEAD 0.15f
+// bots only shoot at enemies closer than this
+#define BOT_SHOOT_DISTANCE 45.0f
+// distance aim nearest and strafe bots try to keep from enemies
+#define BOT_PREFERRED_DISTANCE 20.0f
+#define BOT_DISTANCE_TOLERANCE 4.0f
+// frames strafe bots keep strafing in one direction
+#define BOT_STRAFE_FRAMES 45
+// projectiles that will pass closer than this within the horizon are dodged
+#define BOT_DODGE_DISTANCE 3.5f
+#define BOT_DODGE_HORIZON 0.75f
+
 // weapon projectile settings
 #define STANDARD_AMMO INFINITE
 #define STANDARD_PROJECTILES 1
@@ -0,0 +1,173 @@
+#ifndef IMPULSE_WARS_STATS_H
+#define IMPULSE_WARS_STATS_H
+
+#include "helpers.h"
+#include "settings.h"
+#include "types.h"
+
+#ifndef AUTOPXD
+_Static_assert(sizeof(droneStats) == _NUM_DRONE_STATS * sizeof(float), "droneStats must only contain floats");
+#endif
+
+statsAccumulator *createStatsAccumulator(const uint8_t numDrones) {
+    statsAccumulator *acc = (statsAccumulator *)fastCalloc(1, sizeof(statsAccumulator));
+    acc->numDrones = numDrones;
+    return acc;
+}
+
+void destroyStatsAccumulator(statsAccumulator *acc) {
+    fastFree(acc);
+}
+
+// count is the number of values added before this one
+static inline void quantileSketchAdd(quantileSketch *sketch, const float p, const uint32_t count, const float v) {
+    float *heights = sketch->heights;
+    float *positions = sketch->positions;
+
+    // keep the first values sorted, once there are enough of them
+    // they become the initial marker heights
+    if (count < _NUM_SKETCH_MARKERS) {
+        uint8_t i = count;
+        while (i > 0 && heights[i - 1] > v) {
+            heights[i] = heights[i - 1];
+            i--;
+        }
+        heights[i] = v;
+
+        if (count == _NUM_SKETCH_MARKERS - 1) {
+            for (uint8_t j = 0; j < _NUM_SKETCH_MARKERS; j++) {
+                positions[j] = j + 1;
+            }
+            sketch->desired[0] = 1.0f;
+            sketch->desired[1] = 1.0f + (2.0f * p);
+            sketch->desired[2] = 1.0f + (4.0f * p);
+            sketch->desired[3] = 3.0f + (2.0f * p);
+            sketch->desired[4] = 5.0f;
+        }
+        return;
+    }
+
+    // find the cell the value falls in, extending the extremes if needed
+    uint8_t k = 0;
+    if (v < heights[0]) {
+        heights[0] = v;
+    } else if (v >= heights[4]) {
+        heights[4] = v;
+        k = 3;
+    } else {
+        while (v >= heights[k + 1]) {
+            k++;
+        }
+    }
+
+    for (uint8_t i = k + 1; i < _NUM_SKETCH_MARKERS; i++) {
+        positions[i]++;
+    }
+    sketch->desired[1] += p / 2.0f;
+    sketch->desired[2] += p;
+    sketch->desired[3] += (1.0f + p) / 2.0f;
+    sketch->desired[4] += 1.0f;
+
+    // adjust the heights of the middle markers if they are off
+    // from their desired positions
+    for (uint8_t i = 1; i < _NUM_SKETCH_MARKERS - 1; i++) {
+        const float d = sketch->desired[i] - positions[i];
+        if ((d < 1.0f || positions[i + 1] - positions[i] <= 1.0f) && (d > -1.0f || positions[i - 1] - positions[i] >= -1.0f)) {
+            continue;
+        }
+
+        const float sign = d >= 0.0f ? 1.0f : -1.0f;
+        const float nextGap = positions[i + 1] - positions[i];
+        const float prevGap = positions[i] - positions[i - 1];
+        float height = heights[i] + (sign / (positions[i + 1] - positions[i - 1])) * (((prevGap + sign) * (heights[i + 1] - heights[i]) / nextGap) + ((nextGap - sign) * (heights[i] - heights[i - 1]) / prevGap));
+        if (height <= heights[i - 1] || height >= heights[i + 1]) {
+            // parabolic prediction is out of order, fall back to linear
+            const uint8_t j = i + (int8_t)sign;
+            height = heights[i] + sign * (heights[j] - heights[i]) / (positions[j] - positions[i]);
+        }
+        heights[i] = height;
+        positions[i] += sign;
+    }
+}
+
+static inline float quantileSketchValue(const quantileSketch *sketch, const float p, const uint32_t count) {
+    if (count == 0) {
+        return 0.0f;
+    }
+    // not enough values for the markers, the stored values are sorted
+    // so just pick the nearest rank
+    if (count < _NUM_SKETCH_MARKERS) {
+        return sketch->heights[(uint8_t)((p * (count - 1)) + 0.5f)];
+    }
+    return sketch->heights[2];
+}
+
+static inline void runningStatAdd(runningStat *stat, const uint32_t count, const float v) {
+    if (count == 0) {
+        stat->min = v;
+        stat->max = v;
+    } else {
+        stat->min = fminf(stat->min, v);
+        stat->max = fmaxf(stat->max, v);
+    }
+
+    const float delta = v - stat->mean;
+    stat->mean += delta / (float)(count + 1);
+    stat->m2 += delta * (v - stat->mean);
+
+    for (uint8_t i = 0; i < NUM_STAT_QUANTILES; i++) {
+        quantileSketchAdd(&stat->quantiles[i], STAT_QUANTILES[i], count, v);
+    }
+}
+
+// adds the stats of a finished episode, this is O(1) with respect to
+// the number of episodes accumulated. Every stat is added once; the old
+// log buffer summed distance stats once per weapon, so logged distances
+// are NUM_WEAPONS times smaller than those of runs logged with it
+void addEpisodeStats(statsAccumulator *acc, const float length, const droneStats *stats) {
+    runningStatAdd(&acc->stats[0], acc->count, length);
+
+    for (uint8_t i = 0; i < acc->numDrones; i++) {
+        const float *values = (const float *)&stats[i];
+        runningStat *droneRunningStats = &acc->stats[1 + (i * NUM_DRONE_STATS)];
+        for (uint8_t j = 0; j < NUM_DRONE_STATS; j++) {
+            runningStatAdd(&droneRunningStats[j], acc->count, values[j]);
+        }
+    }
+
+    acc->count++;
+}
+
+// writes the episode count followed by the mean, sample variance, min,
+// max and quantiles of every stat to out, which must hold
+// STATS_BUFFER_SIZE floats; stats of unused drones are zeroed
+void readAndClearStats(statsAccumulator *acc, float *out) {
+    memset(out, 0x0, STATS_BUFFER_SIZE * sizeof(float));
+    out[0] = acc->count;
+    if (acc->count == 0) {
+        return;
+    }
+
+    DEBUG_LOGF("reading stats, episodes: %d", acc->count);
+
+    const uint16_t numStats = 1 + (acc->numDrones * NUM_DRONE_STATS);
+    for (uint16_t i = 0; i < numStats; i++) {
+        const runningStat *stat = &acc->stats[i];
+        float *fields = out + 1 + (i * STAT_FIELDS);
+        fields[0] = stat->mean;
+        if (acc->count > 1) {
+            fields[1] = stat->m2 / (float)(acc->count - 1);
+        }
+        fields[2] = stat->min;
+        fields[3] = stat->max;
+        for (uint8_t j = 0; j < NUM_STAT_QUANTILES; j++) {
+            fields[4 + j] = quantileSketchValue(&stat->quantiles[j], STAT_QUANTILES[j], acc->count);
+        }
+    }
+
+    const uint8_t numDrones = acc->numDrones;
+    memset(acc, 0x0, sizeof(statsAccumulator));
+    acc->numDrones = numDrones;
+}
+
+#endif
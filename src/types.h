@@ -8,8 +8,36 @@
 
 #include "settings.h"
 
+#ifndef AUTOPXD
+#include "raylib.h"
+#endif
+
 #define _MAX_DRONES 4
 
+#define _MAX_MAP_COLUMNS 64
+#define _MAX_MAP_ROWS 64
+#define MAX_CELLS ((_MAX_MAP_COLUMNS * _MAX_MAP_ROWS) + 1)
+// the size of the map obs, maps smaller than it are centered in it;
+// can be set at build time to train on bigger maps
+#ifndef _OBS_MAP_COLUMNS
+#define _OBS_MAP_COLUMNS 21
+#endif
+#ifndef _OBS_MAP_ROWS
+#define _OBS_MAP_ROWS 21
+#endif
+#ifndef AUTOPXD
+_Static_assert(_OBS_MAP_COLUMNS <= _MAX_MAP_COLUMNS && _OBS_MAP_ROWS <= _MAX_MAP_ROWS, "the map obs is larger than the biggest map");
+#endif
+// the width and height of pixel obs, which cover the same area as the
+// map obs; can be set at build time
+#ifndef _PIXEL_OBS_RES
+#define _PIXEL_OBS_RES 64
+#endif
+#define _PIXEL_OBS_CHANNELS 5
+#ifndef AUTOPXD
+_Static_assert(_PIXEL_OBS_RES <= UINT8_MAX, "pixel obs can be at most 255 pixels wide");
+#endif
+
 const uint8_t NUM_WALL_TYPES = 3;
 
 enum entityType {
@@ -31,12 +59,30 @@ enum shapeCategory {
     DRONE_SHAPE = 16,
 };
 
-// general purpose entity object
+// handle to an entity in an env's entity table, stored as the user data
+// of the entity's shape; the low 16 bits are the index of the entity's
+// slot and the high 16 bits the generation of the slot when the handle
+// was created, so handles to destroyed entities can be detected
+typedef uint32_t entityHandle;
+
+#define NULL_ENTITY_HANDLE 0
+
+// general purpose entity object, a slot in an env's entity table
 typedef struct entity {
     enum entityType type;
     void *entity;
+    uint16_t generation;
+    // index of the next free slot if this slot is free
+    uint16_t nextFree;
 } entity;
 
+typedef struct entityTable {
+    entity *slots;
+    uint16_t size;
+    uint16_t capacity;
+    uint16_t freeHead;
+} entityTable;
+
 #define _NUM_WEAPONS 5
 const uint8_t NUM_WEAPONS = _NUM_WEAPONS;
 
@@ -59,17 +105,141 @@ typedef struct mapEntry {
     const enum weaponType defaultWeapon;
 } mapEntry;
 
-// a cell in the map; ent will be NULL if the cell is empty
-typedef struct mapCell {
-    entity *ent;
-    b2Vec2 pos;
-} mapCell;
+// the cells of the map as parallel arrays indexed by cell
+typedef struct mapCells {
+    uint16_t count;
+    // the entity type + 1 of the cell's static wall, or 0 if there isn't one
+    uint8_t wallTypes[MAX_CELLS];
+    // the weapon + 1 of the cell's weapon pickup, or 0 if there isn't one
+    uint8_t pickupWeapons[MAX_CELLS];
+    // NULL_ENTITY_HANDLE if the cell is empty
+    entityHandle entities[MAX_CELLS];
+    b2Vec2 positions[MAX_CELLS];
+    // set if a static wall of the map is too close to the cell for drones
+    // to spawn there, not updated by sudden death walls
+    bool droneSpawnBlocked[MAX_CELLS];
+} mapCells;
 
 typedef struct mapBounds {
     b2Vec2 min;
     b2Vec2 max;
 } mapBounds;
 
+#define _NUM_MAPS 5
+const uint8_t NUM_MAPS = _NUM_MAPS;
+// the map index of episodes played on generated maps
+#define GENERATED_MAP_IDX _NUM_MAPS
+// the map index of episodes played on maps from a map file
+#define LIBRARY_MAP_IDX (_NUM_MAPS + 1)
+
+enum mapSymmetry {
+    NO_SYMMETRY,
+    // mirrored left to right
+    MIRROR_SYMMETRY,
+    // mirrored left to right and top to bottom
+    QUAD_SYMMETRY,
+    // rotated 180 degrees
+    ROTATIONAL_SYMMETRY,
+};
+
+// parameters of procedurally generated maps, the same parameters and
+// seed always generate the same map
+typedef struct mapGenParams {
+    uint8_t columns;
+    uint8_t rows;
+    // chance of a cell inside the border having a wall
+    float wallDensity;
+    // relative chances of a wall being a standard, bouncy or death wall
+    float standardWallWeight;
+    float bouncyWallWeight;
+    float deathWallWeight;
+    enum mapSymmetry symmetry;
+    uint8_t floatingStandardWalls;
+    uint8_t floatingBouncyWalls;
+    uint8_t floatingDeathWalls;
+    uint16_t weaponPickups;
+    enum weaponType defaultWeapon;
+    // drones that must be able to spawn on the map
+    uint8_t numDrones;
+} mapGenParams;
+
+// a wall placed by a map's layout
+typedef struct mapTemplateWall {
+    b2Vec2 pos;
+    float thickness;
+    enum entityType type;
+    bool floating;
+    uint16_t cellIdx;
+} mapTemplateWall;
+
+// the parts of a map that are the same every episode, built once from
+// the map's layout so setting up an episode only has to create the walls
+typedef struct mapTemplate {
+    uint8_t columns;
+    uint8_t rows;
+    uint8_t floatingStandardWalls;
+    uint8_t floatingBouncyWalls;
+    uint8_t floatingDeathWalls;
+    uint16_t weaponPickups;
+    enum weaponType defaultWeapon;
+    uint16_t numWalls;
+    mapTemplateWall walls[MAX_CELLS];
+    uint16_t numCells;
+    uint8_t wallTypes[MAX_CELLS];
+    b2Vec2 positions[MAX_CELLS];
+    // set if a static wall is too close to the cell for drones to spawn there
+    bool droneSpawnBlocked[MAX_CELLS];
+    mapBounds bounds;
+} mapTemplate;
+
+typedef struct mapFileHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t numMaps;
+    uint32_t reserved;
+    uint64_t indexOffset;
+} mapFileHeader;
+
+// a map stored in a map file, followed by its layout and whether drones
+// can't spawn at each cell
+typedef struct mapFileRecord {
+    uint8_t columns;
+    uint8_t rows;
+    uint8_t floatingStandardWalls;
+    uint8_t floatingBouncyWalls;
+    uint8_t floatingDeathWalls;
+    uint8_t defaultWeapon;
+    uint16_t weaponPickups;
+    mapBounds bounds;
+} mapFileRecord;
+
+// the maps of a memory mapped map file
+typedef struct mapLibrary {
+    // unique for the life of the process so cached maps of a closed
+    // library are never mistaken for maps of a library opened later
+    uint32_t id;
+    void *data;
+    size_t size;
+    uint32_t numMaps;
+    const uint64_t *offsets;
+} mapLibrary;
+
+#define _MAP_CACHE_SIZE 64
+
+// a compiled generated map, kept around so reusing a map only costs a
+// cache lookup
+typedef struct mapCacheEntry {
+    bool valid;
+    uint64_t lastUsed;
+    // the map file library and index the map was compiled from, the
+    // library id is 0 for generated maps
+    uint32_t libraryId;
+    uint32_t libraryIdx;
+    uint64_t seed;
+    mapGenParams params;
+    mapTemplate tmpl;
+} mapCacheEntry;
+
 typedef struct cachedPos {
     b2Vec2 pos;
     bool valid;
@@ -84,6 +254,20 @@ typedef struct wallEntity {
     enum entityType type;
 } wallEntity;
 
+// scripted behavior of drones that aren't controlled by agents
+enum botType {
+    NO_BOT,
+    AIM_NEAREST_BOT,
+    STRAFE_BOT,
+    PICKUP_SEEKER_BOT,
+    DODGE_BOT,
+    // controlled by a frozen policy, see inference.h
+    POLICY_BOT,
+};
+
+#define _NUM_BOT_TYPES 6
+const uint8_t NUM_BOT_TYPES = _NUM_BOT_TYPES;
+
 typedef struct weaponInformation {
     const enum weaponType type;
     const bool isPhysicsBullet;
@@ -159,24 +343,59 @@ typedef struct droneEntity {
     bool dead;
     int killedBy;
     int lives;
-
-    // New fields for multidiscrete action space
-    uint8_t aim_action;
-    uint8_t booster_action;
-    uint8_t fire_action;
-    uint8_t rotation_speed_action;
 } droneEntity;
 
-typedef struct logEntry {
-    float length;
-    droneStats stats[_MAX_DRONES];
-} logEntry;
-
-typedef struct logBuffer {
-    logEntry *logs;
-    uint16_t size;
-    uint16_t capacity;
-} logBuffer;
+// a discrete action decoded into what is applied to the drone every
+// frame of a step
+typedef struct droneAction {
+    b2Rot aimRotation;
+    b2Vec2 boost;
+    bool fire;
+} droneAction;
+
+// number of floats in droneStats, it's treated as a flat float array
+// when stats are accumulated
+#define _NUM_DRONE_STATS (4 + (6 * _NUM_WEAPONS))
+// episode length followed by the stats of every drone
+#define _NUM_LOG_STATS (1 + (_MAX_DRONES * _NUM_DRONE_STATS))
+#define _NUM_STAT_QUANTILES 3
+#define _NUM_SKETCH_MARKERS 5
+
+// P² quantile estimator state, see https://www.cse.wustl.edu/~jain/papers/ftp/psqr.pdf;
+// the first 5 values are stored sorted in heights until the markers
+// can be initialized
+typedef struct quantileSketch {
+    float heights[_NUM_SKETCH_MARKERS];
+    float positions[_NUM_SKETCH_MARKERS];
+    float desired[_NUM_SKETCH_MARKERS];
+} quantileSketch;
+
+// running mean and variance are computed with Welford's algorithm
+typedef struct runningStat {
+    float mean;
+    float m2;
+    float min;
+    float max;
+    quantileSketch quantiles[_NUM_STAT_QUANTILES];
+} runningStat;
+
+// streaming accumulator of finished episode stats, every stat is
+// updated once per episode so they all share the same count
+typedef struct statsAccumulator {
+    uint8_t numDrones;
+    uint32_t count;
+    runningStat stats[_NUM_LOG_STATS];
+} statsAccumulator;
+
+#ifndef AUTOPXD
+// static walls drawn once per map, redrawn when the env being rendered
+// changes or its static walls change
+typedef struct staticLayer {
+    RenderTexture2D texture;
+    const struct env *env;
+    uint32_t wallsVersion;
+} staticLayer;
+#endif
 
 typedef struct rayClient {
     float scale;
@@ -184,11 +403,95 @@ typedef struct rayClient {
     uint16_t height;
     uint16_t halfWidth;
     uint16_t halfHeight;
+#ifndef AUTOPXD
+    // set if the window is hidden and only used to render offscreen
+    bool headless;
+    staticLayer staticLayer;
+#endif
 } rayClient;
 
+typedef struct replayRecorder replayRecorder;
+
+enum videoFormat {
+    Y4M_VIDEO,
+    PNG_VIDEO,
+    NUM_VIDEO_FORMATS,
+};
+
+typedef struct videoRecorder videoRecorder;
+
+#define _SNAPSHOT_MAX_FLOATING_WALLS 64
+#define _SNAPSHOT_MAX_PICKUPS 64
+#define _SNAPSHOT_MAX_PROJECTILES 256
+
+// what the live viewer draws of an env, copied from the env every step
+// so the viewer never reads the env while it's being stepped
+typedef struct floatingWallSnapshot {
+    b2Vec2 pos;
+    float angle;
+    enum entityType type;
+} floatingWallSnapshot;
+
+typedef struct pickupSnapshot {
+    b2Vec2 pos;
+    enum weaponType weapon;
+} pickupSnapshot;
+
+typedef struct projectileSnapshot {
+    b2Vec2 pos;
+    float radius;
+} projectileSnapshot;
+
+typedef struct droneSnapshot {
+    b2Vec2 pos;
+    b2Vec2 aim;
+    enum weaponType weapon;
+    int8_t ammo;
+    // fraction of the weapon cooldown and charge left
+    float cooldown;
+    float charge;
+    bool dead;
+} droneSnapshot;
+
+typedef struct envSnapshot {
+    uint8_t columns;
+    uint8_t rows;
+    // static wall types of each cell like mapCells, only copied when
+    // wallsVersion differs from the env's
+    uint32_t wallsVersion;
+    uint8_t wallTypes[MAX_CELLS];
+    uint16_t stepsLeft;
+
+    uint8_t numDrones;
+    droneSnapshot drones[_MAX_DRONES];
+    uint8_t numFloatingWalls;
+    floatingWallSnapshot floatingWalls[_SNAPSHOT_MAX_FLOATING_WALLS];
+    uint8_t numPickups;
+    pickupSnapshot pickups[_SNAPSHOT_MAX_PICKUPS];
+    uint16_t numProjectiles;
+    projectileSnapshot projectiles[_SNAPSHOT_MAX_PROJECTILES];
+} envSnapshot;
+
+typedef struct snapshotBuffer snapshotBuffer;
+typedef struct envViewer envViewer;
+
+#define _ARENA_SIZE_CLASSES 16
+
+// per env allocator for entities, see arena.h
+typedef struct envArena {
+    uint8_t *blocks;
+    uint8_t *current;
+    size_t used;
+    void *freeLists[_ARENA_SIZE_CLASSES];
+} envArena;
+
 typedef struct env {
     uint8_t numDrones;
     uint8_t numAgents;
+    // drones after the agents are controlled by bots
+    enum botType botTypes[_MAX_DRONES];
+    // discrete actions of policy bots, indexed by drone
+    int botActions[_MAX_DRONES * 4];
 
     uint8_t *obs;
     float *rewards;
@@ -197,20 +500,49 @@ typedef struct env {
 
     uint64_t randState;
     bool needsReset;
+    // set when the env's episodes are being recorded
+    replayRecorder *recorder;
+    // set when the env is rendered every step and recorded to a video
+    videoRecorder *videoRecorder;
+    // set if agents observe pixel obs instead of map cell obs, static
+    // walls are rasterized once into pixelWalls when they change
+    bool pixelObs;
+    uint8_t *pixelWalls;
+    uint32_t pixelWallsVersion;
+    // set when the env is shown by a live viewer, snapshots of the env
+    // are published to it every step
+    snapshotBuffer *snapshotBuffer;
 
     uint16_t episodeLength;
-    logBuffer *logs;
+    statsAccumulator *logs;
     droneStats stats[_MAX_DRONES];
 
     b2WorldId worldID;
+    uint8_t mapIdx;
+    // probability of each map being picked when an episode starts
+    float mapWeights[_NUM_MAPS];
+    // if set maps are generated from mapGen instead of being sampled
+    // from the predefined maps
+    bool generateMaps;
+    mapGenParams mapGen;
+    // how many different maps are generated, 0 generates a new map
+    // every episode
+    uint32_t mapPoolSize;
+    // if set and maps aren't generated maps are sampled from a map file
+    const mapLibrary *mapLibrary;
     uint8_t columns;
     uint8_t rows;
+    // the index of the map obs cell the map's first cell is written to
+    uint16_t obsCellOffset;
     mapBounds bounds;
     weaponInformation *defaultWeapon;
-    CC_Array *cells;
+    mapCells cells;
     CC_Array *walls;
     CC_Array *floatingWalls;
-    CC_Array *drones;
+    envArena arena;
+    // every entity with a shape, referenced by the shapes' user data
+    entityTable entities;
+    droneEntity drones[_MAX_DRONES];
     CC_Array *pickups;
     CC_SList *projectiles;
 
@@ -222,6 +554,8 @@ typedef struct env {
     uint8_t suddenDeathWallCounter;
 
     rayClient *client;
+    // incremented when static walls are created
+    uint32_t staticWallsVersion;
 
     // used for rendering explosions
     // TODO: use hitInfo
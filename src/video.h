@@ -0,0 +1,246 @@
+#ifndef IMPULSE_WARS_VIDEO_H
+#define IMPULSE_WARS_VIDEO_H
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+#include "raylib.h"
+
+#include "helpers.h"
+#include "settings.h"
+#include "types.h"
+
+// Video recorders record envs that are rendered offscreen every step.
+// Rendered frames are read back into a ring of frames and written to
+// disk by a background thread, so stepping only waits on the encoder if
+// it falls a whole ring of frames behind. Frames are written either as a
+// y4m video (raw 4:2:0 YCbCr frames that ffmpeg and most players read
+// directly) or as a directory of numbered PNG images.
+//
+// The encoder thread only uses the system allocator and raylib's image
+// functions that don't touch the GPU, everything that does is done on
+// the thread the env is stepped on.
+
+#define VIDEO_RING_SIZE 8
+#define VIDEO_WRITE_BUFFER_SIZE (1 << 20)
+#define VIDEO_FRAME_RATE ((int)(FRAME_RATE / FRAMESKIP))
+
+typedef struct videoRecorder {
+    enum videoFormat format;
+    // y4m videos are written to file, PNG images to dir, framePath
+    // holds the path of the image being written
+    FILE *file;
+    char *dir;
+    char *framePath;
+    uint16_t width;
+    uint16_t height;
+    // envs are rendered to frame, each recorder has its own static
+    // layer as envs recorded together are rendered alternately
+    RenderTexture2D frame;
+    staticLayer staticLayer;
+
+    // frames are added at head + count and written from head
+    Image frames[VIDEO_RING_SIZE];
+    uint8_t head;
+    uint8_t count;
+    bool stopping;
+    bool failed;
+    uint32_t framesWritten;
+    // converted y4m frames, only used by the encoder thread
+    uint8_t *planes;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t frameAdded;
+    pthread_cond_t frameWritten;
+} videoRecorder;
+
+static inline uint8_t clampByte(const int v) {
+    return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+// converts a frame to full range BT.601 YCbCr with chroma averaged over
+// 2x2 blocks; frames read back from render textures are upside down
+void writeY4MFrame(videoRecorder *recorder, const Image *frame) {
+    const uint16_t width = recorder->width;
+    const uint16_t height = recorder->height;
+    const uint32_t lumaSize = width * height;
+    const uint16_t chromaWidth = width / 2;
+    uint8_t *lumaPlane = recorder->planes;
+    uint8_t *cbPlane = lumaPlane + lumaSize;
+    uint8_t *crPlane = cbPlane + (lumaSize / 4);
+
+    const uint8_t *pixels = (const uint8_t *)frame->data;
+    const uint32_t stride = frame->width * 4;
+    for (uint16_t y = 0; y < height; y += 2) {
+        const uint8_t *rows[2] = {
+            pixels + ((frame->height - 1 - y) * stride),
+            pixels + ((frame->height - 2 - y) * stride),
+        };
+        for (uint16_t x = 0; x < width; x += 2) {
+            int r = 0;
+            int g = 0;
+            int b = 0;
+            for (uint8_t i = 0; i < 4; i++) {
+                const uint8_t *pixel = rows[i / 2] + ((x + (i % 2)) * 4);
+                // 16 bit fixed point coefficients
+                lumaPlane[((y + (i / 2)) * width) + x + (i % 2)] = (19595 * pixel[0] + 38470 * pixel[1] + 7471 * pixel[2] + 32768) >> 16;
+                r += pixel[0];
+                g += pixel[1];
+                b += pixel[2];
+            }
+            const uint32_t chromaIdx = ((y / 2) * chromaWidth) + (x / 2);
+            cbPlane[chromaIdx] = clampByte(128 + ((-11059 * r - 21709 * g + 32768 * b + 131072) >> 18));
+            crPlane[chromaIdx] = clampByte(128 + ((32768 * r - 27439 * g - 5329 * b + 131072) >> 18));
+        }
+    }
+
+    fputs("FRAME\n", recorder->file);
+    fwrite(recorder->planes, sizeof(uint8_t), lumaSize + (lumaSize / 2), recorder->file);
+    if (ferror(recorder->file)) {
+        recorder->failed = true;
+    }
+}
+
+void writePNGFrame(videoRecorder *recorder, Image *frame) {
+    ImageFlipVertical(frame);
+    sprintf(recorder->framePath, "%s/%08u.png", recorder->dir, recorder->framesWritten);
+    if (!ExportImage(*frame, recorder->framePath)) {
+        recorder->failed = true;
+    }
+}
+
+void *videoEncoderThread(void *arg) {
+    videoRecorder *recorder = (videoRecorder *)arg;
+
+    while (true) {
+        pthread_mutex_lock(&recorder->lock);
+        while (recorder->count == 0 && !recorder->stopping) {
+            pthread_cond_wait(&recorder->frameAdded, &recorder->lock);
+        }
+        if (recorder->count == 0) {
+            pthread_mutex_unlock(&recorder->lock);
+            break;
+        }
+        // the slot isn't reused until count is decremented, so it can be
+        // written without holding the lock
+        Image *frame = &recorder->frames[recorder->head];
+        pthread_mutex_unlock(&recorder->lock);
+
+        if (!recorder->failed) {
+            if (recorder->format == Y4M_VIDEO) {
+                writeY4MFrame(recorder, frame);
+            } else {
+                writePNGFrame(recorder, frame);
+            }
+        }
+        UnloadImage(*frame);
+
+        pthread_mutex_lock(&recorder->lock);
+        recorder->framesWritten++;
+        recorder->head = (recorder->head + 1) % VIDEO_RING_SIZE;
+        recorder->count--;
+        pthread_cond_signal(&recorder->frameWritten);
+        pthread_mutex_unlock(&recorder->lock);
+    }
+
+    return NULL;
+}
+
+// creates a recorder of width x height frames, y4m videos are written
+// to the file at path and PNG images to the directory at path, which is
+// created if needed; returns NULL if path couldn't be used. Must be called
+// on the thread the ray client was created on
+videoRecorder *createVideoRecorder(const char *path, const enum videoFormat format, const uint16_t width, const uint16_t height) {
+    ASSERT(format < NUM_VIDEO_FORMATS);
+    videoRecorder *recorder = (videoRecorder *)fastCalloc(1, sizeof(videoRecorder));
+    recorder->format = format;
+    // 4:2:0 chroma subsampling needs even dimensions
+    recorder->width = width & ~1;
+    recorder->height = height & ~1;
+
+    if (format == Y4M_VIDEO) {
+        recorder->file = fopen(path, "wb");
+        if (recorder->file == NULL) {
+            DEBUG_LOGF("failed to create video file %s", path);
+            fastFree(recorder);
+            return NULL;
+        }
+        setvbuf(recorder->file, NULL, _IOFBF, VIDEO_WRITE_BUFFER_SIZE);
+        fprintf(recorder->file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", recorder->width, recorder->height, VIDEO_FRAME_RATE);
+        const uint32_t lumaSize = recorder->width * recorder->height;
+        recorder->planes = (uint8_t *)fastMalloc(lumaSize + (lumaSize / 2));
+    } else {
+        if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+            DEBUG_LOGF("failed to create video frame directory %s", path);
+            fastFree(recorder);
+            return NULL;
+        }
+        recorder->dir = (char *)fastMalloc(strlen(path) + 1);
+        strcpy(recorder->dir, path);
+        // room for the separator, 10 digits and the extension
+        recorder->framePath = (char *)fastMalloc(strlen(path) + 16);
+    }
+
+    recorder->frame = LoadRenderTexture(width, height);
+    recorder->staticLayer.texture = LoadRenderTexture(width, height);
+
+    pthread_mutex_init(&recorder->lock, NULL);
+    pthread_cond_init(&recorder->frameAdded, NULL);
+    pthread_cond_init(&recorder->frameWritten, NULL);
+    if (pthread_create(&recorder->thread, NULL, videoEncoderThread, recorder) != 0) {
+        ERROR("failed to start video encoder thread");
+    }
+
+    return recorder;
+}
+
+// reads back the last rendered frame and queues it to be written, only
+// waits if the encoder thread is a whole ring of frames behind
+void recordVideoFrame(videoRecorder *recorder) {
+    const Image frame = LoadImageFromTexture(recorder->frame.texture);
+    ASSERT(frame.format == PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+
+    pthread_mutex_lock(&recorder->lock);
+    while (recorder->count == VIDEO_RING_SIZE) {
+        pthread_cond_wait(&recorder->frameWritten, &recorder->lock);
+    }
+    recorder->frames[(recorder->head + recorder->count) % VIDEO_RING_SIZE] = frame;
+    recorder->count++;
+    pthread_cond_signal(&recorder->frameAdded);
+    pthread_mutex_unlock(&recorder->lock);
+}
+
+// writes the queued frames and closes the recorder, returns false if
+// any frame failed to be written
+bool destroyVideoRecorder(videoRecorder *recorder) {
+    pthread_mutex_lock(&recorder->lock);
+    recorder->stopping = true;
+    pthread_cond_signal(&recorder->frameAdded);
+    pthread_mutex_unlock(&recorder->lock);
+    pthread_join(recorder->thread, NULL);
+
+    pthread_mutex_destroy(&recorder->lock);
+    pthread_cond_destroy(&recorder->frameAdded);
+    pthread_cond_destroy(&recorder->frameWritten);
+
+    UnloadRenderTexture(recorder->frame);
+    UnloadRenderTexture(recorder->staticLayer.texture);
+
+    bool ok = !recorder->failed;
+    if (recorder->file != NULL) {
+        ok = fclose(recorder->file) == 0 && ok;
+    }
+    if (!ok) {
+        DEBUG_LOG("failed to write video frames");
+    }
+    fastFree(recorder->planes);
+    fastFree(recorder->dir);
+    fastFree(recorder->framePath);
+    fastFree(recorder);
+    return ok;
+}
+
+#endif
@@ -0,0 +1,317 @@
+#ifndef IMPULSE_WARS_VIEWER_H
+#define IMPULSE_WARS_VIEWER_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "raylib.h"
+
+#include "game.h"
+#include "helpers.h"
+#include "render.h"
+#include "settings.h"
+#include "types.h"
+
+// A live viewer draws a grid of envs in its own window on its own
+// thread at a fixed frame rate, no matter how fast the envs are stepped.
+// Envs publish a snapshot of what is drawn every step and the viewer
+// draws the latest snapshot of each env, so neither the stepping thread
+// nor the viewer ever waits on the other.
+//
+// Snapshots are double buffered with a spare buffer: the env writes to
+// its back buffer and swaps it with the latest buffer, the viewer swaps
+// the latest buffer with its front buffer if a newer one was published.
+// Each side only ever touches its own buffer, the swaps are atomic so
+// no locks are needed.
+//
+// raylib only supports one window per process, so a viewer can't be
+// used while envs are rendered or recorded to videos.
+
+#define VIEWER_LABEL_HEIGHT 20
+#define VIEWER_TILE_PADDING 4
+// set on the latest buffer index until the viewer takes it
+#define SNAPSHOT_FRESH 0x80
+
+typedef struct snapshotBuffer {
+    envSnapshot snapshots[3];
+    // only used by the stepping thread
+    uint8_t back;
+    // only used by the viewer thread
+    uint8_t front;
+    _Atomic uint8_t latest;
+} snapshotBuffer;
+
+typedef struct envViewer {
+    env *envs;
+    uint16_t numEnvs;
+    snapshotBuffer *buffers;
+    uint16_t fps;
+    uint16_t width;
+    uint16_t height;
+    uint16_t tileColumns;
+    uint16_t tileRows;
+
+    pthread_t thread;
+    atomic_bool running;
+} envViewer;
+
+// where a tile's map is drawn: the screen position of the map's center
+// and pixels per world unit
+typedef struct viewerTile {
+    float x;
+    float y;
+    float scale;
+} viewerTile;
+
+static inline Vector2 tileVec(const viewerTile *tile, const b2Vec2 v) {
+    return (Vector2){.x = tile->x + (v.x * tile->scale), .y = tile->y + (v.y * tile->scale)};
+}
+
+// copies what is drawn of the env into its back buffer and publishes it
+void publishEnvSnapshot(env *e) {
+    snapshotBuffer *buffer = e->snapshotBuffer;
+    envSnapshot *snapshot = &buffer->snapshots[buffer->back];
+
+    if (snapshot->wallsVersion != e->staticWallsVersion || snapshot->columns != e->columns || snapshot->rows != e->rows) {
+        snapshot->columns = e->columns;
+        snapshot->rows = e->rows;
+        memcpy(snapshot->wallTypes, e->cells.wallTypes, e->columns * e->rows * sizeof(uint8_t));
+        snapshot->wallsVersion = e->staticWallsVersion;
+    }
+    snapshot->stepsLeft = e->stepsLeft;
+
+    snapshot->numDrones = e->numDrones;
+    for (uint8_t i = 0; i < e->numDrones; i++) {
+        droneEntity *drone = &e->drones[i];
+        droneSnapshot *droneSnap = &snapshot->drones[i];
+        droneSnap->pos = getCachedPos(drone->bodyID, &drone->pos);
+        droneSnap->aim = drone->lastAim;
+        droneSnap->weapon = drone->weaponInfo->type;
+        droneSnap->ammo = drone->ammo;
+        droneSnap->cooldown = 0.0f;
+        if (drone->weaponInfo->coolDown != 0.0f) {
+            droneSnap->cooldown = drone->weaponCooldown / drone->weaponInfo->coolDown;
+        }
+        droneSnap->charge = 0.0f;
+        const uint16_t maxCharge = weaponCharge(drone->weaponInfo->type);
+        if (maxCharge != 0) {
+            droneSnap->charge = (float)drone->charge / maxCharge;
+        }
+        droneSnap->dead = drone->dead;
+    }
+
+    // the viewer only needs to show what is going on, anything past
+    // the snapshot's capacity isn't drawn
+    snapshot->numFloatingWalls = 0;
+    for (size_t i = 0; i < cc_array_size(e->floatingWalls) && i < _SNAPSHOT_MAX_FLOATING_WALLS; i++) {
+        wallEntity *wall = safe_array_get_at(e->floatingWalls, i);
+        snapshot->floatingWalls[snapshot->numFloatingWalls++] = (floatingWallSnapshot){
+            .pos = getCachedPos(wall->bodyID, &wall->pos),
+            .angle = b2Rot_GetAngle(b2Body_GetRotation(wall->bodyID)),
+            .type = wall->type,
+        };
+    }
+
+    snapshot->numPickups = 0;
+    for (size_t i = 0; i < cc_array_size(e->pickups) && snapshot->numPickups < _SNAPSHOT_MAX_PICKUPS; i++) {
+        const weaponPickupEntity *pickup = safe_array_get_at(e->pickups, i);
+        if (pickup->respawnWait != 0.0f || pickup->floatingWallsTouching != 0) {
+            continue;
+        }
+        snapshot->pickups[snapshot->numPickups++] = (pickupSnapshot){
+            .pos = e->cells.positions[pickup->mapCellIdx],
+            .weapon = pickup->weapon,
+        };
+    }
+
+    snapshot->numProjectiles = 0;
+    for (SNode *cur = e->projectiles->head; cur != NULL && snapshot->numProjectiles < _SNAPSHOT_MAX_PROJECTILES; cur = cur->next) {
+        const projectileEntity *projectile = (projectileEntity *)cur->data;
+        snapshot->projectiles[snapshot->numProjectiles++] = (projectileSnapshot){
+            .pos = projectile->lastPos,
+            .radius = projectile->weaponInfo->radius,
+        };
+    }
+
+    buffer->back = atomic_exchange(&buffer->latest, buffer->back | SNAPSHOT_FRESH) & ~SNAPSHOT_FRESH;
+}
+
+// returns the latest snapshot the env published, only called by the
+// viewer thread
+const envSnapshot *latestEnvSnapshot(snapshotBuffer *buffer) {
+    if ((atomic_load(&buffer->latest) & SNAPSHOT_FRESH) != 0) {
+        buffer->front = atomic_exchange(&buffer->latest, buffer->front) & ~SNAPSHOT_FRESH;
+    }
+    return &buffer->snapshots[buffer->front];
+}
+
+void drawEnvSnapshot(const envSnapshot *snapshot, const viewerTile *tile) {
+    // cells are positioned the same way map.h positions them
+    const float cellSize = WALL_THICKNESS * tile->scale;
+    for (uint8_t row = 0; row < snapshot->rows; row++) {
+        for (uint8_t col = 0; col < snapshot->columns; col++) {
+            const uint8_t wallType = snapshot->wallTypes[col + (row * snapshot->columns)];
+            if (wallType == 0) {
+                continue;
+            }
+            const b2Vec2 corner = {
+                .x = (col - (snapshot->columns / 2.0f)) * WALL_THICKNESS,
+                .y = ((snapshot->rows / 2.0f) - (snapshot->rows - row)) * WALL_THICKNESS,
+            };
+            DrawRectangleV(tileVec(tile, corner), (Vector2){.x = cellSize, .y = cellSize}, getWallColor(wallType - 1));
+        }
+    }
+
+    const float wallSize = FLOATING_WALL_THICKNESS * tile->scale;
+    for (uint8_t i = 0; i < snapshot->numFloatingWalls; i++) {
+        const floatingWallSnapshot *wall = &snapshot->floatingWalls[i];
+        const Vector2 pos = tileVec(tile, wall->pos);
+        const Rectangle rec = {.x = pos.x, .y = pos.y, .width = wallSize, .height = wallSize};
+        DrawRectanglePro(rec, (Vector2){.x = wallSize / 2.0f, .y = wallSize / 2.0f}, wall->angle * RAD2DEG, getWallColor(wall->type));
+    }
+
+    const float pickupSize = PICKUP_THICKNESS * tile->scale;
+    for (uint8_t i = 0; i < snapshot->numPickups; i++) {
+        const Vector2 pos = tileVec(tile, snapshot->pickups[i].pos);
+        const Rectangle rec = {.x = pos.x, .y = pos.y, .width = pickupSize, .height = pickupSize};
+        DrawRectanglePro(rec, (Vector2){.x = pickupSize / 2.0f, .y = pickupSize / 2.0f}, 0.0f, LIME);
+    }
+
+    for (uint16_t i = 0; i < snapshot->numProjectiles; i++) {
+        const projectileSnapshot *projectile = &snapshot->projectiles[i];
+        DrawCircleV(tileVec(tile, projectile->pos), fmaxf(projectile->radius * tile->scale, 1.0f), PURPLE);
+    }
+
+    const float radius = DRONE_RADIUS * tile->scale;
+    for (uint8_t i = 0; i < snapshot->numDrones; i++) {
+        const droneSnapshot *drone = &snapshot->drones[i];
+        if (drone->dead) {
+            continue;
+        }
+        const Color color = getDroneColor(i);
+        const Vector2 pos = tileVec(tile, drone->pos);
+        const Vector2 aimEnd = tileVec(tile, b2MulAdd(drone->pos, 2.0f * DRONE_RADIUS, drone->aim));
+        DrawLineEx(pos, aimEnd, fmaxf(aimGuideHeight * tile->scale, 1.0f), color);
+        DrawCircleV(pos, radius, BLACK);
+        DrawCircleLinesV(pos, radius, color);
+
+        // cooldown meter, or charge meter while a weapon is charging
+        const float meter = drone->cooldown != 0.0f ? drone->cooldown : drone->charge;
+        if (meter != 0.0f) {
+            const Rectangle rec = {
+                .x = pos.x - radius,
+                .y = pos.y + (1.5f * radius),
+                .width = 2.0f * radius * fminf(meter, 1.0f),
+                .height = fmaxf(radius / 3.0f, 1.0f),
+            };
+            DrawRectangleRec(rec, RAYWHITE);
+        }
+    }
+}
+
+void drawViewerTile(envViewer *viewer, const uint16_t idx) {
+    const float tileWidth = (float)viewer->width / viewer->tileColumns;
+    const float tileHeight = (float)viewer->height / viewer->tileRows;
+    const Rectangle bounds = {
+        .x = (idx % viewer->tileColumns) * tileWidth,
+        .y = (idx / viewer->tileColumns) * tileHeight,
+        .width = tileWidth,
+        .height = tileHeight,
+    };
+    DrawRectangleLinesEx(bounds, 1.0f, DARKGRAY);
+
+    const envSnapshot *snapshot = latestEnvSnapshot(&viewer->buffers[idx]);
+    const int bufferSize = 32;
+    char label[bufferSize];
+    if (snapshot->columns == 0) {
+        snprintf(label, bufferSize, "env %d", idx);
+    } else if (snapshot->stepsLeft == 0) {
+        snprintf(label, bufferSize, "env %d  SUDDEN DEATH", idx);
+    } else {
+        snprintf(label, bufferSize, "env %d  %d", idx, (uint16_t)(snapshot->stepsLeft / FRAME_RATE));
+    }
+    DrawText(label, bounds.x + VIEWER_TILE_PADDING, bounds.y + VIEWER_TILE_PADDING, VIEWER_LABEL_HEIGHT - VIEWER_TILE_PADDING, WHITE);
+    // nothing has been published yet
+    if (snapshot->columns == 0) {
+        return;
+    }
+
+    const float mapWidth = tileWidth - (2 * VIEWER_TILE_PADDING);
+    const float mapHeight = tileHeight - VIEWER_LABEL_HEIGHT - (2 * VIEWER_TILE_PADDING);
+    const viewerTile tile = {
+        .x = bounds.x + (tileWidth / 2.0f),
+        .y = bounds.y + VIEWER_LABEL_HEIGHT + VIEWER_TILE_PADDING + (mapHeight / 2.0f),
+        .scale = fminf(mapWidth / (snapshot->columns * WALL_THICKNESS), mapHeight / (snapshot->rows * WALL_THICKNESS)),
+    };
+    drawEnvSnapshot(snapshot, &tile);
+}
+
+void *envViewerThread(void *arg) {
+    envViewer *viewer = (envViewer *)arg;
+
+    SetConfigFlags(FLAG_MSAA_4X_HINT);
+    InitWindow(viewer->width, viewer->height, "Impulse Wars");
+    SetTargetFPS(viewer->fps);
+
+    while (atomic_load(&viewer->running) && !WindowShouldClose()) {
+        BeginDrawing();
+        ClearBackground(BLACK);
+        for (uint16_t i = 0; i < viewer->numEnvs; i++) {
+            drawViewerTile(viewer, i);
+        }
+        EndDrawing();
+    }
+
+    CloseWindow();
+    return NULL;
+}
+
+// shows the first numEnvs envs of envs in a new window drawn at fps
+// frames per second. Envs must not be stepped while the viewer is
+// created or destroyed
+envViewer *createEnvViewer(env *envs, const uint16_t numEnvs, const uint16_t fps) {
+    ASSERT(numEnvs != 0);
+    ASSERT(fps != 0);
+    envViewer *viewer = (envViewer *)fastCalloc(1, sizeof(envViewer));
+    viewer->envs = envs;
+    viewer->numEnvs = numEnvs;
+    viewer->fps = fps;
+    viewer->width = DEFAULT_WIDTH;
+    viewer->height = DEFAULT_HEIGHT;
+    viewer->tileColumns = (uint16_t)ceilf(sqrtf(numEnvs));
+    viewer->tileRows = (numEnvs + viewer->tileColumns - 1) / viewer->tileColumns;
+
+    viewer->buffers = (snapshotBuffer *)fastCalloc(numEnvs, sizeof(snapshotBuffer));
+    for (uint16_t i = 0; i < numEnvs; i++) {
+        snapshotBuffer *buffer = &viewer->buffers[i];
+        buffer->back = 0;
+        buffer->front = 1;
+        atomic_init(&buffer->latest, 2);
+        // make sure the static walls are copied the first time each
+        // buffer is published
+        for (uint8_t j = 0; j < 3; j++) {
+            buffer->snapshots[j].wallsVersion = envs[i].staticWallsVersion - 1;
+        }
+        envs[i].snapshotBuffer = buffer;
+    }
+
+    atomic_init(&viewer->running, true);
+    if (pthread_create(&viewer->thread, NULL, envViewerThread, viewer) != 0) {
+        ERROR("failed to start viewer thread");
+    }
+
+    return viewer;
+}
+
+void destroyEnvViewer(envViewer *viewer) {
+    atomic_store(&viewer->running, false);
+    pthread_join(viewer->thread, NULL);
+
+    for (uint16_t i = 0; i < viewer->numEnvs; i++) {
+        viewer->envs[i].snapshotBuffer = NULL;
+    }
+    fastFree(viewer->buffers);
+    fastFree(viewer);
+}
+
+#endif
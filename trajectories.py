@@ -0,0 +1,193 @@
+import json
+import os
+from typing import Iterator, List
+
+import numpy as np
+import torch as th
+
+import pufferlib
+
+
+# Trajectories are stored in fixed capacity chunk files that are written
+# and read through memory maps, so neither side serializes anything.
+# Each chunk holds contiguous columns of shape (steps, agents, ...):
+#   observations (uint8), actions (uint8), rewards (float32), terminals (uint8)
+# The steps of each agent within a chunk form its trajectory, rows at the
+# same step index are from the same env step.
+# Every writer owns a directory with its chunks and an index.json that
+# is atomically rewritten whenever a chunk is finished.
+
+INDEX_FILE = "index.json"
+INDEX_VERSION = 1
+
+# all action components fit in a byte
+ACTION_DTYPE = np.uint8
+
+PAGE_SIZE = os.sysconf("SC_PAGE_SIZE")
+
+
+def chunkLayout(numAgents: int, obsSize: int, actionSize: int, capacity: int) -> List[tuple]:
+    """Returns (name, dtype, shape, offset) of each column in a chunk file"""
+    columns = [
+        ("observations", np.uint8, (capacity, numAgents, obsSize)),
+        ("actions", ACTION_DTYPE, (capacity, numAgents, actionSize)),
+        ("rewards", np.float32, (capacity, numAgents)),
+        ("terminals", np.uint8, (capacity, numAgents)),
+    ]
+
+    layout = []
+    offset = 0
+    for name, dtype, shape in columns:
+        # keep every column page aligned so they can be paged in separately
+        offset = (offset + PAGE_SIZE - 1) // PAGE_SIZE * PAGE_SIZE
+        layout.append((name, dtype, shape, offset))
+        offset += int(np.prod(shape)) * np.dtype(dtype).itemsize
+
+    return layout
+
+
+def chunkSize(layout: List[tuple]) -> int:
+    name, dtype, shape, offset = layout[-1]
+    return offset + int(np.prod(shape)) * np.dtype(dtype).itemsize
+
+
+def mapChunk(path: str, layout: List[tuple], mode: str) -> pufferlib.Namespace:
+    columns = {}
+    for name, dtype, shape, offset in layout:
+        columns[name] = np.memmap(path, dtype=dtype, mode=mode, offset=offset, shape=shape)
+    return pufferlib.Namespace(**columns)
+
+
+class TrajectoryWriter:
+    """Streams rollouts of an ImpulseWars env to memory mapped chunk files"""
+
+    def __init__(self, directory: str, numAgents: int, obsSize: int, actionSize: int, chunkSteps: int = 4096):
+        os.makedirs(directory, exist_ok=True)
+        self.directory = directory
+        self.numAgents = numAgents
+        self.obsSize = obsSize
+        self.actionSize = actionSize
+        self.chunkSteps = chunkSteps
+        self.layout = chunkLayout(numAgents, obsSize, actionSize, chunkSteps)
+
+        self.chunks = []
+        self.chunk = None
+        self.step = 0
+
+        # continue an existing dataset instead of overwriting it
+        indexPath = os.path.join(directory, INDEX_FILE)
+        if os.path.exists(indexPath):
+            with open(indexPath) as f:
+                index = json.load(f)
+            if (index["numAgents"], index["obsSize"], index["actionSize"], index["chunkSteps"]) != (
+                numAgents,
+                obsSize,
+                actionSize,
+                chunkSteps,
+            ):
+                raise ValueError(f"existing trajectory dataset in {directory} has a different layout")
+            self.chunks = index["chunks"]
+
+    def _newChunk(self):
+        path = os.path.join(self.directory, f"chunk_{len(self.chunks):06d}.bin")
+        with open(path, "wb") as f:
+            f.truncate(chunkSize(self.layout))
+        self.chunkPath = path
+        self.chunk = mapChunk(path, self.layout, "r+")
+        self.step = 0
+
+    def writeObservations(self, observations: np.ndarray, actions: np.ndarray):
+        """Writes the observations agents acted on and their actions, must
+        be called before the env is stepped"""
+        if self.chunk is None:
+            self._newChunk()
+        self.chunk.observations[self.step] = observations
+        self.chunk.actions[self.step] = actions
+
+    def writeOutcomes(self, rewards: np.ndarray, terminals: np.ndarray):
+        """Writes the rewards and terminals of the step, must be called
+        after the env is stepped"""
+        self.chunk.rewards[self.step] = rewards
+        self.chunk.terminals[self.step] = terminals
+        self.step += 1
+        if self.step == self.chunkSteps:
+            self._finishChunk()
+
+    def _finishChunk(self):
+        if self.chunk is None or self.step == 0:
+            return
+        for column in vars(self.chunk).values():
+            column.flush()
+        self.chunks.append({"file": os.path.basename(self.chunkPath), "steps": self.step})
+        self.chunk = None
+        self._writeIndex()
+
+    def _writeIndex(self):
+        index = {
+            "version": INDEX_VERSION,
+            "numAgents": self.numAgents,
+            "obsSize": self.obsSize,
+            "actionSize": self.actionSize,
+            "chunkSteps": self.chunkSteps,
+            "chunks": self.chunks,
+        }
+        tmpPath = os.path.join(self.directory, INDEX_FILE + ".tmp")
+        with open(tmpPath, "w") as f:
+            json.dump(index, f)
+        os.replace(tmpPath, os.path.join(self.directory, INDEX_FILE))
+
+    def close(self):
+        self._finishChunk()
+
+
+class TrajectoryDataset:
+    """Zero-copy reader of one or more trajectory datasets written by
+    TrajectoryWriter, chunks are memory mapped copy-on-write and paged
+    in by the OS as they are accessed; writes never reach the files"""
+
+    def __init__(self, directory: str):
+        self.chunks = []
+        for root, _, files in sorted(os.walk(directory)):
+            if INDEX_FILE not in files:
+                continue
+            with open(os.path.join(root, INDEX_FILE)) as f:
+                index = json.load(f)
+            if index["version"] != INDEX_VERSION:
+                raise ValueError(f"unsupported trajectory dataset version {index['version']} in {root}")
+
+            layout = chunkLayout(index["numAgents"], index["obsSize"], index["actionSize"], index["chunkSteps"])
+            for chunk in index["chunks"]:
+                self.chunks.append((os.path.join(root, chunk["file"]), layout, chunk["steps"]))
+
+        if len(self.chunks) == 0:
+            raise ValueError(f"no trajectory datasets found in {directory}")
+
+    def __len__(self) -> int:
+        return len(self.chunks)
+
+    @property
+    def steps(self) -> int:
+        return sum(steps for _, _, steps in self.chunks)
+
+    def chunk(self, idx: int) -> pufferlib.Namespace:
+        """Returns memory mapped columns of a chunk, trimmed to the steps
+        that were written"""
+        path, layout, steps = self.chunks[idx]
+        # copy-on-write instead of read only so tensors can share the memory
+        columns = mapChunk(path, layout, "c")
+        return pufferlib.Namespace(**{name: column[:steps] for name, column in vars(columns).items()})
+
+    def iterChunks(self, shuffle: bool = True, seed: int = None) -> Iterator[pufferlib.Namespace]:
+        order = np.arange(len(self.chunks))
+        if shuffle:
+            np.random.default_rng(seed).shuffle(order)
+        for idx in order:
+            yield self.chunk(idx)
+
+    def iterTensors(self, shuffle: bool = True, seed: int = None) -> Iterator[pufferlib.Namespace]:
+        """Yields chunks as CPU tensors sharing memory with the memory map,
+        moving them to a device is the first copy of the data"""
+        for chunk in self.iterChunks(shuffle, seed):
+            yield pufferlib.Namespace(
+                **{name: th.from_numpy(np.asarray(column)) for name, column in vars(chunk).items()}
+            )